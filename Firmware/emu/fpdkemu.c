@@ -0,0 +1,159 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//easypdk-emu: programmer firmware (fpdkusb.c command dispatcher) running on the host, served over a pseudo terminal
+//easypdk-emu-pin (FPDKEMU_PIN): same with bit bang engine fpdk.c driving the pin level IC model
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "fpdkemu.h"
+#include "fpdkicdata.h"
+#include "fpdkutil.h"
+#include "argp.h"
+
+#define FPDKEMU_USB_LATENCY_US   1000                                                              //default: host polls CDC endpoints once per frame
+#define FPDKEMU_USB_SPEED        1000000                                                           //default: bytes/s of full speed bulk transfers
+#define FPDKEMU_GPIO_NS          125                                                               //default: HAL_GPIO_WritePin on 48 MHz Cortex-M0
+
+#ifdef FPDKEMU_PIN
+const char *argp_program_version                = "easypdk-emu-pin 1.0";
+static const char fpdkemu_doc[]                 = "easypdk-emu-pin -- emulated Easy PDK programmer on a pseudo terminal, firmware bit bang engine drives pin level IC model with timing checks\nhttps://free-pdk.github.io";
+#else
+const char *argp_program_version                = "easypdk-emu 1.0";
+static const char fpdkemu_doc[]                 = "easypdk-emu -- emulated Easy PDK programmer with IC on a pseudo terminal\nhttps://free-pdk.github.io";
+#endif
+static const char fpdkemu_args_doc[]            = "";
+
+static struct argp_option fpdkemu_options[] = {
+  {"verbose",     'v', 0,      0,  "Verbose output" },
+  {"icname",      'n', "NAME", 0,  "IC in socket, e.g. PFS154. Default: PFS154" },
+  {"icdb",       448,  "FILE", 0,  "Load additional / modified IC definitions from file" },
+  {"link",        'l', "PATH", 0,  "Create symlink PATH to the pseudo terminal" },
+  {"usblatency", 444,  "US",   0,  "Simulated USB latency per transfer. Default: 1000 us" },
+  {"usbspeed",   445,  "BYTES/S", 0, "Simulated USB bandwidth, 0 = unlimited. Default: 1000000" },
+  {"noicdelay",  446,  0,      0,  "IC operations complete immediately (no modeled programming time)" },
+#ifdef FPDKEMU_PIN
+  {"gpions",     447,  "NS",   0,  "Duration of one GPIO access of the bit bang engine. Default: 125 ns" },
+#endif
+  { 0 }
+};
+
+struct fpdkemu_args {
+  int      verbose;
+  char     *ic;
+  char     *icdb;
+  char     *link;
+  uint32_t usblatency;
+  uint32_t usbspeed;
+  int      noicdelay;
+  uint32_t gpions;
+};
+
+static error_t fpdkemu_parse_opt(int key, char *arg, struct argp_state *state)
+{
+  struct fpdkemu_args *arguments = state->input;
+  switch (key)
+  {
+    case 'v': arguments->verbose = 1; break;
+    case 'n': arguments->ic = arg; break;
+    case 448: arguments->icdb = arg; break;
+    case 'l': arguments->link = arg; break;
+    case 444: if(arg) arguments->usblatency = strtoul(arg,NULL,0); break;
+    case 445: if(arg) arguments->usbspeed = strtoul(arg,NULL,0); break;
+    case 446: arguments->noicdelay = 1; break;
+    case 447: if(arg) arguments->gpions = strtoul(arg,NULL,0); break;
+
+    case ARGP_KEY_ARG:
+      argp_usage(state);
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+static struct argp argp = { fpdkemu_options, fpdkemu_parse_opt, fpdkemu_args_doc, fpdkemu_doc };
+
+static void _FPDKEMU_Signal(int sig)
+{
+  FPDKEMU_Stop();
+}
+
+int main( int argc, char * argv [] )
+{
+  struct fpdkemu_args arguments = { .ic = "PFS154", .usblatency = FPDKEMU_USB_LATENCY_US, .usbspeed = FPDKEMU_USB_SPEED, .gpions = FPDKEMU_GPIO_NS };
+  argp_parse(&argp, argc, argv, 0, 0, &arguments);
+  verbose_set(arguments.verbose);
+
+  if( arguments.icdb )
+  {
+    int r = FPDKICDATA_LoadDefinitions(arguments.icdb);
+    if( r<0 )
+    {
+      printf("ERROR: Could not load IC definitions from: %s\n", arguments.icdb);
+      return -1;
+    }
+    verbose_printf("Loaded %d IC definitions from: %s\n", r, arguments.icdb);
+  }
+
+  FPDKICDATA* icdata = FPDKICDATA_GetICDataByName(arguments.ic);
+  if( !icdata )
+  {
+    printf("ERROR: Unknown IC: %s\n", arguments.ic);
+    return -2;
+  }
+  if( (FPDK_IC_FLASH != icdata->type) && (FPDK_IC_OTP1 != icdata->type) )
+  {
+    printf("ERROR: IC type of %s is not supported by programmer\n", icdata->name);
+    return -3;
+  }
+
+  FPDKEMUIC ic = { .id12bit = icdata->id12bit, .type = icdata->type, .addressbits = icdata->addressbits,
+                   .codebits = icdata->codebits, .codewords = icdata->codewords,
+                   .write_block_size = icdata->write_block_size, .write_block_clock_groups = icdata->write_block_clock_groups,
+                   .write_block_clocks_per_group = icdata->write_block_clocks_per_group, .erase_clocks = icdata->erase_clocks,
+                   .vdd_write_hv_mv = icdata->vdd_write_hv*1000, .vpp_write_hv_mv = icdata->vpp_write_hv*1000,
+                   .vdd_erase_hv_mv = icdata->vdd_erase_hv*1000, .vpp_erase_hv_mv = icdata->vpp_erase_hv*1000 };
+#ifdef FPDKEMU_PIN
+  FPDKEMU_PIN_SetGPIOTime(arguments.gpions);
+#endif
+  FPDKEMU_IC_Setup(&ic, !arguments.noicdelay);
+
+  const char* port = FPDKEMU_USB_Open(arguments.link, arguments.usblatency, arguments.usbspeed);
+  if( !port )
+  {
+    printf("ERROR: Could not create pseudo terminal%s%s\n", arguments.link?" / link: ":"", arguments.link?arguments.link:"");
+    return -4;
+  }
+
+  signal(SIGINT, _FPDKEMU_Signal);
+  signal(SIGTERM, _FPDKEMU_Signal);
+  signal(SIGPIPE, SIG_IGN);
+
+  printf("Emulating %s on %s\n", icdata->name, port);
+  fflush(stdout);
+
+  FPDKEMU_Run();
+
+  if( arguments.link )
+    unlink(arguments.link);
+  return 0;
+}
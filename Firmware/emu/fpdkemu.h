@@ -0,0 +1,51 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __FPDKEMU_H_
+#define __FPDKEMU_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct FPDKEMUIC                                                                           //emulated IC in socket (subset of host FPDKICDATA)
+{
+  uint16_t id12bit;
+  char     type;                                                                                   //FPDKICTYPE value ('F', 'O')
+  uint8_t  addressbits;
+  uint8_t  codebits;
+  uint16_t codewords;
+  uint8_t  write_block_size;                                                                       //programming protocol (pin level model)
+  uint8_t  write_block_clock_groups;
+  uint8_t  write_block_clocks_per_group;
+  uint8_t  erase_clocks;
+  uint16_t vdd_write_hv_mv;
+  uint16_t vpp_write_hv_mv;
+  uint16_t vdd_erase_hv_mv;
+  uint16_t vpp_erase_hv_mv;
+} FPDKEMUIC;
+
+void     FPDKEMU_IC_Setup(const FPDKEMUIC* ic, const bool delays);
+void     FPDKEMU_PIN_SetGPIOTime(const uint32_t ns);                                               //easypdk-emu-pin: duration of one HAL GPIO access
+
+const char* FPDKEMU_USB_Open(const char* link, const uint32_t latency_us, const uint32_t speed);   //returns pty name, NULL on error
+void     FPDKEMU_Run(void);                                                                        //firmware main loop until FPDKEMU_Stop
+void     FPDKEMU_Stop(void);
+
+uint64_t FPDKEMU_GetMicroTicks(void);
+void     FPDKEMU_DelayUS(const uint64_t us);
+
+#endif //__FPDKEMU_H_
@@ -0,0 +1,626 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//IC in socket for easypdk-emu: implements the fpdk.h API on a memory array with the command flow, error codes
+//and (optional) durations of the bit bang engine in fpdk.c
+
+#include "fpdk.h"
+#include "fpdkproto.h"
+#include "fpdkcalsearch.h"
+#include "fpdkemu.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+//PDK command timings (same values as fpdk.c)
+#define FPDK_VPP_CMD_STABELIZE_DELAYUS  100
+#define FPDK_VDD_CMD_STABELIZE_DELAYUS  500
+#define FPDK_VPP_EW_STABELIZE_DELAYUS   10000
+#define FPDK_VDD_EW_STABELIZE_DELAYUS   10000
+#define FPDK_LEAVEPROGMODE_DELAYUS      10000
+#define FPDK_ERASE_WAIT_DELAYUS         100000
+#define FPDK_WRITE_WAIT_DELAYUS         100000
+#define FPDK_ERASE_PULSE_DELAYUS        5000
+#define FPDK_WRITE_CLOCK_HALF_F_DELAYUS 15
+#define FPDK_WRITE_CLOCK_HALF_O_DELAYUS 30
+#define FPDK_TIMING_MAX_WAITUS          1000000
+#define FPDK_TIMING_MAX_ERASE_PULSEUS   50000
+#define FPDK_TIMING_MAX_WRITE_CLOCKUS   1000
+
+#define FPDKEMU_IC_BIT_NS               1000                                                       //bit bang clock period of fpdk.c (GPIO via HAL)
+#define FPDKEMU_IC_CALIB_MEASURE_US     2000                                                       //one frequency measurement / comparator check
+#define FPDKEMU_IC_CALIB_STOP_US        50000
+#define FPDKEMU_IC_CALIB_RESTART_US     11000                                                      //power cycle of calibration loop (lower trim)
+#define FPDKEMU_IC_IHRC_HZ              16000000                                                   //nominal oscillators for characterization curves
+#define FPDKEMU_IC_ILRC_HZ              55000
+#define FPDKEMU_IC_SLEEP_MIN_US         1000                                                       //sleep in chunks, single bits are far below timer resolution
+
+static FPDKEMUIC         _ic;
+static bool              _delays;
+static uint16_t          _rom[1<<16];
+static uint64_t          _busy_until;                                                              //end of modeled IC time
+
+static FPDKTIMING        _timing;
+static uint32_t          _vdd_mv;
+static uint32_t          _vpp_mv;
+
+static volatile uint32_t _progress_phase;
+static volatile uint32_t _progress_done;
+static volatile uint32_t _progress_total;
+static volatile bool     _abort_requested;
+
+void FPDKEMU_IC_Setup(const FPDKEMUIC* ic, const bool delays)
+{
+  _ic = *ic;
+  _delays = delays;
+  for( uint32_t a=0; a<(sizeof(_rom)/sizeof(_rom[0])); a++ )                                      //new IC: all bits '1'
+    _rom[a] = (1UL<<_ic.codebits)-1;
+}
+
+static void _FPDKEMU_IC_Delay(const uint64_t us)
+{
+  if( !_delays )
+    return;
+
+  uint64_t now = FPDKEMU_GetMicroTicks();
+  if( _busy_until<now )
+    _busy_until = now;
+  _busy_until += us;
+
+  if( (_busy_until-now) >= FPDKEMU_IC_SLEEP_MIN_US )
+    FPDKEMU_DelayUS(_busy_until-now);
+}
+
+static void _FPDKEMU_IC_DelayBits(const uint32_t bits)
+{
+  _FPDKEMU_IC_Delay(((uint64_t)bits*FPDKEMU_IC_BIT_NS)/1000);
+}
+
+static void _FPDKEMU_IC_Finish(void)                                                               //complete modeled time before response is sent
+{
+  uint64_t now = FPDKEMU_GetMicroTicks();
+  if( _delays && (_busy_until>now) )
+    FPDKEMU_DelayUS(_busy_until-now);
+}
+
+static inline uint32_t _FPDKEMU_IC_Timing(const uint32_t value, const uint32_t def)
+{
+  return value?value:def;
+}
+
+static void _FPDKEMU_IC_SetProgress(const uint32_t phase, const uint32_t total)
+{
+  _progress_done = 0;
+  _progress_total = total;
+  _progress_phase = phase;
+}
+
+static int _FPDKEMU_IC_EnterProgramingMode(const uint32_t VPP_mV, const uint32_t VDD_mV)
+{
+  FPDK_SetVPP(VPP_mV, FPDK_VPP_CMD_STABELIZE_DELAYUS);
+  FPDK_SetVDD(VDD_mV, FPDK_VDD_CMD_STABELIZE_DELAYUS);
+  return 0;
+}
+
+static void _FPDKEMU_IC_LeaveProgramingMode(const uint32_t extrawaitus)
+{
+  FPDK_SetVDD(0, 0);
+  FPDK_SetVPP(0, 0);
+  _FPDKEMU_IC_Delay(_FPDKEMU_IC_Timing(_timing.leave_progmode_us, FPDK_LEAVEPROGMODE_DELAYUS) + extrawaitus + 1);
+}
+
+static uint16_t _FPDKEMU_IC_SendCommand(const FPDKICTYPE type)
+{
+  if( FPDK_IC_FLASH == type )
+  {
+    _FPDKEMU_IC_DelayBits(32+16+1);                                                                //preamble+command, ack, extra clock
+    return (type == _ic.type)?_ic.id12bit:0;
+  }
+  _FPDKEMU_IC_DelayBits(32);
+  return 0;
+}
+
+//OTP ID response after write command: data#1, data#2 (nothing sent, low), 12 bit ID, low bits (pull down) when read with more data bits than IC has
+static uint32_t _FPDKEMU_IC_GetIDIC(const FPDKICTYPE type, const uint8_t data_bits)
+{
+  if( type != _ic.type )
+    return 0;
+
+  if( FPDK_IC_FLASH == type )
+  {
+    _FPDKEMU_IC_Delay(FPDK_VPP_CMD_STABELIZE_DELAYUS+FPDK_VDD_CMD_STABELIZE_DELAYUS);
+    uint16_t id = _FPDKEMU_IC_SendCommand(type);
+    _FPDKEMU_IC_LeaveProgramingMode(0);
+    return id;
+  }
+
+  _FPDKEMU_IC_Delay(FPDK_VPP_CMD_STABELIZE_DELAYUS+FPDK_VDD_CMD_STABELIZE_DELAYUS);
+  _FPDKEMU_IC_SendCommand(type);
+  _FPDKEMU_IC_DelayBits(2*data_bits+12);
+  _FPDKEMU_IC_LeaveProgramingMode(0);
+
+  if( data_bits<_ic.codebits )
+    return _ic.id12bit>>(2*(_ic.codebits-data_bits));
+  return ((uint32_t)_ic.id12bit)<<(2*(data_bits-_ic.codebits));
+}
+
+static uint32_t _FPDKEMU_IC_ReadAddr(const uint32_t addr, const uint8_t addr_bits, const uint8_t data_bits)
+{
+  _FPDKEMU_IC_DelayBits(addr_bits+data_bits+1);
+  uint32_t a = addr & ((1UL<<_ic.addressbits)-1);
+  return _rom[a] & ((1UL<<data_bits)-1);
+}
+
+static void _FPDKEMU_IC_WriteAddr(const uint32_t addr, const uint8_t addr_bits, const uint16_t* data, const uint8_t data_bits,
+                                  const uint32_t count, const uint8_t write_block_clock_groups, const uint8_t write_block_clocks_per_group)
+{
+  uint32_t halfus = _FPDKEMU_IC_Timing(_timing.write_clock_half_us, (FPDK_IC_FLASH == _ic.type)?FPDK_WRITE_CLOCK_HALF_F_DELAYUS:FPDK_WRITE_CLOCK_HALF_O_DELAYUS);
+  _FPDKEMU_IC_DelayBits(count*data_bits+addr_bits+1);
+  _FPDKEMU_IC_Delay(4 + write_block_clock_groups*(write_block_clocks_per_group*2*halfus + 8) + 25);
+
+  for( uint32_t p=0; p<count; p++ )                                                                //programming can only clear bits
+  {
+    uint32_t a = (addr+p) & ((1UL<<_ic.addressbits)-1);
+    _rom[a] &= data[p] | ~((1UL<<data_bits)-1);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FPDK_Init(void)
+{
+}
+
+void FPDK_DeInit(void)
+{
+}
+
+void FPDK_SetLeds(uint32_t val)
+{
+}
+
+void FPDK_SetLed(uint32_t led, bool enable)
+{
+}
+
+bool FPDK_IsButtonPressed(void)
+{
+  return false;
+}
+
+bool FPDK_SetVDD(uint32_t mV, uint32_t stabelizeDelayUS)
+{
+  _vdd_mv = mV;
+  _FPDKEMU_IC_Delay(stabelizeDelayUS);
+  return true;
+}
+
+bool FPDK_SetVPP(uint32_t mV, uint32_t stabelizeDelayUS)
+{
+  _vpp_mv = mV;
+  _FPDKEMU_IC_Delay(stabelizeDelayUS);
+  return true;
+}
+
+uint32_t FPDK_GetAdcVref(void)
+{
+  return 3300;
+}
+
+uint32_t FPDK_GetAdcVdd(void)
+{
+  return _vdd_mv;
+}
+
+uint32_t FPDK_GetAdcVpp(void)
+{
+  return _vpp_mv;
+}
+
+void FPDK_Abort(void)
+{
+  _abort_requested = true;
+}
+
+void FPDK_ClearAbort(void)
+{
+  _abort_requested = false;
+}
+
+void FPDK_GetProgress(uint32_t* phase, uint32_t* done, uint32_t* total)
+{
+  *phase = _progress_phase;
+  *done = _progress_done;
+  *total = _progress_total;
+}
+
+uint16_t FPDK_BufGetWord(const FPDKBUFSLOT* buf, const uint32_t idx)
+{
+  uint32_t bitpos = idx*buf->bits;
+  const uint8_t* d = &buf->data[bitpos>>3];
+  uint32_t v = d[0] | (((uint32_t)d[1])<<8) | (((uint32_t)d[2])<<16);
+  return (v>>(bitpos&7)) & ((1UL<<buf->bits)-1);
+}
+
+void FPDK_BufSetWord(FPDKBUFSLOT* buf, const uint32_t idx, const uint16_t val)
+{
+  uint32_t bitpos = idx*buf->bits;
+  uint8_t* d = &buf->data[bitpos>>3];
+  uint32_t m = ((1UL<<buf->bits)-1) << (bitpos&7);
+  uint32_t v = (val << (bitpos&7)) & m;
+  for( ; m; m>>=8, v>>=8, d++ )
+    *d = (*d & ~m) | v;
+}
+
+bool FPDK_SetTiming(const FPDKTIMING* timing)
+{
+  if( (timing->leave_progmode_us > FPDK_TIMING_MAX_WAITUS) ||
+      (timing->erase_wait_us > FPDK_TIMING_MAX_WAITUS) ||
+      (timing->write_wait_us > FPDK_TIMING_MAX_WAITUS) ||
+      (timing->erase_pulse_us > FPDK_TIMING_MAX_ERASE_PULSEUS) ||
+      (timing->write_clock_half_us > FPDK_TIMING_MAX_WRITE_CLOCKUS) )
+    return false;
+
+  _timing = *timing;
+  return true;
+}
+
+uint32_t FPDK_ProbeIC(FPDKICTYPE* type, uint32_t* vpp_cmd, uint32_t* vdd_cmd)
+{
+  uint32_t ic_id = _FPDKEMU_IC_GetIDIC(FPDK_IC_FLASH, 0);
+  if( ic_id )
+    *type = FPDK_IC_FLASH;
+  else
+  {
+    ic_id = _FPDKEMU_IC_GetIDIC(FPDK_IC_OTP1, 16);
+    *type = FPDK_IC_OTP1;
+  }
+  _FPDKEMU_IC_Finish();
+
+  if( !ic_id )
+    return 0;
+
+  *vpp_cmd = 4500;
+  *vdd_cmd = 2000;
+  return ic_id;
+}
+
+//common start of read based commands, returns 0 when IC answered
+static uint16_t _FPDKEMU_IC_StartRead(const uint16_t ic_id, const FPDKICTYPE type, const uint32_t vpp_cmd, const uint32_t vdd_cmd, const uint8_t data_bits)
+{
+  if( (FPDK_IC_FLASH != type) && (ic_id != (_FPDKEMU_IC_GetIDIC(type, data_bits)&0xFFF)) )
+    return FPDK_ERR_CMDRSP;
+
+  _FPDKEMU_IC_EnterProgramingMode(vpp_cmd, vdd_cmd);
+
+  uint16_t resp = _FPDKEMU_IC_SendCommand(type);
+  if( (FPDK_IC_FLASH == type) && (ic_id != (resp&0xFFF)) )
+  {
+    _FPDKEMU_IC_LeaveProgramingMode(0);
+    return FPDK_ERR_CMDRSP;
+  }
+  return 0;
+}
+
+uint16_t FPDK_ReadIC(const uint16_t ic_id, const FPDKICTYPE type, const uint32_t vpp_cmd, const uint32_t vdd_cmd,
+                     const uint32_t addr, const uint8_t addr_bits, FPDKBUFSLOT* buf, const uint32_t data_offs, const uint8_t data_bits, const uint32_t count)
+{
+  uint16_t err = _FPDKEMU_IC_StartRead(ic_id, type, vpp_cmd, vdd_cmd, data_bits);
+  if( err )
+  {
+    _FPDKEMU_IC_Finish();
+    return err;
+  }
+
+  uint16_t ret = ic_id;
+
+  _FPDKEMU_IC_SetProgress(FPDKPROTO_PHASE_READ, count);
+  for( uint32_t p=0; p<count; p++ )
+  {
+    if( _abort_requested )
+    {
+      ret = FPDK_ERR_ABORTED;
+      break;
+    }
+
+    FPDK_BufSetWord( buf, data_offs+p, _FPDKEMU_IC_ReadAddr( addr+p, addr_bits, data_bits ) );
+    _progress_done = p+1;
+  }
+
+  _FPDKEMU_IC_LeaveProgramingMode(0);
+  _FPDKEMU_IC_Finish();
+  _progress_phase = FPDKPROTO_PHASE_IDLE;
+  return ret;
+}
+
+uint16_t FPDK_VerifyIC(const uint16_t ic_id, const FPDKICTYPE type, const uint32_t vpp_cmd, const uint32_t vdd_cmd,
+                       const uint32_t addr, const uint8_t addr_bits, const FPDKBUFSLOT* buf, const uint32_t data_offs, const uint8_t data_bits, const uint32_t count,
+                       const bool addr_exclude_first_instr, const uint32_t addr_exclude_start, const uint32_t addr_exclude_end)
+{
+  uint16_t err = _FPDKEMU_IC_StartRead(ic_id, type, vpp_cmd, vdd_cmd, data_bits);
+  if( err )
+  {
+    _FPDKEMU_IC_Finish();
+    return err;
+  }
+
+  uint16_t ret = ic_id;
+  uint32_t blank_value = (1<<data_bits)-1;
+
+  _FPDKEMU_IC_SetProgress(FPDKPROTO_PHASE_VERIFY, count);
+  for( uint32_t p=0; p<count; p++ )
+  {
+    if( _abort_requested )
+    {
+      ret = FPDK_ERR_ABORTED;
+      break;
+    }
+
+    _progress_done = p+1;
+
+    if( addr_exclude_first_instr && (0 == addr+p) )
+      continue;
+
+    if( ((addr+p)<addr_exclude_start) || ((addr+p)>addr_exclude_end) )
+    {
+      uint32_t dat = _FPDKEMU_IC_ReadAddr( addr+p, addr_bits, data_bits );
+      uint32_t expected = FPDK_BufGetWord( buf, data_offs+p );
+      if( ((expected&blank_value) != (dat&blank_value)) && ((expected&blank_value) != blank_value) )
+      {
+        ret = FPDK_ERR_VERIFY;
+        break;
+      }
+    }
+  }
+
+  _FPDKEMU_IC_LeaveProgramingMode(0);
+  _FPDKEMU_IC_Finish();
+  _progress_phase = FPDKPROTO_PHASE_IDLE;
+  return ret;
+}
+
+uint16_t FPDK_BlankCheckIC(const uint16_t ic_id, const FPDKICTYPE type, const uint32_t vpp_cmd, const uint32_t vdd_cmd,
+                           const uint8_t addr_bits, const uint8_t data_bits, const uint32_t count,
+                           const bool addr_exclude_first_instr, const uint32_t addr_exclude_start, const uint32_t addr_exclude_end)
+{
+  uint16_t err = _FPDKEMU_IC_StartRead(ic_id, type, vpp_cmd, vdd_cmd, data_bits);
+  if( err )
+  {
+    _FPDKEMU_IC_Finish();
+    return err;
+  }
+
+  uint16_t ret = ic_id;
+  uint32_t blank_value = (1<<data_bits)-1;
+
+  _FPDKEMU_IC_SetProgress(FPDKPROTO_PHASE_BLANKCHECK, count);
+  for( uint32_t p=0; p<count; p++ )
+  {
+    if( _abort_requested )
+    {
+      ret = FPDK_ERR_ABORTED;
+      break;
+    }
+
+    _progress_done = p+1;
+
+    if( addr_exclude_first_instr && (0 == p) )
+      continue;
+
+    if( ((p<addr_exclude_start) || (p>addr_exclude_end)) && (blank_value != _FPDKEMU_IC_ReadAddr( p, addr_bits, data_bits )) )
+    {
+      ret = FPDK_ERR_NOTBLANK;
+      break;
+    }
+  }
+
+  _FPDKEMU_IC_LeaveProgramingMode(0);
+  _FPDKEMU_IC_Finish();
+  _progress_phase = FPDKPROTO_PHASE_IDLE;
+  return ret;
+}
+
+uint16_t FPDK_EraseIC(const uint16_t ic_id, const FPDKICTYPE type,
+                      const uint32_t vpp_cmd, const uint32_t vdd_cmd,
+                      const uint32_t vpp_erase, const uint32_t vdd_erase,
+                      const uint8_t erase_clocks)
+{
+  _FPDKEMU_IC_EnterProgramingMode(vpp_cmd, vdd_cmd);
+
+  if( FPDK_IC_FLASH != type )
+    return FPDK_ERR_UKNOWN;
+
+  if( ic_id != (_FPDKEMU_IC_SendCommand(type)&0xFFF) )
+  {
+    _FPDKEMU_IC_LeaveProgramingMode(0);
+    _FPDKEMU_IC_Finish();
+    return FPDK_ERR_CMDRSP;
+  }
+
+  FPDK_SetVPP(vpp_erase, FPDK_VPP_EW_STABELIZE_DELAYUS);
+  FPDK_SetVDD(vdd_erase, FPDK_VDD_EW_STABELIZE_DELAYUS);
+
+  uint16_t ret = ic_id;
+  uint32_t pulseus = _FPDKEMU_IC_Timing(_timing.erase_pulse_us, FPDK_ERASE_PULSE_DELAYUS);
+
+  _FPDKEMU_IC_SetProgress(FPDKPROTO_PHASE_ERASE, erase_clocks);
+  for( uint32_t e=0; e<erase_clocks; e++ )
+  {
+    if( _abort_requested )
+    {
+      ret = FPDK_ERR_ABORTED;
+      break;
+    }
+    _FPDKEMU_IC_Delay(pulseus+6);
+    _progress_done = e+1;
+  }
+
+  if( FPDK_ERR_ABORTED != ret )
+  {
+    for( uint32_t a=0; a<(1UL<<_ic.addressbits); a++ )
+      _rom[a] = (1UL<<_ic.codebits)-1;
+  }
+
+  _FPDKEMU_IC_LeaveProgramingMode(_FPDKEMU_IC_Timing(_timing.erase_wait_us, FPDK_ERASE_WAIT_DELAYUS));
+  _FPDKEMU_IC_Finish();
+  _progress_phase = FPDKPROTO_PHASE_IDLE;
+  return ret;
+}
+
+uint16_t FPDK_WriteIC(const uint16_t ic_id, const FPDKICTYPE type,
+                      const uint32_t vpp_cmd, const uint32_t vdd_cmd,
+                      const uint32_t vpp_write, const uint32_t vdd_write,
+                      const uint32_t addr, const uint8_t addr_bits,
+                      const FPDKBUFSLOT* buf, const uint32_t data_offs, const uint8_t data_bits,
+                      const uint32_t count,
+                      const uint8_t write_block_size, const uint8_t write_block_clock_groups, const uint8_t write_block_clocks_per_group)
+{
+  if( !write_block_size || (write_block_size>8) )
+    return FPDK_ERR_UKNOWN;
+
+  uint16_t err = _FPDKEMU_IC_StartRead(ic_id, type, vpp_cmd, vdd_cmd, data_bits);                  //same entry as read, with WRITE command
+  if( err )
+  {
+    _FPDKEMU_IC_Finish();
+    return err;
+  }
+
+  FPDK_SetVPP(vpp_write, FPDK_VPP_EW_STABELIZE_DELAYUS);
+  FPDK_SetVDD(vdd_write, FPDK_VDD_EW_STABELIZE_DELAYUS);
+
+  uint32_t blank_value = (1<<data_bits)-1;
+  uint16_t ret = ic_id;
+
+  _FPDKEMU_IC_SetProgress(FPDKPROTO_PHASE_WRITE, count);
+  for( uint32_t p=0; p<count; p+=write_block_size )
+  {
+    if( _abort_requested )
+    {
+      ret = FPDK_ERR_ABORTED;
+      break;
+    }
+
+    uint16_t write_buf[8];
+    memset( write_buf, 0xFF, sizeof(write_buf) );
+
+    uint32_t write_count = (count>(p+write_block_size-1))?write_block_size:(count-p);
+    for( uint32_t c=0; c<write_count; c++ )
+      write_buf[(addr % write_block_size)+c] = FPDK_BufGetWord( buf, data_offs+p+c );
+
+    bool block_is_empty = true;
+    for( uint32_t c=0; c<write_block_size; c++ )
+    {
+      if( blank_value != (write_buf[c] & blank_value) )
+      {
+        block_is_empty = false;
+        break;
+      }
+    }
+
+    if( !block_is_empty )
+    {
+      uint32_t write_addr_aligned = ((addr+p) / write_block_size) * write_block_size;
+      _FPDKEMU_IC_WriteAddr(write_addr_aligned, addr_bits, write_buf, data_bits,
+                            write_block_size, write_block_clock_groups, write_block_clocks_per_group);
+    }
+    _progress_done = p+write_count;
+  }
+
+  _FPDKEMU_IC_LeaveProgramingMode(_FPDKEMU_IC_Timing(_timing.write_wait_us, FPDK_WRITE_WAIT_DELAYUS));
+  _FPDKEMU_IC_Finish();
+  _progress_phase = FPDKPROTO_PHASE_IDLE;
+  return ret;
+}
+
+//oscillator of calibration stub: trim 0..FPDKPROTO_CALIB_TRIM_MAX covers 0.5..1.5 * nominal, slightly VDD dependent
+static uint32_t _FPDKEMU_IC_TrimFrequency(const uint32_t nominal, const uint8_t trim, const uint32_t vdd)
+{
+  uint64_t f = ((uint64_t)nominal * (FPDKPROTO_CALIB_TRIM_MAX/2 + trim)) / FPDKPROTO_CALIB_TRIM_MAX;
+  return (f * (100000 + (int32_t)vdd - 5000)) / 100000;
+}
+
+static uint32_t _calibFrequency;
+static uint8_t  _calibTrim;
+
+static uint32_t _FPDKEMU_IC_CalibrateMeasure(const uint8_t trim, const uint32_t resolution_ppm)
+{
+  if( (trim < _calibTrim) && (0xFF != _calibTrim) )                                                //same trim handling as fpdk.c
+    _FPDKEMU_IC_Delay(FPDKEMU_IC_CALIB_RESTART_US);
+  _calibTrim = trim;
+  _FPDKEMU_IC_Delay(FPDKEMU_IC_CALIB_MEASURE_US);
+  _progress_done++;
+  return _FPDKEMU_IC_TrimFrequency(_calibFrequency, trim, 5000);
+}
+
+bool FPDK_Calibrate(const uint32_t type, const uint32_t vdd,
+                    const uint32_t frequency, const uint32_t multiplier,
+                    uint8_t* fcalval, uint32_t* freq_tuned,
+                    uint8_t* bgcalval, uint32_t* measurements)
+{
+  *measurements = 0;
+  *bgcalval = 0;
+  if( FPDKPROTO_CALIB_BG == type )                                                                 //combined types: frequency only, same as firmware
+    return false;
+
+  _FPDKEMU_IC_SetProgress(FPDKPROTO_PHASE_CALIBRATE, FPDKCALSEARCH_MAX_MEASUREMENTS);
+  FPDK_SetVDD(vdd, 1000);
+
+  _calibFrequency = frequency;                                                                     //stub oscillator is centered on requested frequency
+  _calibTrim = 0xFF;
+  *fcalval = FPDKCALSEARCH_Frequency(frequency, FPDKPROTO_CALIB_TRIM_MAX, _FPDKEMU_IC_CalibrateMeasure, &_abort_requested, freq_tuned);
+  *measurements = _progress_done;
+  bool ret = !_abort_requested;
+
+  FPDK_SetVDD(0, 0);
+  _FPDKEMU_IC_Delay(FPDKEMU_IC_CALIB_STOP_US);
+  _FPDKEMU_IC_Finish();
+  _progress_phase = FPDKPROTO_PHASE_IDLE;
+  return ret;
+}
+
+uint32_t FPDK_Characterize(const uint32_t type, const uint32_t vdd_first, const uint32_t vdd_last, const uint32_t vdd_step,
+                           const uint32_t multiplier, const uint8_t trim_first, const uint8_t trim_last,
+                           FPDK_CHARACTERIZECB cb)
+{
+  if( (FPDKPROTO_CALIB_BG == type) || (trim_last<trim_first) || (trim_last>FPDKPROTO_CALIB_TRIM_MAX) || (vdd_last<vdd_first) )
+    return 0;
+
+  uint32_t levels = vdd_step?(1+(vdd_last-vdd_first)/vdd_step):1;
+  uint32_t trims = 1+trim_last-trim_first;
+  uint32_t nominal = ((FPDKPROTO_CALIB_ILRC == type) || (FPDKPROTO_CALIB_ILRC_BG == type))?FPDKEMU_IC_ILRC_HZ:FPDKEMU_IC_IHRC_HZ;
+  uint32_t samples = 0;
+
+  _FPDKEMU_IC_SetProgress(FPDKPROTO_PHASE_CHARACTERIZE, levels*trims);
+  for( uint32_t l=0; (l<levels) && !_abort_requested; l++ )
+  {
+    uint32_t vdd = vdd_first + l*vdd_step;
+    FPDK_SetVDD(vdd, 0);
+    for( uint32_t t=trim_first; (t<=trim_last) && !_abort_requested; t++ )
+    {
+      _FPDKEMU_IC_Delay(FPDKEMU_IC_CALIB_MEASURE_US);
+      _FPDKEMU_IC_Finish();                                                                        //samples are streamed, send them at modeled time
+      cb(vdd, t, _FPDKEMU_IC_TrimFrequency(nominal, t, vdd));
+      _progress_done = ++samples;
+    }
+  }
+
+  FPDK_SetVDD(0, 0);
+  _FPDKEMU_IC_Delay(FPDKEMU_IC_CALIB_STOP_US);
+  _FPDKEMU_IC_Finish();
+  _progress_phase = FPDKPROTO_PHASE_IDLE;
+  return samples;
+}
@@ -0,0 +1,706 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//pin level model of the IC in socket for easypdk-emu-pin: fpdk.c drives CLK (PA3), DAT (PA6), PA4 with the mock GPIO functions
+//and VDD / VPP with the DAC. The model decodes preamble+command words, answers read / write / erase / OTP ID like the IC and
+//checks timing in virtual time (every GPIO access and bit bang delay of fpdk.c advances it)
+
+#include "main.h"
+#include "fpdk.h"
+#include "fpdkemu.h"
+#include "fpdkutil.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+//board: DAC full scale (fpdk.c) and settling of DAC + opamps (delays used by fpdk.c)
+#define FPDKEMU_PIN_VDD_DAC_MAX_MV      ( 6290 - 30)
+#define FPDKEMU_PIN_VPP_DAC_MAX_MV      (13300 - 30)
+#define FPDKEMU_PIN_VPP_SETTLE_US       100
+#define FPDKEMU_PIN_VDD_SETTLE_US       500
+#define FPDKEMU_PIN_HV_SETTLE_US        10000                                                      //supply change in programming mode (write / erase voltages)
+
+//IC
+#define FPDKEMU_PIN_VDD_ON_MV           1000                                                       //IC powered
+#define FPDKEMU_PIN_VPP_PROG_MV         4000                                                       //VPP applied at power up: programming mode
+#define FPDKEMU_PIN_HV_TOL_MV           250                                                        //write / erase voltages of IC table
+#define FPDKEMU_PIN_CLK_MIN_NS          100                                                        //CLK high / low
+#define FPDKEMU_PIN_SETUP_NS            50                                                         //data stable before CLK rising edge
+#define FPDKEMU_PIN_HOLD_NS             50                                                         //data stable after CLK rising edge
+#define FPDKEMU_PIN_TDO_NS              100                                                        //IC output valid after CLK rising edge
+#define FPDKEMU_PIN_OTP_ID_BITS         12
+#define FPDKEMU_PIN_SYNC_MIN_US         1000                                                       //real time follows virtual time in chunks
+
+
+#define FPDKEMU_PIN_CMD_ERASE           0x3
+#define FPDKEMU_PIN_CMD_READ            0x6
+#define FPDKEMU_PIN_CMD_WRITE           0x7
+
+typedef enum FPDKEMUPINSTATE
+{
+  FPDKEMU_PIN_OFF,
+  FPDKEMU_PIN_RUN,                                                                                 //powered without VPP, pins are ignored
+  FPDKEMU_PIN_CMD,                                                                                 //preamble+command (32 bits)
+  FPDKEMU_PIN_RESP,                                                                                //IC drives DAT
+  FPDKEMU_PIN_EXTRA,                                                                               //1 extra clock
+  FPDKEMU_PIN_ADDR,                                                                                //read address
+  FPDKEMU_PIN_DATA,                                                                                //write block data words + address
+  FPDKEMU_PIN_PROG,                                                                                //write clock groups
+  FPDKEMU_PIN_ERASE,                                                                               //erase pulses
+  FPDKEMU_PIN_IGNORE,                                                                              //unknown preamble / command, done
+} FPDKEMUPINSTATE;
+
+typedef enum FPDKEMUPINVIOLATION
+{
+  FPDKEMU_PIN_V_POWERON,
+  FPDKEMU_PIN_V_SETTLE,
+  FPDKEMU_PIN_V_CLOCK,
+  FPDKEMU_PIN_V_SETUP,
+  FPDKEMU_PIN_V_HOLD,
+  FPDKEMU_PIN_V_TDO,
+  FPDKEMU_PIN_V_CONTENTION,
+  FPDKEMU_PIN_V_HVLEVEL,
+  FPDKEMU_PIN_V_WRITEPULSE,
+  FPDKEMU_PIN_V_ERASEPULSE,
+  FPDKEMU_PIN_V_COUNT
+} FPDKEMUPINVIOLATION;
+
+static const char* _violation_names[FPDKEMU_PIN_V_COUNT] =
+{
+  "power up after leaving programming mode", "supply settling", "clock width", "data setup", "data hold",
+  "IC output delay", "DAT contention", "write / erase voltage", "write pulse", "erase pulse"
+};
+
+//IC minimum timings, own to the model (not the programmer timing profile of the IC table: a profile below these is flagged)
+typedef struct FPDKEMUPINLIMITS
+{
+  uint16_t id12bit;                                                                                //0: fallback for IC type
+  char     type;
+  uint32_t leave_progmode_us;                                                                      //power down before next power up
+  uint32_t erase_wait_us;                                                                          //extra power down after erase
+  uint32_t write_wait_us;                                                                          //extra power down after write
+  uint32_t erase_pulse_us;
+  uint32_t write_clock_half_us;                                                                    //write clock high / low
+} FPDKEMUPINLIMITS;
+
+static const FPDKEMUPINLIMITS _limits[] =                                                          //last entries: fallback by type
+{
+  { 0xA16, FPDK_IC_OTP1,    5000,      0,  50000,     0,  20 },                                    //PMS150C
+  { 0xE06, FPDK_IC_OTP1,    5000,      0,  50000,     0,  20 },                                    //PMS154B / PMS154C
+  { 0xAA1, FPDK_IC_FLASH,   5000,  50000,  50000,  4000,  10 },                                    //PFS154
+  { 0xEA2, FPDK_IC_FLASH,   5000,  50000,  50000,  4000,  10 },                                    //PFS173
+  { 0,     FPDK_IC_OTP1,    5000,      0,  50000,     0,  20 },                                    //other OTP (--icdb)
+  { 0,     FPDK_IC_FLASH,   5000,  50000,  50000,  4000,  10 },                                    //other flash (--icdb)
+};
+
+//handles to peripherals (defined from cubemx in main.c)
+ADC_HandleTypeDef  hadc;
+DMA_HandleTypeDef  hdma_adc;
+DAC_HandleTypeDef  hdac;
+TIM_HandleTypeDef  htim1;
+TIM_HandleTypeDef  htim2;
+TIM_HandleTypeDef  htim15;
+SPI_HandleTypeDef  hspi1;
+DMA_HandleTypeDef  hdma_spi1_tx;
+DMA_HandleTypeDef  hdma_spi1_rx;
+
+GPIO_TypeDef       FPDKEMU_GPIO[3];
+static uint16_t    _gpio_odr[3];
+static uint16_t    _gpio_out[3];                                                                   //pins configured as output
+
+static FPDKEMUIC   _ic;
+static const FPDKEMUPINLIMITS* _lim;
+static bool        _delays;
+static uint16_t    _rom[1<<16];
+static uint32_t    _gpio_ns = 125;
+
+//virtual time (ns) and real time following it
+static uint64_t    _vt;
+static uint64_t    _sync_rt;
+static uint64_t    _sync_vt;
+
+//supplies
+static uint32_t    _vdd_mv;
+static uint32_t    _vpp_mv;
+static uint64_t    _vpp_settled;
+static uint64_t    _settled;
+static uint64_t    _t_off;
+static uint64_t    _off_required;                                                                  //after last programming session
+
+//pins (programmer side)
+static bool        _clk;
+static bool        _dat;
+static bool        _pa4;
+static uint64_t    _t_rise;
+static uint64_t    _t_fall;
+static uint64_t    _t_data;                                                                        //last change of data input (flash DAT, OTP PA4)
+static uint64_t    _t_pa4_edge;
+static bool        _sampled;                                                                       //last rising edge sampled data
+
+//IC output
+static bool        _drive;
+static bool        _drive_val;
+static uint64_t    _t_drive;
+static bool        _release_at_fall;
+
+//protocol
+static FPDKEMUPINSTATE _state;
+static FPDKEMUPINSTATE _extra_next;
+static uint32_t    _bits;
+static uint32_t    _shift;
+static uint8_t     _cmd;
+static uint32_t    _resp;
+static uint32_t    _resp_bits;
+static FPDKEMUPINSTATE _resp_next;
+static uint16_t    _wdata[8];
+static uint32_t    _waddr;
+static bool        _first_block;
+static bool        _op_ok;                                                                         //all write / erase pulses of current block valid
+static uint32_t    _pulses;
+
+//session statistics (power up to power down in programming mode)
+static bool        _session;
+static uint64_t    _session_start;
+static uint32_t    _session_clocks;
+static uint32_t    _session_words;
+static uint32_t    _violations[FPDKEMU_PIN_V_COUNT];
+
+static void _FPDKEMU_PIN_Violation(const FPDKEMUPINVIOLATION kind, const char* format, ...)
+{
+  if( _violations[kind]++ )                                                                        //first one of a kind per session is shown
+    return;
+
+  printf("IC TIMING @%llu.%03llu ms: ", (unsigned long long)(_vt/1000000), (unsigned long long)((_vt/1000)%1000));
+  va_list ap;
+  va_start(ap, format);
+  vprintf(format, ap);
+  va_end(ap);
+  printf("\n");
+  fflush(stdout);
+}
+
+static void _FPDKEMU_PIN_SessionStart(void)
+{
+  if( (_vt-_t_off) < _off_required )
+    _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_POWERON, "power up %llu us after power down, IC needs %llu us",
+                           (unsigned long long)((_vt-_t_off)/1000), (unsigned long long)(_off_required/1000));
+  if( _vt < _vpp_settled )
+    _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_SETTLE, "VDD applied %llu us before VPP settled", (unsigned long long)((_vpp_settled-_vt+999)/1000));
+
+  _session = true;
+  _session_start = _vt;
+  _session_clocks = 0;
+  _session_words = 0;
+  _state = FPDKEMU_PIN_CMD;
+  _bits = 0;
+  _shift = 0;
+  _cmd = 0;
+}
+
+static void _FPDKEMU_PIN_SessionEnd(void)
+{
+  const char* name = "no command";
+  switch( _cmd )
+  {
+    case FPDKEMU_PIN_CMD_READ:  name = "read"; break;
+    case FPDKEMU_PIN_CMD_WRITE: name = "write"; break;
+    case FPDKEMU_PIN_CMD_ERASE: name = "erase"; break;
+  }
+  uint64_t us = (_vt-_session_start)/1000;
+  verbose_printf("IC %s: %u words, %u clocks, %llu.%03llu ms\n", name, _session_words, _session_clocks,
+                 (unsigned long long)(us/1000), (unsigned long long)(us%1000));
+
+  for( uint32_t v=0; v<FPDKEMU_PIN_V_COUNT; v++ )
+  {
+    if( _violations[v]>1 )
+      printf("IC TIMING: %u x %s in %s session\n", _violations[v], _violation_names[v], name);
+    _violations[v] = 0;
+  }
+  fflush(stdout);
+
+  uint64_t off_us = _lim->leave_progmode_us;
+  if( FPDKEMU_PIN_CMD_ERASE == _cmd )
+    off_us += _lim->erase_wait_us;
+  if( (FPDKEMU_PIN_CMD_WRITE == _cmd) && _session_words )
+    off_us += _lim->write_wait_us;
+  _off_required = off_us*1000;
+  _session = false;
+}
+
+static bool _FPDKEMU_PIN_CheckHV(const uint32_t vdd_mv, const uint32_t vpp_mv)
+{
+  if( (_vdd_mv+FPDKEMU_PIN_HV_TOL_MV >= vdd_mv) && (_vdd_mv <= vdd_mv+FPDKEMU_PIN_HV_TOL_MV) &&
+      (_vpp_mv+FPDKEMU_PIN_HV_TOL_MV >= vpp_mv) && (_vpp_mv <= vpp_mv+FPDKEMU_PIN_HV_TOL_MV) )
+    return true;
+
+  _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_HVLEVEL, "VDD=%.2fV VPP=%.2fV, IC needs VDD=%.2fV VPP=%.2fV",
+                         _vdd_mv/1000.0, _vpp_mv/1000.0, vdd_mv/1000.0, vpp_mv/1000.0);
+  return false;
+}
+
+static void _FPDKEMU_PIN_StartResponse(const uint32_t value, const uint32_t bits, const FPDKEMUPINSTATE next)
+{
+  _resp = value;
+  _resp_bits = bits;
+  _resp_next = next;
+  _state = FPDKEMU_PIN_RESP;
+  _bits = 0;
+}
+
+static void _FPDKEMU_PIN_Drive(const bool value)                                                   //at CLK rising edge
+{
+  if( _gpio_out[1] & IC_IO_PA6_DAT_Pin )
+    _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_CONTENTION, "IC drives DAT while programmer output is enabled");
+  _drive = true;
+  _drive_val = value;
+  _t_drive = _vt;
+}
+
+static void _FPDKEMU_PIN_Command(void)
+{
+  if( (_shift>>4) != 0x0A5A5A5A )                                                                  //other protocol (probing) or garbage: IC does not answer
+  {
+    verbose_printf("IC: no preamble (0x%08X)\n", _shift);
+    _state = FPDKEMU_PIN_IGNORE;
+    return;
+  }
+
+  _cmd = _shift & 0xF;
+  _first_block = true;
+  _op_ok = true;
+  FPDKEMUPINSTATE next = FPDKEMU_PIN_IGNORE;
+  switch( _cmd )
+  {
+    case FPDKEMU_PIN_CMD_READ:  next = FPDKEMU_PIN_ADDR; break;
+    case FPDKEMU_PIN_CMD_WRITE: next = FPDKEMU_PIN_DATA; break;
+    case FPDKEMU_PIN_CMD_ERASE: next = (FPDK_IC_FLASH == _ic.type)?FPDKEMU_PIN_ERASE:FPDKEMU_PIN_IGNORE; break;
+  }
+
+  _bits = 0;
+  _shift = 0;
+  _waddr = 0;
+  memset(_wdata, 0, sizeof(_wdata));
+  if( FPDK_IC_FLASH == _ic.type )                                                                  //ack (IC ID), extra clock
+  {
+    _extra_next = next;
+    _FPDKEMU_PIN_StartResponse(_ic.id12bit, 16, FPDKEMU_PIN_EXTRA);
+  }
+  else
+    _state = next;
+}
+
+static void _FPDKEMU_PIN_WriteBlock(void)
+{
+  if( !_op_ok )
+    return;
+
+  uint16_t mask = (1UL<<_ic.codebits)-1;
+  for( uint32_t w=0; w<_ic.write_block_size; w++ )
+  {
+    uint32_t a = (_waddr+w) & ((1UL<<_ic.addressbits)-1);
+    if( a < _ic.codewords )
+      _rom[a] &= _wdata[w] & mask;                                                                 //programming clears bits only
+  }
+  _session_words += _ic.write_block_size;
+}
+
+static void _FPDKEMU_PIN_ClockRise(void)
+{
+  _session_clocks++;
+  if( (_vt-_t_fall) < FPDKEMU_PIN_CLK_MIN_NS )
+    _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_CLOCK, "CLK low for %llu ns", (unsigned long long)(_vt-_t_fall));
+  if( _vt < _settled )
+    _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_SETTLE, "CLK %llu us before supplies settled", (unsigned long long)((_settled-_vt+999)/1000));
+
+  bool bit = (FPDK_IC_FLASH == _ic.type) ? _dat : _pa4;
+  _sampled = (FPDKEMU_PIN_CMD == _state) || (FPDKEMU_PIN_ADDR == _state) || (FPDKEMU_PIN_DATA == _state);
+  if( _sampled && ((_vt-_t_data) < FPDKEMU_PIN_SETUP_NS) )
+    _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_SETUP, "data changed %llu ns before CLK rising edge", (unsigned long long)(_vt-_t_data));
+
+  uint32_t block_bits = _ic.write_block_size*_ic.codebits;
+  uint32_t half_ns = _lim->write_clock_half_us*1000;
+
+  switch( _state )
+  {
+    case FPDKEMU_PIN_CMD:
+      _shift = (_shift<<1) | bit;
+      if( 32 == ++_bits )
+        _FPDKEMU_PIN_Command();
+      break;
+
+    case FPDKEMU_PIN_RESP:
+      _FPDKEMU_PIN_Drive( (_resp>>(_resp_bits-1-_bits)) & 1 );
+      if( ++_bits == _resp_bits )
+      {
+        _release_at_fall = true;
+        _state = _resp_next;
+        _bits = 0;
+      }
+      break;
+
+    case FPDKEMU_PIN_EXTRA:
+      _state = _extra_next;
+      _bits = 0;
+      break;
+
+    case FPDKEMU_PIN_ADDR:
+      _shift = (_shift<<1) | bit;
+      if( ++_bits == _ic.addressbits )
+      {
+        uint32_t a = _shift & ((1UL<<_ic.addressbits)-1);
+        _extra_next = FPDKEMU_PIN_ADDR;
+        _FPDKEMU_PIN_StartResponse( (a<_ic.codewords)?_rom[a]:((1UL<<_ic.codebits)-1), _ic.codebits,
+                                    (FPDK_IC_FLASH == _ic.type)?FPDKEMU_PIN_EXTRA:FPDKEMU_PIN_ADDR );
+        _session_words++;
+        _shift = 0;
+      }
+      break;
+
+    case FPDKEMU_PIN_DATA:
+      if( _bits < block_bits )
+        _wdata[_bits/_ic.codebits] = (_wdata[_bits/_ic.codebits]<<1) | bit;
+      else
+        _waddr = (_waddr<<1) | bit;
+
+      if( (FPDK_IC_FLASH != _ic.type) && _first_block &&                                            //OTP: ID is sent back while data#1, data#2 are followed by address
+          (_bits >= 2*_ic.codebits) && (_bits < (2*_ic.codebits+FPDKEMU_PIN_OTP_ID_BITS)) )
+      {
+        _FPDKEMU_PIN_Drive( (_ic.id12bit>>(2*_ic.codebits+FPDKEMU_PIN_OTP_ID_BITS-1-_bits)) & 1 );
+        _release_at_fall = true;
+      }
+
+      if( ++_bits == (block_bits+_ic.addressbits) )
+      {
+        _first_block = false;
+        _op_ok = true;
+        _bits = 0;
+        _pulses = 0;
+        if( FPDK_IC_FLASH == _ic.type )
+          _state = FPDKEMU_PIN_PROG;
+        else
+        {
+          _extra_next = FPDKEMU_PIN_PROG;
+          _state = FPDKEMU_PIN_EXTRA;
+        }
+      }
+      break;
+
+    case FPDKEMU_PIN_PROG:
+      if( FPDK_IC_FLASH == _ic.type )                                                              //flash: clocks_per_group write clocks + 1 extra clock per group
+      {
+        uint32_t pos = _bits % (_ic.write_block_clocks_per_group+1);
+        if( pos && ((_vt-_t_fall) < half_ns) )
+        {
+          _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_WRITEPULSE, "write clock low for %llu ns, IC needs %u us", (unsigned long long)(_vt-_t_fall), half_ns/1000);
+          _op_ok = false;
+        }
+        if( (pos < _ic.write_block_clocks_per_group) && !_FPDKEMU_PIN_CheckHV(_ic.vdd_write_hv_mv, _ic.vpp_write_hv_mv) )
+          _op_ok = false;
+        if( ++_bits == _ic.write_block_clock_groups*(_ic.write_block_clocks_per_group+1) )
+        {
+          _FPDKEMU_PIN_WriteBlock();
+          _state = FPDKEMU_PIN_DATA;
+          _bits = 0;
+          memset(_wdata, 0, sizeof(_wdata));
+          _waddr = 0;
+        }
+      }
+      else                                                                                         //OTP: write pulses on PA4 while CLK is high + 1 extra clock per group
+      {
+        if( !(_bits & 1) )
+          _pulses = 0;
+        if( ++_bits == 2*_ic.write_block_clock_groups )
+        {
+          _FPDKEMU_PIN_WriteBlock();
+          _state = FPDKEMU_PIN_DATA;
+          _bits = 0;
+          memset(_wdata, 0, sizeof(_wdata));
+          _waddr = 0;
+        }
+      }
+      break;
+
+    case FPDKEMU_PIN_ERASE:                                                                        //erase pulse + short clock per erase clock
+      if( !(_bits & 1) && !_FPDKEMU_PIN_CheckHV(_ic.vdd_erase_hv_mv, _ic.vpp_erase_hv_mv) )
+        _op_ok = false;
+      if( ++_bits == 2*_ic.erase_clocks )
+      {
+        if( _op_ok )
+        {
+          for( uint32_t a=0; a<(sizeof(_rom)/sizeof(_rom[0])); a++ )
+            _rom[a] = (1UL<<_ic.codebits)-1;
+          _session_words = _ic.codewords;
+        }
+        _state = FPDKEMU_PIN_IGNORE;
+      }
+      break;
+
+    default:
+      break;
+  }
+  _t_rise = _vt;
+}
+
+static void _FPDKEMU_PIN_ClockFall(void)
+{
+  uint64_t high = _vt-_t_rise;
+  if( high < FPDKEMU_PIN_CLK_MIN_NS )
+    _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_CLOCK, "CLK high for %llu ns", (unsigned long long)high);
+
+  if( _release_at_fall )
+  {
+    _drive = false;
+    _release_at_fall = false;
+  }
+
+  if( (FPDKEMU_PIN_PROG == _state) && _bits )
+  {
+    uint32_t half_ns = _lim->write_clock_half_us*1000;
+    if( FPDK_IC_FLASH == _ic.type )
+    {
+      uint32_t pos = (_bits-1) % (_ic.write_block_clocks_per_group+1);
+      if( (pos < _ic.write_block_clocks_per_group) && (high < half_ns) )
+      {
+        _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_WRITEPULSE, "write clock high for %llu ns, IC needs %u us", (unsigned long long)high, half_ns/1000);
+        _op_ok = false;
+      }
+    }
+    else
+    if( (_bits & 1) && (_pulses != _ic.write_block_clocks_per_group) )                             //group without all write pulses (OTP ID probe): not written
+      _op_ok = false;
+  }
+
+  if( (FPDKEMU_PIN_ERASE == _state) && (_bits & 1) )
+  {
+    uint32_t pulse_ns = _lim->erase_pulse_us*1000;
+    if( high < pulse_ns )
+    {
+      _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_ERASEPULSE, "erase pulse %llu us, IC needs %u us", (unsigned long long)(high/1000), pulse_ns/1000);
+      _op_ok = false;
+    }
+  }
+  _t_fall = _vt;
+}
+
+static void _FPDKEMU_PIN_DataChange(void)
+{
+  if( _sampled && _clk && ((_vt-_t_rise) < FPDKEMU_PIN_HOLD_NS) )
+    _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_HOLD, "data changed %llu ns after CLK rising edge", (unsigned long long)(_vt-_t_rise));
+  _t_data = _vt;
+}
+
+static void _FPDKEMU_PIN_PA4Change(void)                                                           //OTP: data input and write pulses
+{
+  if( (FPDKEMU_PIN_PROG == _state) && _clk && (_bits & 1) )
+  {
+    uint32_t half_ns = _lim->write_clock_half_us*1000;
+    if( (!_pa4 || _pulses) && ((_vt-_t_pa4_edge) < half_ns) )                                      //pulse high / low between pulses
+    {
+      _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_WRITEPULSE, "write pulse %s for %llu ns, IC needs %u us", _pa4?"low":"high",
+                             (unsigned long long)(_vt-_t_pa4_edge), half_ns/1000);
+      _op_ok = false;
+    }
+    if( _pa4 )
+    {
+      _pulses++;
+      if( !_FPDKEMU_PIN_CheckHV(_ic.vdd_write_hv_mv, _ic.vpp_write_hv_mv) )
+        _op_ok = false;
+    }
+  }
+  else
+    _FPDKEMU_PIN_DataChange();
+  _t_pa4_edge = _vt;
+}
+
+static bool _FPDKEMU_PIN_Driven(const uint16_t pin)
+{
+  return (_gpio_out[1] & pin) && (_gpio_odr[1] & pin);
+}
+
+static void _FPDKEMU_PIN_Update(void)
+{
+  bool dat = _FPDKEMU_PIN_Driven(IC_IO_PA6_DAT_Pin);
+  bool pa4 = _FPDKEMU_PIN_Driven(IC_IO_PA4_Pin);
+  bool clk = _FPDKEMU_PIN_Driven(IC_IO_PA3_CLK_Pin);
+  bool prog = (FPDKEMU_PIN_OFF != _state) && (FPDKEMU_PIN_RUN != _state);
+
+  if( dat != _dat )
+  {
+    _dat = dat;
+    if( prog && (FPDK_IC_FLASH == _ic.type) )
+      _FPDKEMU_PIN_DataChange();
+  }
+  if( pa4 != _pa4 )
+  {
+    _pa4 = pa4;
+    if( prog && (FPDK_IC_FLASH != _ic.type) )
+      _FPDKEMU_PIN_PA4Change();
+  }
+  if( clk != _clk )
+  {
+    _clk = clk;
+    if( prog )
+    {
+      if( clk )
+        _FPDKEMU_PIN_ClockRise();
+      else
+        _FPDKEMU_PIN_ClockFall();
+    }
+  }
+}
+
+static uint32_t _FPDKEMU_PIN_Port(const GPIO_TypeDef* port)
+{
+  return port-FPDKEMU_GPIO;
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef* port, GPIO_InitTypeDef* init)
+{
+  _vt += _gpio_ns;
+  uint32_t p = _FPDKEMU_PIN_Port(port);
+  if( GPIO_MODE_OUTPUT_PP == init->Mode )
+  {
+    if( (1 == p) && (init->Pin & IC_IO_PA6_DAT_Pin) && _drive )
+      _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_CONTENTION, "programmer enables DAT output while IC drives it");
+    _gpio_out[p] |= init->Pin;
+  }
+  else
+    _gpio_out[p] &= ~init->Pin;
+
+  if( 1 == p )
+    _FPDKEMU_PIN_Update();
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state)
+{
+  _vt += _gpio_ns;
+  uint32_t p = _FPDKEMU_PIN_Port(port);
+  if( GPIO_PIN_SET == state )
+    _gpio_odr[p] |= pin;
+  else
+    _gpio_odr[p] &= ~pin;
+
+  if( 1 == p )
+    _FPDKEMU_PIN_Update();
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* port, uint16_t pin)
+{
+  _vt += _gpio_ns;
+  uint32_t p = _FPDKEMU_PIN_Port(port);
+  if( _gpio_out[p] & pin )
+    return (_gpio_odr[p] & pin)?GPIO_PIN_SET:GPIO_PIN_RESET;
+
+  if( (1 == p) && (IC_IO_PA6_DAT_Pin == pin) && _drive )
+  {
+    if( (_vt-_t_drive) < FPDKEMU_PIN_TDO_NS )
+      _FPDKEMU_PIN_Violation(FPDKEMU_PIN_V_TDO, "DAT sampled %llu ns after CLK rising edge, IC output valid after %u ns",
+                             (unsigned long long)(_vt-_t_drive), FPDKEMU_PIN_TDO_NS);
+    return _drive_val?GPIO_PIN_SET:GPIO_PIN_RESET;
+  }
+  return GPIO_PIN_RESET;                                                                           //pull down / button not pressed
+}
+
+HAL_StatusTypeDef HAL_DACEx_DualSetValue(DAC_HandleTypeDef* dac, uint32_t align, uint32_t data1, uint32_t data2)
+{
+  _vt += _gpio_ns;
+  uint32_t vpp = (data1*FPDKEMU_PIN_VPP_DAC_MAX_MV)/4095;
+  uint32_t vdd = (data2*FPDKEMU_PIN_VDD_DAC_MAX_MV)/4095;
+  bool was_on = (_vdd_mv >= FPDKEMU_PIN_VDD_ON_MV);
+  bool on = (vdd >= FPDKEMU_PIN_VDD_ON_MV);
+
+  if( vpp != _vpp_mv )
+  {
+    uint64_t settle = _session?FPDKEMU_PIN_HV_SETTLE_US:FPDKEMU_PIN_VPP_SETTLE_US;
+    _vpp_settled = _vt + settle*1000;
+    if( _vpp_settled > _settled )
+      _settled = _vpp_settled;
+  }
+  if( (vdd != _vdd_mv) && on )
+  {
+    uint64_t settle = _session?FPDKEMU_PIN_HV_SETTLE_US:FPDKEMU_PIN_VDD_SETTLE_US;
+    if( (_vt + settle*1000) > _settled )
+      _settled = _vt + settle*1000;
+  }
+  _vpp_mv = vpp;
+  _vdd_mv = vdd;
+
+  if( on && !was_on )
+  {
+    if( vpp >= FPDKEMU_PIN_VPP_PROG_MV )
+      _FPDKEMU_PIN_SessionStart();
+    else
+      _state = FPDKEMU_PIN_RUN;
+  }
+  else
+  if( !on && was_on )
+  {
+    if( _session )
+      _FPDKEMU_PIN_SessionEnd();
+    _state = FPDKEMU_PIN_OFF;
+    _drive = false;
+    _release_at_fall = false;
+    _t_off = _vt;
+  }
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef FPDKEMU_HAL_Stub(const void* handle)
+{
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef FPDKEMU_HAL_Unavailable(const void* handle)
+{
+  return HAL_ERROR;
+}
+
+void FPDKEMU_PIN_DelayUS(const uint32_t us)
+{
+  _vt += (uint64_t)us*1000;
+  if( !_delays )
+    return;
+
+  uint64_t now = FPDKEMU_GetMicroTicks();
+  uint64_t vt_us = _vt/1000;
+  if( (now-_sync_rt) >= (vt_us-_sync_vt) )                                                         //real time is ahead (idle between commands): follow from here
+  {
+    _sync_rt = now;
+    _sync_vt = vt_us;
+    return;
+  }
+  uint64_t ahead = (vt_us-_sync_vt) - (now-_sync_rt);
+  if( ahead >= FPDKEMU_PIN_SYNC_MIN_US )
+    FPDKEMU_DelayUS(ahead);
+}
+
+void FPDKEMU_PIN_SetGPIOTime(const uint32_t ns)
+{
+  _gpio_ns = ns;
+}
+
+void FPDKEMU_IC_Setup(const FPDKEMUIC* ic, const bool delays)
+{
+  _ic = *ic;
+  _delays = delays;
+  for( _lim=_limits; (_lim->id12bit != _ic.id12bit) && (_lim->id12bit || (_lim->type != _ic.type)); _lim++ ) //IC by ID, else by type
+    ;
+  for( uint32_t a=0; a<(sizeof(_rom)/sizeof(_rom[0])); a++ )                                      //new IC: all bits '1'
+    _rom[a] = (1UL<<_ic.codebits)-1;
+  _state = FPDKEMU_PIN_OFF;
+}
@@ -0,0 +1,167 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//USART1 + RX DMA of the programmer for the unmodified fpdkuart.c, connected to the running IC which echoes everything it receives
+//(the IC starts with the auto baud character 'U'), transfers complete in FPDKEMU_UART_Poll which stands in for the interrupts
+
+#include "fpdkuart.h"
+#include "fpdkemu.h"
+#include "main.h"
+
+#define FPDKEMU_UART_BYTE_US   87                                                                  //10 bits at 115200 baud
+#define FPDKEMU_UART_AUTOBAUD  'U'
+
+#define FPDKEMU_UART_STATE_RESET 0x00
+#define FPDKEMU_UART_STATE_READY 0x20
+
+UART_HandleTypeDef huart1;
+SCB_Type           FPDKEMU_SCB;
+
+static DMA_HandleTypeDef _dmarx;
+static uint8_t*          _rxbuf;
+static uint32_t          _rxsize;
+static uint32_t          _rxidx;                                                                   //DMA write index
+static bool              _autobaud;                                                                //IC still has to send auto baud character
+
+static uint8_t*          _txdat;
+static uint32_t          _txlen;
+static uint64_t          _txdone;                                                                  //time when running transfer is on the wire completely
+
+SysTick_Type* FPDKEMU_SysTick(void)
+{
+  static SysTick_Type systick = { .LOAD = 48000-1 };
+  uint32_t us = FPDKEMU_GetMicroTicks() % 1000;                                                    //counts down from LOAD once per ms (HAL_GetTick)
+  systick.VAL = systick.LOAD - (us*(systick.LOAD+1))/1000;
+  return &systick;
+}
+
+void FPDKEMU_UART_Modify(volatile uint32_t* reg, const uint32_t clear, const uint32_t set)
+{
+  FPDKEMU_IRQ_Disable();
+  *reg = (*reg & ~clear) | set;
+  FPDKEMU_IRQ_Enable();
+}
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef* huart)
+{
+  FPDKEMU_IRQ_Disable();
+  huart->RxState = FPDKEMU_UART_STATE_READY;
+  huart->ISR = 0;
+  huart->IER = 0;
+  _autobaud = true;
+  FPDKEMU_IRQ_Enable();
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Abort(UART_HandleTypeDef* huart)
+{
+  FPDKEMU_IRQ_Disable();
+  if( FPDKEMU_UART_STATE_RESET != huart->RxState )
+    huart->RxState = FPDKEMU_UART_STATE_READY;
+  huart->hdmarx = 0;
+  _rxbuf = 0;
+  _txlen = 0;
+  FPDKEMU_IRQ_Enable();
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_DeInit(UART_HandleTypeDef* huart)
+{
+  HAL_UART_Abort(huart);
+  FPDKEMU_IRQ_Disable();
+  huart->RxState = FPDKEMU_UART_STATE_RESET;
+  huart->ISR = 0;
+  huart->IER = 0;
+  _autobaud = false;                                                                               //IC is not running
+  FPDKEMU_IRQ_Enable();
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef* huart, uint8_t* data, uint16_t size)
+{
+  HAL_StatusTypeDef ret = HAL_BUSY;
+  FPDKEMU_IRQ_Disable();
+  if( FPDKEMU_UART_STATE_READY == huart->RxState )
+  {
+    _rxbuf = data;
+    _rxsize = size;
+    _rxidx = 0;
+    _dmarx.CNDTR = size;
+    huart->hdmarx = &_dmarx;
+    huart->RxState = HAL_UART_STATE_BUSY_RX;
+    ret = HAL_OK;
+  }
+  FPDKEMU_IRQ_Enable();
+  return ret;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef* huart, uint8_t* data, uint16_t size)
+{
+  HAL_StatusTypeDef ret = HAL_BUSY;
+  FPDKEMU_IRQ_Disable();
+  if( (FPDKEMU_UART_STATE_RESET != huart->RxState) && !_txlen && size )
+  {
+    _txdat = data;
+    _txlen = size;
+    _txdone = FPDKEMU_GetMicroTicks() + (uint64_t)size*FPDKEMU_UART_BYTE_US;
+    ret = HAL_OK;
+  }
+  FPDKEMU_IRQ_Enable();
+  return ret;
+}
+
+static void _FPDKEMU_UART_Receive(const uint8_t c)                                                 //circular DMA: half / complete transfer callbacks
+{
+  if( !_rxbuf )
+    return;
+
+  _rxbuf[_rxidx++] = c;
+  if( _rxidx == _rxsize )
+    _rxidx = 0;
+  _dmarx.CNDTR = _rxsize - _rxidx;                                                                 //counter is current when callbacks read it
+  if( _rxidx == _rxsize/2 )
+    HAL_UART_RxHalfCpltCallback(&huart1);
+  if( 0 == _rxidx )
+    HAL_UART_RxCpltCallback(&huart1);
+}
+
+static void _FPDKEMU_UART_LineIdle(void)
+{
+  huart1.ISR |= UART_FLAG_IDLE;
+  if( huart1.IER & UART_IT_IDLE )
+    FPDKUART_HandleIRQ();                                                                          //USART1_IRQHandler
+}
+
+void FPDKEMU_UART_Poll(void)
+{
+  if( _autobaud && _rxbuf )
+  {
+    _autobaud = false;
+    _FPDKEMU_UART_Receive(FPDKEMU_UART_AUTOBAUD);
+    huart1.ISR |= UART_FLAG_ABRF;
+    _FPDKEMU_UART_LineIdle();
+  }
+
+  if( _txlen && (FPDKEMU_GetMicroTicks() >= _txdone) )
+  {
+    for( uint32_t i=0; i<_txlen; i++ )
+      _FPDKEMU_UART_Receive(_txdat[i]);
+    _txlen = 0;
+    _FPDKEMU_UART_LineIdle();
+    HAL_UART_TxCpltCallback(&huart1);
+  }
+}
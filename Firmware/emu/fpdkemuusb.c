@@ -0,0 +1,312 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//USB side of easypdk-emu: mock HAL / CDC interface for fpdkusb.c and the firmware main loop
+//main thread = firmware main loop, USB thread = USB interrupts (pty <-> 64 byte packets with latency / bandwidth model)
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+#include "fpdkemu.h"
+#include "fpdkusb.h"
+#include "fpdkuart.h"
+#include "main.h"
+#include "usbd_cdc_if.h"
+#include "fpdkutil.h"
+
+#define FPDKEMU_USB_PACKET_SIZE  64                                                                //full speed bulk packet
+#define FPDKEMU_HUP_POLL_US      10000                                                             //no host port open: check again
+#define FPDKEMU_MAIN_SPIN_US     2000                                                              //main loop keeps spinning after USB activity (queued frames)
+
+static volatile bool     _quit;
+
+static int               _pty = -1;
+static int               _wake_usb[2];                                                             //main loop -> USB thread (packet to transmit, reception resumed)
+static int               _wake_main[2];                                                            //USB thread -> main loop (packet received / transmitted)
+static uint32_t          _usb_latency_us;
+static uint32_t          _usb_speed;
+static uint64_t          _usb_busy_until;                                                          //bus is shared by both directions
+
+static volatile bool     _port_open;
+static volatile bool     _rx_paused;
+static volatile bool     _tx_pending;
+static uint8_t           _tx_packet[FPDKEMU_USB_PACKET_SIZE];
+static uint16_t          _tx_len;
+
+static pthread_mutex_t   _irq_lock;
+static __thread uint32_t _irq_depth;
+
+uint64_t FPDKEMU_GetMicroTicks(void)
+{
+  return fpdkutil_getMicroTicks();
+}
+
+void FPDKEMU_DelayUS(const uint64_t us)
+{
+  struct timespec ts = { us/1000000, (us%1000000)*1000 };
+  while( nanosleep(&ts, &ts) && (EINTR == errno) ) {;}
+}
+
+uint32_t HAL_GetTick(void)
+{
+  return FPDKEMU_GetMicroTicks()/1000;
+}
+
+void FPDKEMU_IRQ_Disable(void)
+{
+  pthread_mutex_lock(&_irq_lock);
+  _irq_depth++;
+}
+
+void FPDKEMU_IRQ_Enable(void)
+{
+  if( !_irq_depth )
+    return;
+  _irq_depth--;
+  pthread_mutex_unlock(&_irq_lock);
+}
+
+uint32_t FPDKEMU_IRQ_GetMask(void)
+{
+  return _irq_depth;
+}
+
+void FPDKEMU_IRQ_SetMask(const uint32_t mask)
+{
+  while( _irq_depth>mask )
+    FPDKEMU_IRQ_Enable();
+  while( _irq_depth<mask )
+    FPDKEMU_IRQ_Disable();
+}
+
+static void _FPDKEMU_Wake(const int fd)
+{
+  uint8_t c = 0;
+  if( write(fd, &c, 1) ) {;}                                                                       //pipe full: a wake up is pending anyway
+}
+
+static bool _FPDKEMU_WaitWake(const int fd, const int timeoutms)
+{
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  if( poll(&pfd, 1, timeoutms) <= 0 )
+    return false;
+  uint8_t dummy[64];
+  while( read(fd, dummy, sizeof(dummy)) > 0 ) {;}
+  return true;
+}
+
+uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)                                                //called with "interrupts" disabled
+{
+  if( _tx_pending || (Len>FPDKEMU_USB_PACKET_SIZE) )
+    return USBD_BUSY;
+
+  memcpy(_tx_packet, Buf, Len);
+  _tx_len = Len;
+  _tx_pending = true;
+  _FPDKEMU_Wake(_wake_usb[1]);
+  return USBD_OK;
+}
+
+bool CDC_IsConnected(void)
+{
+  return true;
+}
+
+bool CDC_IsHostPortOpen(void)
+{
+  return _port_open;
+}
+
+void CDC_ResumeReceive(void)
+{
+  _rx_paused = false;
+  _FPDKEMU_Wake(_wake_usb[1]);
+}
+
+static void _FPDKEMU_USBDelay(const uint32_t len, bool* lastshort)                                 //transfer = packets up to a short one, latency once per transfer
+{
+  uint64_t us = *lastshort?_usb_latency_us:0;
+  if( _usb_speed )
+    us += ((uint64_t)len*1000000)/_usb_speed;
+  *lastshort = (len<FPDKEMU_USB_PACKET_SIZE);
+
+  uint64_t now = FPDKEMU_GetMicroTicks();
+  if( _usb_busy_until<now )
+    _usb_busy_until = now;
+  _usb_busy_until += us;
+  if( _usb_busy_until>now )
+    FPDKEMU_DelayUS(_usb_busy_until-now);
+}
+
+static void _FPDKEMU_USBWrite(const uint8_t* dat, const uint32_t len)
+{
+  for( uint32_t p=0; p<len; )
+  {
+    int w = write(_pty, &dat[p], len-p);
+    if( w>0 )
+    {
+      p += w;
+      continue;
+    }
+    struct pollfd pfd = { _pty, POLLOUT, 0 };
+    if( (poll(&pfd, 1, 100)<0) || (pfd.revents & (POLLHUP|POLLERR)) )                              //host closed port: data is lost like on real USB
+      return;
+  }
+}
+
+static void _FPDKEMU_USBSetPortOpen(const bool open)
+{
+  if( open == _port_open )
+    return;
+
+  FPDKEMU_IRQ_Disable();
+  _port_open = open;
+  FPDKUSB_USBSignalPortOpenClose();
+  FPDKEMU_IRQ_Enable();
+  _FPDKEMU_Wake(_wake_main[1]);
+  verbose_printf("Host %s port\n", open?"opened":"closed");
+}
+
+static void* _FPDKEMU_USBThread(void* arg)
+{
+  bool rxshort = true;
+  bool txshort = true;
+  while( !_quit )
+  {
+    struct pollfd pfd[2] = { { _pty, _rx_paused?0:POLLIN, 0 }, { _wake_usb[0], POLLIN, 0 } };
+    if( !_tx_pending && (poll(pfd, 2, 100)<0) )
+      continue;
+    if( pfd[1].revents & POLLIN )
+      _FPDKEMU_WaitWake(_wake_usb[0], 0);
+
+    if( _tx_pending )                                                                              //IN packet (ZLP included)
+    {
+      _FPDKEMU_USBDelay(_tx_len, &txshort);
+      if( _port_open )
+        _FPDKEMU_USBWrite(_tx_packet, _tx_len);
+      FPDKEMU_IRQ_Disable();
+      _tx_pending = false;
+      FPDKUSB_USBHandleTransmitComplete();
+      FPDKEMU_IRQ_Enable();
+      _FPDKEMU_Wake(_wake_main[1]);
+      poll(pfd, 1, 0);                                                                             //port state / data arrived meanwhile
+    }
+
+    if( pfd[0].revents & POLLHUP )                                                                 //no process has the pty open
+    {
+      _FPDKEMU_USBSetPortOpen(false);
+      if( !_tx_pending )
+        FPDKEMU_DelayUS(FPDKEMU_HUP_POLL_US);
+      continue;
+    }
+    _FPDKEMU_USBSetPortOpen(true);
+
+    if( !_rx_paused && (pfd[0].revents & POLLIN) )                                                 //OUT packet
+    {
+      uint8_t packet[FPDKEMU_USB_PACKET_SIZE];
+      int len = read(_pty, packet, sizeof(packet));
+      if( len>0 )
+      {
+        _FPDKEMU_USBDelay(len, &rxshort);
+        FPDKEMU_IRQ_Disable();
+        FPDKUSB_USBHandleReceive(packet, len);
+        if( !FPDKUSB_USBCanReceive() )                                                             //main loop calls CDC_ResumeReceive
+          _rx_paused = true;
+        FPDKEMU_IRQ_Enable();
+        _FPDKEMU_Wake(_wake_main[1]);
+      }
+    }
+  }
+  return 0;
+}
+
+const char* FPDKEMU_USB_Open(const char* link, const uint32_t latency_us, const uint32_t speed)
+{
+  _usb_latency_us = latency_us;
+  _usb_speed = speed;
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&_irq_lock, &attr);
+
+  if( pipe2(_wake_usb, O_NONBLOCK) || pipe2(_wake_main, O_NONBLOCK) )
+    return 0;
+
+  _pty = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if( _pty<0 )
+    return 0;
+
+  struct termios config;
+  if( grantpt(_pty) || unlockpt(_pty) || tcgetattr(_pty, &config) )
+    return 0;
+  cfmakeraw(&config);                                                                              //applies to slave side, binary protocol
+  tcsetattr(_pty, TCSANOW, &config);
+
+  if( link )
+  {
+    unlink(link);
+    if( symlink(ptsname(_pty), link) )
+      return 0;
+  }
+  return ptsname(_pty);
+}
+
+void FPDKEMU_Run(void)
+{
+  FPDK_Init();
+  FPDKUSB_Init();
+
+  pthread_t usbthread;
+  if( pthread_create(&usbthread, 0, _FPDKEMU_USBThread, 0) )
+    return;
+
+  uint64_t spin_until = 0;
+  while( !_quit )
+  {
+    FPDKEMU_IRQ_Disable();
+    FPDKEMU_UART_Poll();
+    FPDKEMU_IRQ_Enable();
+
+    if( FPDKUSB_IsConnected() )
+    {
+      FPDKUSB_HandleCommands();
+      FPDKUART_HandleQueue();
+    }
+
+    if( (FPDKEMU_GetMicroTicks() >= spin_until) && _FPDKEMU_WaitWake(_wake_main[0], 1) )            //idle: sleep until USB activity (1 ms for UART transfers / latency timers)
+      spin_until = FPDKEMU_GetMicroTicks() + FPDKEMU_MAIN_SPIN_US;
+  }
+
+  pthread_join(usbthread, 0);
+  FPDKUSB_DeInit();
+  FPDK_DeInit();
+  close(_pty);
+}
+
+void FPDKEMU_Stop(void)                                                                            //from signal handler
+{
+  _quit = true;
+}
@@ -0,0 +1,186 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//mock of the HAL parts used by fpdkusb.c, fpdkuart.c and fpdk.c, firmware sources are compiled unmodified for easypdk-emu
+//GPIO / DAC of the programming interface are implemented by the pin level IC model (fpdkemupin.c), USART1 with its
+//RX DMA by the debug UART model (fpdkemuuart.c), other peripherals are stubs (no ADC samples, SPI / TIM2 fail to start:
+//calibration is not available at pin level)
+
+#ifndef __MAIN_H
+#define __MAIN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+uint32_t HAL_GetTick(void);
+
+//"interrupts" (USB thread) are blocked by one recursive lock, PRIMASK is the nesting depth of the calling thread
+void     FPDKEMU_IRQ_Disable(void);
+void     FPDKEMU_IRQ_Enable(void);
+uint32_t FPDKEMU_IRQ_GetMask(void);
+void     FPDKEMU_IRQ_SetMask(const uint32_t mask);
+
+#define __disable_irq()     FPDKEMU_IRQ_Disable()
+#define __enable_irq()      FPDKEMU_IRQ_Enable()
+#define __get_PRIMASK()     FPDKEMU_IRQ_GetMask()
+#define __set_PRIMASK(mask) FPDKEMU_IRQ_SetMask(mask)
+
+//bit bang delays of fpdk.c advance virtual time of the IC model
+void     FPDKEMU_PIN_DelayUS(const uint32_t us);
+#define _FPDK_DelayUS(us)   FPDKEMU_PIN_DelayUS(us)
+
+//STM32F072 factory calibration values (typical)
+#define TEMP030_CAL         1750
+#define TEMP110_CAL         1300
+#define VREFINT_CAL         1525
+#define VDD_VALUE           3300
+
+typedef enum { HAL_OK = 0, HAL_ERROR, HAL_BUSY, HAL_TIMEOUT } HAL_StatusTypeDef;
+
+typedef struct { uint32_t AFR[2]; } GPIO_TypeDef;
+typedef struct { volatile uint32_t CCR2; } TIM_TypeDef;
+typedef struct { int dummy; } ADC_HandleTypeDef;
+typedef struct { volatile uint32_t CNDTR; } DMA_HandleTypeDef;
+typedef struct { int dummy; } DAC_HandleTypeDef;
+typedef struct { int dummy; } SPI_HandleTypeDef;
+typedef struct { DMA_HandleTypeDef* hdmarx; volatile uint32_t RxState; volatile uint32_t ISR; volatile uint32_t IER; } UART_HandleTypeDef;
+typedef struct { TIM_TypeDef* Instance; DMA_HandleTypeDef* hdma[7]; } TIM_HandleTypeDef;
+
+typedef enum { GPIO_PIN_RESET = 0, GPIO_PIN_SET } GPIO_PinState;
+typedef enum { RESET = 0, SET = !RESET } FlagStatus;
+typedef struct { uint32_t Pin; uint32_t Mode; uint32_t Pull; uint32_t Speed; uint32_t Alternate; } GPIO_InitTypeDef;
+typedef struct { uint32_t ICPolarity; uint32_t ICSelection; uint32_t ICPrescaler; uint32_t ICFilter; } TIM_IC_InitTypeDef;
+
+extern GPIO_TypeDef FPDKEMU_GPIO[3];
+#define GPIOA                      (&FPDKEMU_GPIO[0])
+#define GPIOB                      (&FPDKEMU_GPIO[1])
+#define GPIOC                      (&FPDKEMU_GPIO[2])
+
+#define GPIO_PIN_2                 0x0004
+#define GPIO_PIN_3                 0x0008
+#define GPIO_PIN_4                 0x0010
+#define GPIO_PIN_5                 0x0020
+#define GPIO_PIN_6                 0x0040
+#define GPIO_PIN_7                 0x0080
+#define GPIO_PIN_13                0x2000
+#define GPIO_PIN_14                0x4000
+#define GPIO_PIN_15                0x8000
+
+#define GPIO_MODE_INPUT            0
+#define GPIO_MODE_OUTPUT_PP        1
+#define GPIO_NOPULL                0
+#define GPIO_PULLUP                1
+#define GPIO_PULLDOWN              2
+#define GPIO_SPEED_FREQ_HIGH       3
+#define GPIO_AF0_SPI1              0
+#define GPIO_AF2_TIM2              2
+#define GPIO_AFRL_AFSEL3_Pos       12
+#define GPIO_AFRL_AFSEL3           (0xFUL<<GPIO_AFRL_AFSEL3_Pos)
+
+#define DAC_CHANNEL_1              0
+#define DAC_CHANNEL_2              1
+#define DAC_ALIGN_12B_R            0
+#define TIM_CHANNEL_2              4
+#define TIM_DMA_ID_CC2             2
+#define TIM_DMA_CC2                0x0400
+#define TIM_ICPOLARITY_RISING      0
+#define TIM_ICSELECTION_DIRECTTI   1
+#define TIM_ICPSC_DIV8             0x0C
+
+#define UART_FLAG_IDLE             0x00000010
+#define UART_FLAG_ABRE             0x00004000
+#define UART_FLAG_ABRF             0x00008000
+#define UART_IT_IDLE               0x00000010
+#define HAL_UART_STATE_BUSY_RX     0x00000022
+
+//SysTick (1 ms reload at 48 MHz) / SCB: time stamps of fpdkuart.c, SysTick interrupt is never pending
+typedef struct { volatile uint32_t LOAD; volatile uint32_t VAL; } SysTick_Type;
+typedef struct { volatile uint32_t ICSR; } SCB_Type;
+SysTick_Type* FPDKEMU_SysTick(void);
+extern SCB_Type FPDKEMU_SCB;
+#define SysTick                    FPDKEMU_SysTick()
+#define SCB                        (&FPDKEMU_SCB)
+#define SCB_ICSR_PENDSTSET_Msk     (1UL<<26)
+
+#define MODIFY_REG(REG, CLEARMASK, SETMASK) ((REG) = (((REG) & (~(CLEARMASK))) | (SETMASK)))
+
+//board pins (Inc/main.h)
+#define LED1_OUT_Pin               GPIO_PIN_13
+#define LED1_OUT_GPIO_Port         GPIOC
+#define LED2_OUT_Pin               GPIO_PIN_14
+#define LED2_OUT_GPIO_Port         GPIOC
+#define LED3_OUT_Pin               GPIO_PIN_15
+#define LED3_OUT_GPIO_Port         GPIOC
+#define DCDC15VOLT_ENABLE_OUT_Pin  GPIO_PIN_2
+#define DCDC15VOLT_ENABLE_OUT_GPIO_Port GPIOA
+#define USER_BTN_IN_Pin            GPIO_PIN_15
+#define USER_BTN_IN_GPIO_Port      GPIOA
+#define IC_IO_PA3_CLK_Pin          GPIO_PIN_3
+#define IC_IO_PA3_CLK_GPIO_Port    GPIOB
+#define IC_IO_PA4_Pin              GPIO_PIN_4
+#define IC_IO_PA4_GPIO_Port        GPIOB
+#define IC_IO_PA6_DAT_Pin          GPIO_PIN_5
+#define IC_IO_PA6_DAT_GPIO_Port    GPIOB
+
+//programming interface (pin level IC model)
+void              HAL_GPIO_Init(GPIO_TypeDef* port, GPIO_InitTypeDef* init);
+void              HAL_GPIO_WritePin(GPIO_TypeDef* port, uint16_t pin, GPIO_PinState state);
+GPIO_PinState     HAL_GPIO_ReadPin(GPIO_TypeDef* port, uint16_t pin);
+HAL_StatusTypeDef HAL_DACEx_DualSetValue(DAC_HandleTypeDef* hdac, uint32_t align, uint32_t data1, uint32_t data2);
+
+//IC debug UART (USART1 + circular RX DMA, IC echoes everything it receives)
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef* huart);
+HAL_StatusTypeDef HAL_UART_DeInit(UART_HandleTypeDef* huart);
+HAL_StatusTypeDef HAL_UART_Abort(UART_HandleTypeDef* huart);
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef* huart, uint8_t* data, uint16_t size);
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef* huart, uint8_t* data, uint16_t size);
+void              HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef* huart);
+void              HAL_UART_RxCpltCallback(UART_HandleTypeDef* huart);
+void              HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart);
+void              FPDKEMU_UART_Modify(volatile uint32_t* reg, const uint32_t clear, const uint32_t set);
+void              FPDKEMU_UART_Poll(void);                                                         //"USART1 / DMA interrupts", call with interrupts disabled
+
+#define __HAL_UART_GET_FLAG(h, flag)           ((((h)->ISR & (flag)) == (flag)) ? SET : RESET)
+#define __HAL_UART_CLEAR_IDLEFLAG(h)           FPDKEMU_UART_Modify(&(h)->ISR, UART_FLAG_IDLE, 0)
+#define __HAL_UART_ENABLE_IT(h, it)            FPDKEMU_UART_Modify(&(h)->IER, 0, (it))
+#define __HAL_UART_DISABLE_IT(h, it)           FPDKEMU_UART_Modify(&(h)->IER, (it), 0)
+
+//other peripherals
+HAL_StatusTypeDef FPDKEMU_HAL_Stub(const void* handle);
+HAL_StatusTypeDef FPDKEMU_HAL_Unavailable(const void* handle);
+
+#define HAL_SPI_DeInit(h)                      FPDKEMU_HAL_Stub(h)
+#define HAL_SPI_Abort(h)                       FPDKEMU_HAL_Stub(h)
+#define HAL_TIM_PWM_Start(h, ch)               FPDKEMU_HAL_Stub(h)
+#define HAL_TIM_Base_Start(h)                  FPDKEMU_HAL_Stub(h)
+#define HAL_TIM_IC_Start(h, ch)                FPDKEMU_HAL_Stub(h)
+#define HAL_TIM_IC_Stop(h, ch)                 FPDKEMU_HAL_Stub(h)
+#define HAL_DAC_Start(h, ch)                   FPDKEMU_HAL_Stub(h)
+#define HAL_ADCEx_Calibration_Start(h)         FPDKEMU_HAL_Stub(h)
+#define HAL_ADC_Start_DMA(h, buf, len)         FPDKEMU_HAL_Stub(h)
+#define HAL_ADC_Stop(h)                        FPDKEMU_HAL_Stub(h)
+#define HAL_DMA_Start(h, src, dst, len)        FPDKEMU_HAL_Stub(h)
+#define HAL_DMA_Abort(h)                       FPDKEMU_HAL_Stub(h)
+#define HAL_SPI_Init(h)                        FPDKEMU_HAL_Unavailable(h)
+#define HAL_SPI_TransmitReceive_DMA(h, tx, rx, len) ((void)(tx), (void)(rx), FPDKEMU_HAL_Unavailable(h))
+#define HAL_TIM_IC_ConfigChannel(h, cfg, ch)   ((void)(cfg), FPDKEMU_HAL_Unavailable(h))
+#define __HAL_TIM_ENABLE_DMA(h, dma)           FPDKEMU_HAL_Stub(h)
+#define __HAL_TIM_DISABLE_DMA(h, dma)          FPDKEMU_HAL_Stub(h)
+#define __HAL_TIM_GET_COUNTER(h)               0
+#define __HAL_DMA_GET_COUNTER(h)               ((h)?(h)->CNDTR:0)
+
+#endif //__MAIN_H
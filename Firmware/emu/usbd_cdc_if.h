@@ -0,0 +1,39 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//mock of the USB CDC interface used by fpdkusb.c, implemented by the pty USB model in fpdkemuusb.c
+
+#ifndef __USBD_CDC_IF_H__
+#define __USBD_CDC_IF_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum
+{
+  USBD_OK   = 0,
+  USBD_BUSY,
+  USBD_FAIL,
+} USBD_StatusTypeDef;
+
+uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
+
+bool CDC_IsConnected(void);
+bool CDC_IsHostPortOpen(void);
+void CDC_ResumeReceive(void);
+
+#endif /* __USBD_CDC_IF_H__ */
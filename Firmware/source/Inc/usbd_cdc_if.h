@@ -108,6 +108,7 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
 bool CDC_IsConnected(void);
 bool CDC_IsHostPortOpen(void);
+void CDC_ResumeReceive(void);
 /* USER CODE END EXPORTED_FUNCTIONS */
 
 /**
@@ -17,6 +17,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "fpdk.h"
 #include "fpdkproto.h"
+#include "fpdkcalsearch.h"
 
 #include "main.h"
 #include <string.h>
@@ -42,7 +43,9 @@ extern UART_HandleTypeDef huart1;
 #define _FPDK_GET_DAT()      HAL_GPIO_ReadPin(  IC_IO_PA6_DAT_GPIO_Port, IC_IO_PA6_DAT_Pin )
 
 //general macros for programing IO
+#ifndef _FPDK_DelayUS                                                                              //host build (easypdk-emu-pin) advances virtual time instead
 #define _FPDK_DelayUS(us)    { asm volatile ("MOV R0,%[loops]\n1:\nSUB R0,#1\nCMP R0,#0\nBNE 1b"::[loops]"r"(10*us):"memory"); }
+#endif
 #define _FPDK_Clock()        { _FPDK_CLK_UP(); _FPDK_CLK_DOWN(); }
 #define _FPDK_SendBitO(bit)  { _FPDK_SET_DAT_O(bit); _FPDK_Clock(); }
 #define _FPDK_SendBitF(bit)  { _FPDK_SET_DAT_F(bit); _FPDK_Clock(); }
@@ -53,9 +56,11 @@ extern UART_HandleTypeDef huart1;
 #define FPDK_VPP_DAC_MAX_MV (13300 - 30)
 
 //STM32F072 chip specific factory calibration values in rom
+#ifndef VREFINT_CAL
 #define TEMP030_CAL ((uint32_t)*((uint16_t*)0x1FFFF7B8))
 #define TEMP110_CAL ((uint32_t)*((uint16_t*)0x1FFFF7C2))
 #define VREFINT_CAL ((uint32_t)*((uint16_t*)0x1FFFF7BA))
+#endif
 
 //PDK command timings
 #define FPDK_VPP_CMD_STABELIZE_DELAYUS  100
@@ -67,6 +72,18 @@ extern UART_HandleTypeDef huart1;
 #define FPDK_LEAVEPROGMODE_DELAYUS      10000  //IMPORTANT: wait a bit after leaving program mode, before executing next command
 #define FPDK_VDD_CAL_STARTUP_DELAYUS    1000
 
+//default IC timings (conservative, used when host does not send a timing profile / sends 0 for a value)
+#define FPDK_ERASE_WAIT_DELAYUS         100000 //extra wait after erase
+#define FPDK_WRITE_WAIT_DELAYUS         100000 //extra wait after write
+#define FPDK_ERASE_PULSE_DELAYUS        5000
+#define FPDK_WRITE_CLOCK_HALF_F_DELAYUS 15
+#define FPDK_WRITE_CLOCK_HALF_O_DELAYUS 30
+
+//timing limits accepted from host
+#define FPDK_TIMING_MAX_WAITUS          1000000
+#define FPDK_TIMING_MAX_ERASE_PULSEUS   50000
+#define FPDK_TIMING_MAX_WRITE_CLOCKUS   1000
+
 
 //current dac output values, we need to store them so we can set channels seperate
 static uint32_t _dac_vdd;
@@ -80,6 +97,14 @@ static volatile uint32_t _adc_vref;
 static volatile uint32_t _adc_vdd;
 static volatile uint32_t _adc_vpp;
 
+//progress of current IC operation (read from USB interrupt) and abort request (set from USB interrupt)
+static FPDKTIMING        _timing;                                                                //per IC timing profile from host, 0 = default
+
+static volatile uint32_t _progress_phase;
+static volatile uint32_t _progress_done;
+static volatile uint32_t _progress_total;
+static volatile bool     _abort_requested;
+
 static void _FPDK_ADC_HandleData(const uint16_t* adcdata)
 {
   uint32_t avref=1;
@@ -108,6 +133,13 @@ void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef* AdcHandle)
   _FPDK_ADC_HandleData(((uint16_t*)_adcDMABuffer)+(8*3));
 }
 
+static void _FPDK_SetProgress(const uint32_t phase, const uint32_t total)
+{
+  _progress_done = 0;
+  _progress_total = total;
+  _progress_phase = phase;
+}
+
 static void _FPDK_SetClkOutgoing(void)
 {
   HAL_GPIO_WritePin( IC_IO_PA3_CLK_GPIO_Port, IC_IO_PA3_CLK_Pin, GPIO_PIN_RESET );
@@ -203,13 +235,19 @@ static int _FPDK_EnterProgramingmMode(const FPDKICTYPE type, const uint32_t VPP_
   return 0;
 }
 
+static inline uint32_t _FPDK_Timing(const uint32_t value, const uint32_t def)
+{
+  return value?value:def;
+}
+
 static void _FPDK_LeaveProgramingMode(const FPDKICTYPE type, const uint32_t extrawaitus)
 {
   _FPDK_SetDatIncoming();
   _FPDK_SetPA4Incoming();
   FPDK_SetVDD(0, FPDK_VDD_STOP_DELAYUS);                                                           //disable VDD
   FPDK_SetVPP(0, FPDK_VPP_STOP_DELAYUS);                                                           //disable VPP
-  _FPDK_DelayUS(FPDK_LEAVEPROGMODE_DELAYUS);
+  uint32_t leavewaitus = _FPDK_Timing(_timing.leave_progmode_us, FPDK_LEAVEPROGMODE_DELAYUS);
+  _FPDK_DelayUS(leavewaitus);
   _FPDK_DelayUS(extrawaitus+1);
   _FPDK_SetClkIncoming();
 }
@@ -260,6 +298,7 @@ static void _FPDK_WriteAddr(const FPDKICTYPE type, const uint32_t addr, const ui
     _FPDK_SendBits32F(addr,addr_bits);                                                             //send address to write to
     _FPDK_SetDatIncoming();                                                                        //set DAT incoming
 
+    uint32_t halfus = _FPDK_Timing(_timing.write_clock_half_us, FPDK_WRITE_CLOCK_HALF_F_DELAYUS);
     _FPDK_DelayUS(4);
 
     for( uint32_t l=0; l<write_block_clock_groups; l++ )
@@ -267,9 +306,9 @@ static void _FPDK_WriteAddr(const FPDKICTYPE type, const uint32_t addr, const ui
       for( uint32_t w=0; w<write_block_clocks_per_group; w++ )
       {
         _FPDK_CLK_UP();
-        _FPDK_DelayUS(15);
+        _FPDK_DelayUS(halfus);
         _FPDK_CLK_DOWN();
-        _FPDK_DelayUS(15);
+        _FPDK_DelayUS(halfus);
       }
 
       _FPDK_Clock();                                                                               //1 extra clock
@@ -286,6 +325,7 @@ static void _FPDK_WriteAddr(const FPDKICTYPE type, const uint32_t addr, const ui
     _FPDK_SendBits32O(addr,addr_bits);                                                             //send address to write to
 
     _FPDK_Clock();                                                                                 //1 extra clock 
+    uint32_t halfus = _FPDK_Timing(_timing.write_clock_half_us, FPDK_WRITE_CLOCK_HALF_O_DELAYUS);
     _FPDK_DelayUS(4);
 
     for( uint32_t l=0; l<write_block_clock_groups; l++ )
@@ -294,9 +334,9 @@ static void _FPDK_WriteAddr(const FPDKICTYPE type, const uint32_t addr, const ui
       for( uint32_t w=0; w<write_block_clocks_per_group; w++ )
       {
         _FPDK_SET_DAT_O(1);
-        _FPDK_DelayUS(30);
+        _FPDK_DelayUS(halfus);
         _FPDK_SET_DAT_O(0);
-        _FPDK_DelayUS(30);
+        _FPDK_DelayUS(halfus);
       }
       _FPDK_CLK_DOWN();
       _FPDK_DelayUS(4);
@@ -403,6 +443,41 @@ uint32_t FPDK_GetAdcVpp(void) {
   return _adc_vpp;
 }
 
+uint16_t FPDK_BufGetWord(const FPDKBUFSLOT* buf, const uint32_t idx)
+{
+  uint32_t bitpos = idx*buf->bits;
+  const uint8_t* d = &buf->data[bitpos>>3];
+  uint32_t v = d[0] | (((uint32_t)d[1])<<8) | (((uint32_t)d[2])<<16);
+  return (v>>(bitpos&7)) & ((1UL<<buf->bits)-1);
+}
+
+void FPDK_BufSetWord(FPDKBUFSLOT* buf, const uint32_t idx, const uint16_t val)
+{
+  uint32_t bitpos = idx*buf->bits;
+  uint8_t* d = &buf->data[bitpos>>3];
+  uint32_t m = ((1UL<<buf->bits)-1) << (bitpos&7);
+  uint32_t v = (val << (bitpos&7)) & m;
+  for( ; m; m>>=8, v>>=8, d++ )                                                                    //only touch bytes containing bits of this word (other slot may be written from interrupt)
+    *d = (*d & ~m) | v;
+}
+
+void FPDK_Abort(void)
+{
+  _abort_requested = true;
+}
+
+void FPDK_ClearAbort(void)
+{
+  _abort_requested = false;
+}
+
+void FPDK_GetProgress(uint32_t* phase, uint32_t* done, uint32_t* total)
+{
+  *phase = _progress_phase;
+  *done = _progress_done;
+  *total = _progress_total;
+}
+
 bool FPDK_SetVDD(uint32_t mV, uint32_t stabelizeDelayUS)
 {
   _dac_vdd = (mV*4095) / FPDK_VDD_DAC_MAX_MV;
@@ -468,6 +543,19 @@ static uint32_t _FPDK_GetIDIC(const FPDKICTYPE type, const uint32_t vpp_cmd, con
   return ic_id;
 }
 
+bool FPDK_SetTiming(const FPDKTIMING* timing)
+{
+  if( (timing->leave_progmode_us > FPDK_TIMING_MAX_WAITUS) ||
+      (timing->erase_wait_us > FPDK_TIMING_MAX_WAITUS) ||
+      (timing->write_wait_us > FPDK_TIMING_MAX_WAITUS) ||
+      (timing->erase_pulse_us > FPDK_TIMING_MAX_ERASE_PULSEUS) ||
+      (timing->write_clock_half_us > FPDK_TIMING_MAX_WRITE_CLOCKUS) )
+    return false;
+
+  _timing = *timing;
+  return true;
+}
+
 uint32_t FPDK_ProbeIC(FPDKICTYPE* type, uint32_t* vpp_cmd, uint32_t* vdd_cmd)
 {
   uint32_t vpp_probe;
@@ -502,7 +590,7 @@ uint32_t FPDK_ProbeIC(FPDKICTYPE* type, uint32_t* vpp_cmd, uint32_t* vdd_cmd)
 }
 
 uint16_t FPDK_ReadIC(const uint16_t ic_id, const FPDKICTYPE type, const uint32_t vpp_cmd, const uint32_t vdd_cmd,
-                     const uint32_t addr, const uint8_t addr_bits, uint16_t* data, const uint8_t data_bits, const uint32_t count)
+                     const uint32_t addr, const uint8_t addr_bits, FPDKBUFSLOT* buf, const uint32_t data_offs, const uint8_t data_bits, const uint32_t count)
 {
   if( (FPDK_IC_FLASH != type) && (ic_id != (_FPDK_GetIDIC( type, vpp_cmd, vdd_cmd, data_bits )&0xFFF)) )
     return FPDK_ERR_CMDRSP;
@@ -517,15 +605,28 @@ uint16_t FPDK_ReadIC(const uint16_t ic_id, const FPDKICTYPE type, const uint32_t
     return FPDK_ERR_CMDRSP;
   }
 
+  uint16_t ret = ic_id;
+
+  _FPDK_SetProgress(FPDKPROTO_PHASE_READ, count);
   for( uint32_t p=0; p<count; p++ )
-    data[p] = _FPDK_ReadAddr( type, addr+p, addr_bits, data_bits );
+  {
+    if( _abort_requested )
+    {
+      ret = FPDK_ERR_ABORTED;
+      break;
+    }
+
+    FPDK_BufSetWord( buf, data_offs+p, _FPDK_ReadAddr( type, addr+p, addr_bits, data_bits ) );
+    _progress_done = p+1;
+  }
 
   _FPDK_LeaveProgramingMode(type, 0);
-  return ic_id;
+  _progress_phase = FPDKPROTO_PHASE_IDLE;
+  return ret;
 }
 
 uint16_t FPDK_VerifyIC(const uint16_t ic_id, const FPDKICTYPE type, const uint32_t vpp_cmd, const uint32_t vdd_cmd,
-                       const uint32_t addr, const uint8_t addr_bits, const uint16_t* data, const uint8_t data_bits, const uint32_t count,
+                       const uint32_t addr, const uint8_t addr_bits, const FPDKBUFSLOT* buf, const uint32_t data_offs, const uint8_t data_bits, const uint32_t count,
                        const bool addr_exclude_first_instr, const uint32_t addr_exclude_start, const uint32_t addr_exclude_end)
 {
   if( (FPDK_IC_FLASH != type) && (ic_id != (_FPDK_GetIDIC( type, vpp_cmd, vdd_cmd, data_bits )&0xFFF)) )
@@ -545,18 +646,28 @@ uint16_t FPDK_VerifyIC(const uint16_t ic_id, const FPDKICTYPE type, const uint32
 
   uint32_t blank_value = (1<<data_bits)-1;
 
+  _FPDK_SetProgress(FPDKPROTO_PHASE_VERIFY, count);
   for( uint32_t p=0; p<count; p++ )
   {
+    if( _abort_requested )
+    {
+      ret = FPDK_ERR_ABORTED;
+      break;
+    }
+
+    _progress_done = p+1;
+
     if( addr_exclude_first_instr && (0 == addr+p) )
       continue;
 
-    if( (p<addr_exclude_start) || (p>addr_exclude_end) )
+    if( ((addr+p)<addr_exclude_start) || ((addr+p)>addr_exclude_end) )                             //exclude window is absolute, verify may start at any address
     {
       uint32_t dat = _FPDK_ReadAddr( type, addr+p, addr_bits, data_bits );
-      if( (data[p]&blank_value) != (dat&blank_value) )
+      uint32_t expected = FPDK_BufGetWord( buf, data_offs+p );
+      if( (expected&blank_value) != (dat&blank_value) )
       {
         //special exception if data was blank value this was a "joker" to skip write / ignore original value
-        if( (data[p]&blank_value) != blank_value )
+        if( (expected&blank_value) != blank_value )
         {
           ret = FPDK_ERR_VERIFY;
           break;
@@ -566,6 +677,7 @@ uint16_t FPDK_VerifyIC(const uint16_t ic_id, const FPDKICTYPE type, const uint32
   }
 
   _FPDK_LeaveProgramingMode(type, 0);
+  _progress_phase = FPDKPROTO_PHASE_IDLE;
   return ret;
 }
 
@@ -589,9 +701,18 @@ uint16_t FPDK_BlankCheckIC(const uint16_t ic_id, const FPDKICTYPE type, const ui
   uint32_t blank_value = (1<<data_bits)-1;
 
   uint16_t ret = ic_id;
-  
+
+  _FPDK_SetProgress(FPDKPROTO_PHASE_BLANKCHECK, count);
   for( uint32_t p=0; p<count; p++ )
   {
+    if( _abort_requested )
+    {
+      ret = FPDK_ERR_ABORTED;
+      break;
+    }
+
+    _progress_done = p+1;
+
     if( addr_exclude_first_instr && (0 == p) )
       continue;
 
@@ -607,6 +728,7 @@ uint16_t FPDK_BlankCheckIC(const uint16_t ic_id, const FPDKICTYPE type, const ui
   }
 
   _FPDK_LeaveProgramingMode(type, 0);
+  _progress_phase = FPDKPROTO_PHASE_IDLE;
   return ret;
 }
 
@@ -631,29 +753,41 @@ uint16_t FPDK_EraseIC(const uint16_t ic_id, const FPDKICTYPE type,
       !FPDK_SetVDD(vdd_erase, FPDK_VDD_EW_STABELIZE_DELAYUS)   )
     return FPDK_ERR_HVPPHVDD;
 
+  uint16_t ret = ic_id;
+  uint32_t pulseus = _FPDK_Timing(_timing.erase_pulse_us, FPDK_ERASE_PULSE_DELAYUS);
+
+  _FPDK_SetProgress(FPDKPROTO_PHASE_ERASE, erase_clocks);
   for( uint32_t e=0; e<erase_clocks; e++ )
   {
+    if( _abort_requested )
+    {
+      ret = FPDK_ERR_ABORTED;
+      break;
+    }
+
     _FPDK_CLK_UP();
-    _FPDK_DelayUS(5000);
+    _FPDK_DelayUS(pulseus);
     _FPDK_CLK_DOWN();
     _FPDK_DelayUS(1);
     _FPDK_CLK_UP();
     _FPDK_DelayUS(1);
     _FPDK_CLK_DOWN();
     _FPDK_DelayUS(4);
+    _progress_done = e+1;
   }
 
   _FPDK_Clock();                                                                                   //1 extra clock
-  _FPDK_LeaveProgramingMode(type, 100000);
+  _FPDK_LeaveProgramingMode(type, _FPDK_Timing(_timing.erase_wait_us, FPDK_ERASE_WAIT_DELAYUS));
+  _progress_phase = FPDKPROTO_PHASE_IDLE;
 
-  return ic_id;
+  return ret;
 }
 
 uint16_t FPDK_WriteIC(const uint16_t ic_id, const FPDKICTYPE type, 
                       const uint32_t vpp_cmd, const uint32_t vdd_cmd,
                       const uint32_t vpp_write, const uint32_t vdd_write,
                       const uint32_t addr, const uint8_t addr_bits, 
-                      const uint16_t* data, const uint8_t data_bits, 
+                      const FPDKBUFSLOT* buf, const uint32_t data_offs, const uint8_t data_bits, 
                       const uint32_t count, 
                       const uint8_t write_block_size, const uint8_t write_block_clock_groups, const uint8_t write_block_clocks_per_group)
 {
@@ -679,13 +813,23 @@ uint16_t FPDK_WriteIC(const uint16_t ic_id, const FPDKICTYPE type,
 
   uint32_t blank_value = (1<<data_bits)-1;
 
+  uint16_t ret = ic_id;
+
+  _FPDK_SetProgress(FPDKPROTO_PHASE_WRITE, count);
   for( uint32_t p=0; p<count; p+=write_block_size )
   {
+    if( _abort_requested )                                                                         //abort between blocks, a started block is always completed
+    {
+      ret = FPDK_ERR_ABORTED;
+      break;
+    }
+
     uint16_t write_buf[8];
     memset( write_buf, 0xFF, sizeof(write_buf) );                                                  //initialize empty write buffer (all bits '1')
 
     uint32_t write_count = (count>(p+write_block_size-1))?write_block_size:(count-p);
-    memcpy( &write_buf[addr % write_block_size], &data[p], write_count*sizeof(uint16_t) );         //place data to write in write buffer (aligned to block size)
+    for( uint32_t c=0; c<write_count; c++ )                                                        //place data to write in write buffer (aligned to block size)
+      write_buf[(addr % write_block_size)+c] = FPDK_BufGetWord( buf, data_offs+p+c );
 
     bool block_is_empty = true;
     for( uint32_t c=0; c<write_block_size; c++ )                                                   //check of complete block is empty (all bits '1')
@@ -704,123 +848,320 @@ uint16_t FPDK_WriteIC(const uint16_t ic_id, const FPDKICTYPE type,
                       write_addr_aligned, addr_bits, write_buf, data_bits, 
                       write_block_size, write_block_clock_groups, write_block_clocks_per_group);
     }
+    _progress_done = p+write_count;
   }
 
-  _FPDK_LeaveProgramingMode(type, 100000);
+  _FPDK_LeaveProgramingMode(type, _FPDK_Timing(_timing.write_wait_us, FPDK_WRITE_WAIT_DELAYUS));
+  _progress_phase = FPDKPROTO_PHASE_IDLE;
 
-  return ic_id;
+  return ret;
 }
 
 ////////////////////////////
 
 #define SPI_BLOCK_SIZE 16
-#define SPI_BLOCKS_MEASURE 10
-#define SPI_BLOCKS_IGNORE  1
 static uint8_t _spiDMARxBuffer[SPI_BLOCK_SIZE];
 static uint8_t _spiDMATxBuffer[SPI_BLOCK_SIZE];
 
-static volatile bool     _spiSendPulseStartMeasure;
-static volatile int32_t  _spiFreqMeasureCounter;
-static volatile uint32_t _spiFrequency;
+static volatile uint32_t _spiPulses;                                                               //trim increments still to send to IC
+static volatile uint32_t _spiIdleHalfBlocks;                                                       //half blocks without pulses since last pulse
 
-void HAL_SPI_TxRxHalfCpltCallback(SPI_HandleTypeDef *hspi)
+#define FREQ_CAPTURE_PRESCALER 8                                                                   //IC clock edges per TIM2 capture
+#define FREQ_CAPTURES          128
+static uint32_t _freqCaptures[FREQ_CAPTURES];
+
+#define FPDK_CALIB_GATE_MAX_US       20000                                                         //maximum gate time of frequency measurement (slow ILRC)
+#define FPDK_CALIB_MIN_INTERVALS     4                                                             //capture intervals needed for a confidence estimate
+#define FPDK_CALIB_RESTART_DELAYUS   10000                                                         //IC without VDD before calibration loop starts again
+
+#define FPDK_CALIB_VDD_TOLERANCE_MV  10
+#define FPDK_CALIB_VDD_REGULATE_MAX  16
+
+static uint8_t  _calibTrim;                                                                        //trim value in IC (calibration loop adds 1 for every pulse, 8 bit wrap)
+static uint32_t _calibVDD;
+static uint32_t _calibMultiplier;
+static uint32_t _calibMeasurements;
+static uint32_t _calibResolution;                                                                  //relative resolution (ppm) frequency measurements have to reach
+
+//place pulses in half of SPI buffer which gets sent next: single one bits separated by zero bits (IC loop samples once per SPI clock)
+static void _FPDK_CalibrateFillPulses(uint8_t* half)
 {
-  if( _spiSendPulseStartMeasure )
+  uint32_t pulses = _spiPulses;
+  uint32_t sent = 0;
+  for( uint32_t i=0; i<SPI_BLOCK_SIZE/2; i++ )
   {
-    _spiSendPulseStartMeasure = false;
-    _spiFreqMeasureCounter = -SPI_BLOCKS_IGNORE;
-    _spiDMATxBuffer[0] = 1; //set single one bit
+    uint32_t n = ((pulses-sent)>4)?4:(pulses-sent);
+    half[i] = 0x55>>(2*(4-n));
+    sent += n;
   }
-  else
-    _spiDMATxBuffer[0] = 0; //reset single one bit
+  _spiPulses = pulses-sent;
+  _spiIdleHalfBlocks = sent?0:(_spiIdleHalfBlocks+1);
 }
 
-void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+void HAL_SPI_TxRxHalfCpltCallback(SPI_HandleTypeDef *hspi)
 {
-  if( !_spiFreqMeasureCounter )
-    __HAL_TIM_SET_COUNTER(&htim2,0);
+  _FPDK_CalibrateFillPulses(&_spiDMATxBuffer[0]);
+}
 
-  if( _spiFreqMeasureCounter <= SPI_BLOCKS_MEASURE )
-    _spiFreqMeasureCounter++;
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  _FPDK_CalibrateFillPulses(&_spiDMATxBuffer[SPI_BLOCK_SIZE/2]);
+}
 
-  if( SPI_BLOCKS_MEASURE == _spiFreqMeasureCounter )
-  {
-    uint32_t c = __HAL_TIM_GET_COUNTER(&htim2);
-    _spiFrequency = (8*SPI_BLOCK_SIZE*(SPI_BLOCKS_MEASURE-1)*48000000ULL)/c;
-  }
+//IC clock output (PA3) goes to SPI1 SCK (clocks trim pulses) or TIM2 CH2 (frequency measurement)
+static void _FPDK_CalibrateSetClockPin(const uint32_t alternate)
+{
+  MODIFY_REG( IC_IO_PA3_CLK_GPIO_Port->AFR[0], GPIO_AFRL_AFSEL3, alternate<<GPIO_AFRL_AFSEL3_Pos );
 }
 
-static uint32_t _FPDK_CalibrateGetNextFreqeuncy()
+static bool _FPDK_CalibrateSendPulses(const uint32_t pulses)
 {
-  _spiFrequency = 0;
-  _spiSendPulseStartMeasure = true;
+  _spiIdleHalfBlocks = 0;
+  _spiPulses = pulses;
 
   uint32_t timeoutTick = HAL_GetTick() + 1000;
-  for( ; HAL_GetTick()<timeoutTick; )
+  for( ; (HAL_GetTick()<timeoutTick) && !_abort_requested; )
   {
-    if( _spiFrequency )
-      return _spiFrequency;
+    if( !_spiPulses && (_spiIdleHalfBlocks>=2) )                                                   //half with last pulses was sent completely
+      return true;
   }
 
-  return 0;
+  _spiPulses = 0;
+  return false;
 }
 
-static uint8_t _FPDK_CalibrateSingleFrequency(const uint32_t tune_frequency, const uint32_t multiplier, uint32_t* actual_frequency)
+//reciprocal frequency counter: TIM2 (48MHz) captures timestamp of every FREQ_CAPTURE_PRESCALER'th IC clock edge via DMA,
+//frequency = edges between first and last capture / time between them (resolution depends on gate time, not on frequency)
+//gate time adapts: measurement stops as soon as the 95% confidence interval of the mean capture interval (jitter)
+//and timer quantization are below half of the requested relative resolution
+static uint32_t _FPDK_CalibrateMeasureFrequency(const uint32_t resolution_ppm)
 {
-  int32_t bestDistance = 100000000; //100MHz, can not be reached
-  uint8_t bestMatch = 0;
-  for( uint16_t t=0; t<0xA0; t++ ) //0x9F seems maximum for IHRCR, upper bits unknown
+  DMA_HandleTypeDef* hdma = htim2.hdma[TIM_DMA_ID_CC2];
+
+  _FPDK_CalibrateSetClockPin(GPIO_AF2_TIM2);
+  HAL_DMA_Start(hdma, (uint32_t)&htim2.Instance->CCR2, (uint32_t)_freqCaptures, FREQ_CAPTURES);
+  __HAL_TIM_ENABLE_DMA(&htim2, TIM_DMA_CC2);
+  HAL_TIM_IC_Start(&htim2, TIM_CHANNEL_2);
+
+  uint32_t gateStart = __HAL_TIM_GET_COUNTER(&htim2);
+  uint32_t timeoutTick = HAL_GetTick() + 1000;
+  uint32_t captures;
+  uint32_t used = 2;                                                                               //first capture is ignored (pin switch can cause a glitch)
+  uint64_t sum = 0, sumsq = 0;
+  for( ;; )
   {
-    uint32_t measured_frequency = multiplier * _FPDK_CalibrateGetNextFreqeuncy(); 
+    captures = FREQ_CAPTURES - __HAL_DMA_GET_COUNTER(hdma);
+    if( captures >= FREQ_CAPTURES )
+      break;
+    if( (HAL_GetTick()>timeoutTick) || _abort_requested )
+      break;
 
-    int32_t distance = abs((int32_t)measured_frequency - (int32_t)tune_frequency);
-    if( distance < bestDistance )
+    if( captures>used )
     {
-      bestDistance = distance;
-      bestMatch = t;
-      *actual_frequency = measured_frequency;
+      for( ; used<captures; used++ )
+      {
+        uint32_t d = _freqCaptures[used] - _freqCaptures[used-1];
+        sum += d;
+        sumsq += (uint64_t)d*d;
+      }
+
+      uint32_t n = used-2;
+      if( n>=FPDK_CALIB_MIN_INTERVALS )
+      {
+        //relative CI^2 = 4*var/(n*mean^2) = 4*(n*sumsq-sum^2)/((n-1)*sum^2) <= (resolution/2)^2, quantization: 1/sum <= resolution/2
+        float r = (float)resolution_ppm/2000000.0f;
+        float fsum = (float)sum;
+        float var = (float)(n*sumsq - sum*sum);
+        if( ((4.0f*var) <= ((float)(n-1)*fsum*fsum*r*r)) && ((fsum*r) >= 1.0f) )
+          break;
+      }
     }
+
+    if( (captures>=3) && ((__HAL_TIM_GET_COUNTER(&htim2)-gateStart) >= (FPDK_CALIB_GATE_MAX_US*48)) )
+      break;
+  }
+
+  HAL_TIM_IC_Stop(&htim2, TIM_CHANNEL_2);
+  __HAL_TIM_DISABLE_DMA(&htim2, TIM_DMA_CC2);
+  HAL_DMA_Abort(hdma);
+  _FPDK_CalibrateSetClockPin(GPIO_AF0_SPI1);
+
+  if( captures<3 )
+    return 0;
+
+  uint32_t ticks = _freqCaptures[captures-1] - _freqCaptures[1];
+  if( !ticks )
+    return 0;
+
+  return ((uint64_t)(captures-2)*FREQ_CAPTURE_PRESCALER*48000000ULL)/ticks;
+}
+
+static uint32_t _FPDK_CalibrateGetNextFreqeuncy(const uint32_t pulses)
+{
+  if( !_FPDK_CalibrateSendPulses(pulses) )
+    return 0;
+
+  return _FPDK_CalibrateMeasureFrequency(_calibResolution);
+}
+
+//calibration loop of IC starts again with trim 0xFF (first pulse selects 0)
+static bool _FPDK_CalibrateRestart(void)
+{
+  FPDK_SetVDD(0, FPDK_CALIB_RESTART_DELAYUS);
+  _calibTrim = 0xFF;
+  return FPDK_SetVDD(_calibVDD, FPDK_VDD_CAL_STARTUP_DELAYUS);
+}
+
+//trim can only be incremented: going down restarts IC instead of wrapping around through unknown trims above FPDKPROTO_CALIB_TRIM_MAX
+static uint32_t _FPDK_CalibrateMeasureTrim(const uint8_t trim, const uint32_t multiplier)
+{
+  if( (trim < _calibTrim) && (0xFF != _calibTrim) && !_FPDK_CalibrateRestart() )
+    return 0;
+  uint8_t pulses = trim - _calibTrim;
+  _calibTrim = trim;
+  _progress_done = ++_calibMeasurements;
+  return multiplier * _FPDK_CalibrateGetNextFreqeuncy(pulses);
+}
+
+static uint32_t _FPDK_CalibrateSearchMeasure(const uint8_t trim, const uint32_t resolution_ppm)
+{
+  _calibResolution = resolution_ppm;
+  return _FPDK_CalibrateMeasureTrim(trim, _calibMultiplier);
+}
+
+//setup SPI + always running DMA for TX/RX (trim pulses), TIM2 input capture for frequency measurement and start IC with calibration stub
+static bool _FPDK_CalibrateStart(const uint32_t vdd)
+{
+  memset(_spiDMATxBuffer, 0, sizeof(_spiDMATxBuffer));
+  _spiPulses = 0;
+  if( HAL_OK != HAL_SPI_Init(&hspi1) )
+    return false;
+  if( HAL_OK != HAL_SPI_TransmitReceive_DMA(&hspi1, _spiDMATxBuffer, _spiDMARxBuffer, SPI_BLOCK_SIZE) )
+    return false;
+
+  TIM_IC_InitTypeDef sConfigIC = { .ICPolarity = TIM_ICPOLARITY_RISING, .ICSelection = TIM_ICSELECTION_DIRECTTI,
+                                   .ICPrescaler = TIM_ICPSC_DIV8, .ICFilter = 0 };
+  if( HAL_OK != HAL_TIM_IC_ConfigChannel(&htim2, &sConfigIC, TIM_CHANNEL_2) )
+    return false;
+
+  _calibVDD = vdd;
+  _calibTrim = 0xFF;                                                                               //calibration loop starts with 0xFF, first pulse selects 0
+  return FPDK_SetVDD(vdd, FPDK_VDD_CAL_STARTUP_DELAYUS);
+}
+
+static void _FPDK_CalibrateStop(void)
+{
+  FPDK_SetVDD(0,0);
+  HAL_SPI_Abort(&hspi1);
+  HAL_SPI_DeInit(&hspi1);
+  _progress_phase = FPDKPROTO_PHASE_IDLE;
+
+  _FPDK_DelayUS(50000);
+}
+
+//regulate VDD with ADC measurement (referenced to VREFINT_CAL) instead of trusting DAC output
+static bool _FPDK_CalibrateRegulateVDD(const uint32_t mV)
+{
+  int32_t dac = _dac_vdd;
+  for( uint32_t i=0; (i<FPDK_CALIB_VDD_REGULATE_MAX) && !_abort_requested; i++ )
+  {
+    _FPDK_DelayUS(2000);                                                                           //some ADC updates (averaged)
+
+    int32_t err = (int32_t)mV - (int32_t)_adc_vdd;
+    if( abs(err) <= FPDK_CALIB_VDD_TOLERANCE_MV )
+      return true;
+
+    int32_t step = (err*4095) / (int32_t)FPDK_VDD_DAC_MAX_MV;
+    if( !step )
+      step = (err>0)?1:-1;
+    dac += step;
+    if( dac<0 )
+      dac = 0;
+    if( dac>4095 )
+      dac = 4095;
+
+    _dac_vdd = dac;
+    HAL_DACEx_DualSetValue( &hdac, DAC_ALIGN_12B_R, _dac_vpp, _dac_vdd );                          //set VDD
   }
-  return bestMatch;
+  return false;
 }
 
 bool FPDK_Calibrate(const uint32_t type, const uint32_t vdd, 
                     const uint32_t frequency, const uint32_t multiplier,
                     uint8_t* fcalval, uint32_t* freq_tuned, 
-                    uint8_t* bgcalval)
+                    uint8_t* bgcalval, uint32_t* measurements)
 {
   bool ret = false;
+  *measurements = 0;
+  *bgcalval = 0;
+
+  //BG is not tuned (no IC pin reaches an ADC input): combined types calibrate the frequency only, BG only is refused by host
+  if( FPDKPROTO_CALIB_BG == type )
+    return false;
 
   for( ;; )
   {
-    //setup SPI + always running DMA for TX/RX
-    memset(_spiDMATxBuffer, 0, sizeof(_spiDMATxBuffer));
-    if( HAL_OK != HAL_SPI_Init(&hspi1) )
-      break;;
-    if( HAL_OK != HAL_SPI_TransmitReceive_DMA(&hspi1, _spiDMATxBuffer, _spiDMARxBuffer, SPI_BLOCK_SIZE) )
+    if( !_FPDK_CalibrateStart(vdd) )
       break;
 
-    //start IC
-    if( !FPDK_SetVDD(vdd, FPDK_VDD_CAL_STARTUP_DELAYUS) )
-      return false;
+    _calibMeasurements = 0;
+    _calibMultiplier = multiplier;
+    _FPDK_SetProgress(FPDKPROTO_PHASE_CALIBRATE, FPDKCALSEARCH_MAX_MEASUREMENTS);
 
-    //TODO: ADD BG TYPE
-
-    *fcalval = _FPDK_CalibrateSingleFrequency( frequency, multiplier, freq_tuned );
+    *fcalval = FPDKCALSEARCH_Frequency( frequency, FPDKPROTO_CALIB_TRIM_MAX, _FPDK_CalibrateSearchMeasure, &_abort_requested, freq_tuned );
+    *measurements = _calibMeasurements;
 
     //found valid tuning (max 10% drift) ?
-    if( abs( *freq_tuned - frequency ) < (frequency/10) )
+    if( !_abort_requested && (abs( *freq_tuned - frequency ) < (frequency/10)) )
       ret = true;
 
     break;
   }
 
-  FPDK_SetVDD(0,0);
-  HAL_SPI_Abort(&hspi1);
-  HAL_SPI_DeInit(&hspi1);
-
-  _FPDK_DelayUS(50000);
+  _FPDK_CalibrateStop();
 
   return ret;
 }
 
+uint32_t FPDK_Characterize(const uint32_t type, const uint32_t vdd_first, const uint32_t vdd_last, const uint32_t vdd_step,
+                           const uint32_t multiplier, const uint8_t trim_first, const uint8_t trim_last,
+                           FPDK_CHARACTERIZECB cb)
+{
+  if( (FPDKPROTO_CALIB_BG == type) || (trim_last<trim_first) || (trim_last>FPDKPROTO_CALIB_TRIM_MAX) || (vdd_last<vdd_first) )
+    return 0;
+
+  uint32_t levels = vdd_step?(1+(vdd_last-vdd_first)/vdd_step):1;
+  uint32_t trims = 1+trim_last-trim_first;
+  uint32_t samples = 0;
+
+  if( _FPDK_CalibrateStart(vdd_first) )
+  {
+    _calibMeasurements = 0;
+    _FPDK_SetProgress(FPDKPROTO_PHASE_CHARACTERIZE, levels*trims);
+
+    _calibResolution = FPDKCALSEARCH_RES_MIN_PPM;                                                  //full curve: finest resolution
+
+    //next level restarts IC at its VDD (trim can only be incremented), then VDD is regulated
+    for( uint32_t l=0; (l<levels) && !_abort_requested; l++ )
+    {
+      uint32_t vdd = vdd_first + l*vdd_step;
+      _calibVDD = vdd;
+      if( l && !_FPDK_CalibrateRestart() )
+        break;
+      if( !_FPDK_CalibrateRegulateVDD(vdd) )
+        break;
+
+      for( uint32_t t=trim_first; (t<=trim_last) && !_abort_requested; t++ )
+      {
+        uint32_t frequency = _FPDK_CalibrateMeasureTrim(t, multiplier);                            //0: no clock, sample is reported anyway
+        cb(_adc_vdd, t, frequency);
+        samples++;
+      }
+    }
+  }
+
+  _FPDK_CalibrateStop();
+
+  return samples;
+}
+
@@ -31,6 +31,24 @@ typedef enum FPDKICTYPE
   FPDK_IC_OTP2  = '2',
 } FPDKICTYPE;
 
+typedef void (*FPDK_CHARACTERIZECB)(const uint32_t vdd, const uint8_t trim, const uint32_t frequency);
+
+typedef struct FPDKBUFSLOT
+{
+  uint8_t* data;                                                                                   //words bit packed (LSB first), needs 2 bytes readable behind the end
+  uint32_t words;
+  uint8_t  bits;
+} FPDKBUFSLOT;
+
+typedef struct FPDKTIMING                                                                          //all values in us, 0 = firmware default
+{
+  uint32_t leave_progmode_us;
+  uint32_t erase_wait_us;
+  uint32_t write_wait_us;
+  uint32_t erase_pulse_us;
+  uint32_t write_clock_half_us;
+} FPDKTIMING;
+
 void     FPDK_Init(void);
 void     FPDK_DeInit(void);
 
@@ -44,20 +62,29 @@ uint32_t FPDK_GetAdcVref(void);
 uint32_t FPDK_GetAdcVdd(void);
 uint32_t FPDK_GetAdcVpp(void);
 
+void     FPDK_Abort(void);
+void     FPDK_ClearAbort(void);
+void     FPDK_GetProgress(uint32_t* phase, uint32_t* done, uint32_t* total);
+
+uint16_t FPDK_BufGetWord(const FPDKBUFSLOT* buf, const uint32_t idx);
+void     FPDK_BufSetWord(FPDKBUFSLOT* buf, const uint32_t idx, const uint16_t val);
+
+bool     FPDK_SetTiming(const FPDKTIMING* timing);
+
 uint32_t FPDK_ProbeIC(FPDKICTYPE* type, uint32_t* vpp_cmd, uint32_t* vdd_cmd);
 
 uint16_t FPDK_ReadIC(const uint16_t ic_id,
                      const FPDKICTYPE type,
                      const uint32_t vpp_cmd, const uint32_t vdd_cmd,
                      const uint32_t addr, const uint8_t addr_bits,
-                     uint16_t* data, const uint8_t data_bits,
+                     FPDKBUFSLOT* buf, const uint32_t data_offs, const uint8_t data_bits,
                      const uint32_t count);
 
 uint16_t FPDK_VerifyIC(const uint16_t ic_id,
                        const FPDKICTYPE type,
                        const uint32_t vpp_cmd, const uint32_t vdd_cmd,
                        const uint32_t addr, const uint8_t addr_bits,
-                       const uint16_t* data, const uint8_t data_bits,
+                       const FPDKBUFSLOT* buf, const uint32_t data_offs, const uint8_t data_bits,
                        const uint32_t count,
                        const bool addr_exclude_first_instr, const uint32_t addr_exclude_start, const uint32_t addr_exclude_end);
 
@@ -80,13 +107,17 @@ uint16_t FPDK_WriteIC(const uint16_t ic_id,
                       const uint32_t vpp_cmd, const uint32_t vdd_cmd,
                       const uint32_t vpp_write, const uint32_t vdd_write,
                       const uint32_t addr, const uint8_t addr_bits,
-                      const uint16_t* data, const uint8_t data_bits,
+                      const FPDKBUFSLOT* buf, const uint32_t data_offs, const uint8_t data_bits,
                       const uint32_t count,
                       const uint8_t write_block_size, const uint8_t write_block_clock_groups, const uint8_t write_block_clocks_per_group);
 
 bool FPDK_Calibrate(const uint32_t type, const uint32_t vdd,
                     const uint32_t frequency, const uint32_t multiplier,
                     uint8_t* fcalval1, uint32_t* freq1_tuned,
-                    uint8_t* bgcalval);
+                    uint8_t* bgcalval, uint32_t* measurements);
+
+uint32_t FPDK_Characterize(const uint32_t type, const uint32_t vdd_first, const uint32_t vdd_last, const uint32_t vdd_step,
+                           const uint32_t multiplier, const uint8_t trim_first, const uint8_t trim_last,
+                           FPDK_CHARACTERIZECB cb);
 
 #endif //__FPDK_H_
@@ -0,0 +1,154 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+//calibration search on measured trim values, independent of the hardware (also compiled by host for calsearchbench)
+
+#include "fpdkcalsearch.h"
+#include <string.h>
+#include <stdlib.h>
+
+typedef struct FPDKCALSEARCHSTATE
+{
+  uint32_t                tune_frequency;
+  FPDKCALSEARCH_MEASURECB measure;
+  uint32_t                resolution;
+  uint32_t                bestDistance;
+  uint8_t                 bestMatch;
+  uint32_t                bestFrequency;
+  uint8_t                 measured[256/8];                                                         //trims measured already (bit mask)
+  uint32_t                points;
+  uint8_t                 pointTrim[2+8+8];                                                        //range ends + binary search + probes below best
+  uint32_t                pointFrequency[2+8+8];
+} FPDKCALSEARCHSTATE;
+
+static uint32_t _FPDKCALSEARCH_Check(FPDKCALSEARCHSTATE* s, const uint8_t trim)
+{
+  uint32_t measured_frequency = s->measure(trim, s->resolution);
+  s->measured[trim>>3] |= 1<<(trim&7);
+
+  uint32_t distance = abs((int32_t)measured_frequency - (int32_t)s->tune_frequency);
+  if( (distance < s->bestDistance) || ((distance == s->bestDistance) && (trim < s->bestMatch)) )
+  {
+    s->bestDistance = distance;
+    s->bestMatch = trim;
+    s->bestFrequency = measured_frequency;
+  }
+  return measured_frequency;
+}
+
+static uint32_t _FPDKCALSEARCH_Point(FPDKCALSEARCHSTATE* s, const uint8_t trim)
+{
+  uint32_t measured_frequency = _FPDKCALSEARCH_Check(s, trim);
+  if( s->points < sizeof(s->pointTrim) )
+  {
+    s->pointTrim[s->points] = trim;
+    s->pointFrequency[s->points++] = measured_frequency;
+  }
+  return measured_frequency;
+}
+
+//frequency above tune frequency in direction of trim range (negative: below)
+static inline int64_t _FPDKCALSEARCH_Deviation(const uint32_t frequency, const uint32_t tune_frequency, const bool rising)
+{
+  int64_t d = (int64_t)frequency - (int64_t)tune_frequency;
+  return rising?d:-d;
+}
+
+//resolution for next measurements: separate neighbouring trim values (average step of measured range)
+static void _FPDKCALSEARCH_SetResolution(FPDKCALSEARCHSTATE* s, const uint32_t span, const uint8_t trim_max)
+{
+  uint32_t res = ((uint64_t)span*1000000ULL) / ((uint64_t)trim_max*s->tune_frequency);
+  if( res<FPDKCALSEARCH_RES_MIN_PPM )
+    res = FPDKCALSEARCH_RES_MIN_PPM;
+  if( res>FPDKCALSEARCH_RES_INITIAL_PPM )
+    res = FPDKCALSEARCH_RES_INITIAL_PPM;
+  s->resolution = res;
+}
+
+uint8_t FPDKCALSEARCH_Frequency(const uint32_t tune_frequency, const uint8_t trim_max, FPDKCALSEARCH_MEASURECB measure,
+                                const volatile bool* abort, uint32_t* actual_frequency)
+{
+  FPDKCALSEARCHSTATE s = { .tune_frequency = tune_frequency, .measure = measure, .resolution = FPDKCALSEARCH_RES_INITIAL_PPM,
+                           .bestDistance = 0xFFFFFFFF, .bestMatch = 0, .bestFrequency = 0, .points = 0 };
+  memset(s.measured, 0, sizeof(s.measured));
+
+  //successive approximation, direction of trim is taken from range ends
+  uint32_t freq_lo = _FPDKCALSEARCH_Point(&s, 0);
+  uint32_t freq_hi = _FPDKCALSEARCH_Point(&s, trim_max);
+  bool rising = (freq_hi >= freq_lo);
+  uint32_t span = rising?(freq_hi-freq_lo):(freq_lo-freq_hi);
+  _FPDKCALSEARCH_SetResolution(&s, span, trim_max);
+
+  uint8_t lo = 0, hi = trim_max;
+  while( ((hi-lo)>1) && !*abort )
+  {
+    uint8_t mid = (lo+hi)/2;
+    uint32_t measured_frequency = _FPDKCALSEARCH_Point(&s, mid);
+    if( (measured_frequency < tune_frequency) == rising )
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  //local refinement (trim steps are not strictly monotonic): a trim can only be closer than best if no trim below it is more than
+  //best + FPDKCALSEARCH_REFINE average steps under tune frequency (above it: over), measure ascending from last such point below
+  //up to first such trim above (without measured range ends: FPDKCALSEARCH_REFINE neighbours)
+  uint32_t step_margin = ((uint64_t)span*FPDKCALSEARCH_REFINE)/trim_max;
+  int32_t first = (int32_t)s.bestMatch-FPDKCALSEARCH_REFINE, last = (int32_t)s.bestMatch+FPDKCALSEARCH_REFINE;
+  if( span )
+  {
+    first = 0;
+    last = trim_max;
+    for( uint32_t p=0; p<s.points; p++ )
+    {
+      if( (_FPDKCALSEARCH_Deviation(s.pointFrequency[p], tune_frequency, rising) < -((int64_t)s.bestDistance+step_margin)) &&
+          (s.pointTrim[p] >= first) )
+        first = s.pointTrim[p]+1;
+    }
+
+    //points below may be far away: probe in growing distance below best
+    uint8_t center = s.bestMatch;
+    for( int32_t k=FPDKCALSEARCH_REFINE+1; ((int32_t)center-k >= first) && !*abort; k*=2 )
+    {
+      uint8_t t = center-k;
+      if( !(s.measured[t>>3] & (1<<(t&7))) &&
+          (_FPDKCALSEARCH_Deviation(_FPDKCALSEARCH_Point(&s, t), tune_frequency, rising) < -((int64_t)s.bestDistance+step_margin)) )
+      {
+        first = t+1;
+        break;
+      }
+    }
+  }
+  for( int32_t t=(first<0)?0:first; (t<=last) && !*abort; t++ )                                    //ascending: cheap trim increments
+  {
+    uint32_t measured_frequency = 0;
+    if( !(s.measured[t>>3] & (1<<(t&7))) )
+      measured_frequency = _FPDKCALSEARCH_Check(&s, t);
+    else
+    {
+      for( uint32_t p=0; p<s.points; p++ )                                                         //trims above refinement are points
+        if( s.pointTrim[p] == t )
+          measured_frequency = s.pointFrequency[p];
+    }
+    if( span && (_FPDKCALSEARCH_Deviation(measured_frequency, tune_frequency, rising) > ((int64_t)s.bestDistance+step_margin)) )
+      break;
+  }
+
+  *actual_frequency = s.bestFrequency;
+  return s.bestMatch;
+}
@@ -0,0 +1,19 @@
+#ifndef __FPDKCALSEARCH_H_
+#define __FPDKCALSEARCH_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+
+#define FPDKCALSEARCH_REFINE           2                                                           //tolerated step back of trim curve (average trim steps), sets refinement window
+#define FPDKCALSEARCH_MAX_MEASUREMENTS (2+8+2*FPDKCALSEARCH_REFINE)                                //range ends + binary search + typical refinement (progress)
+#define FPDKCALSEARCH_RES_INITIAL_PPM  100000                                                      //resolution before trim step is known: frequency/10 (tuning acceptance)
+#define FPDKCALSEARCH_RES_MIN_PPM      200                                                         //finest resolution requested (bounded by gate time anyway)
+
+typedef uint32_t (*FPDKCALSEARCH_MEASURECB)(const uint8_t trim, const uint32_t resolution_ppm);    //frequency (Hz) with trim set, 0 = no clock
+
+//best trim 0..trim_max for tune_frequency: same result as measuring all trims (closest frequency, lowest trim on equal distance)
+//as long as no trim is more than FPDKCALSEARCH_REFINE average steps against the range direction from any higher trim
+uint8_t FPDKCALSEARCH_Frequency(const uint32_t tune_frequency, const uint8_t trim_max, FPDKCALSEARCH_MEASURECB measure,
+                                const volatile bool* abort, uint32_t* actual_frequency);
+
+#endif //__FPDKCALSEARCH_H_
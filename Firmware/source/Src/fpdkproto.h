@@ -18,17 +18,21 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef __FPDKPROTO_H_
 #define __FPDKPROTO_H_
 
-#define __FPDKPROTO__ "1.0"
+#define __FPDKPROTO__ "1.1"
 
 typedef enum FPDKPROTO_CMD
 {
+  FPDKPROTO_CMD_EXTFRAME     = '+',                                                                //length extension (protocol 1.1): {'+', cmd, length u16, payload}
+
   FPDKPROTO_CMD_GETVERINFO   = 'I',
   FPDKPROTO_CMD_SETLED       = 'L',
   FPDKPROTO_CMD_GETBUTTON    = 'B',
 
   FPDKPROTO_CMD_SETVOLTOUT   = 'O',
   FPDKPROTO_CMD_GETVOLTAGES  = 'U',
+  FPDKPROTO_CMD_SETTIMING    = 'M',
 
+  FPDKPROTO_CMD_INITBUF      = 'N',
   FPDKPROTO_CMD_SETBUF       = 'S',
   FPDKPROTO_CMD_GETBUF       = 'G',
 
@@ -39,10 +43,14 @@ typedef enum FPDKPROTO_CMD
   FPDKPROTO_CMD_WRITEIC      = 'W',
   FPDKPROTO_CMD_VERIFYIC     = 'V',
   FPDKPROTO_CMD_CALIBRATEIC  = 'C',
+  FPDKPROTO_CMD_CHARACTERIZEIC = 'K',
+  FPDKPROTO_CMD_GETPROGRESS  = 'T',
+  FPDKPROTO_CMD_ABORTIC      = 'A',
 
   FPDKPROTO_CMD_EXECUTEIC    = 'X',
   FPDKPROTO_CMD_STOPIC       = 'Q',
   FPDKPROTO_CMD_DBGDAT       = 'D',
+  FPDKPROTO_CMD_GETTRACE     = 'Y',
 
 } FPDKPROTO_CMD;
 
@@ -51,9 +59,57 @@ typedef enum FPDKPROTO_RSP
   FPDKPROTO_RSP_ERROR        = 'E',
   FPDKPROTO_RSP_ACK          = 'A',
   FPDKPROTO_RSP_DBGDAT       = 'D',
+  FPDKPROTO_RSP_PROGRESS     = 'P',
+  FPDKPROTO_RSP_BUFACK       = 'B',
+  FPDKPROTO_RSP_CHARDAT      = 'C',
+  FPDKPROTO_RSP_DBGCREDIT    = 'R',
 
 } FPDKPROTO_RSP;
 
+#define FPDKPROTO_ABORT_ACK "ABORTED"
+
+#define FPDKPROTO_FRAME_MAX 255                                                                    //payload of regular command frame {cmd, length u8, payload}
+#define FPDKPROTO_EXTFRAME_HDR_SIZE 4
+#define FPDKPROTO_EXTFRAME_MAX 512                                                                 //payload of extended frame, longer ones are dropped with ERROR
+
+#define FPDKPROTO_BUF_SLOT1 0x8000                                                                 //buffer offset flag: use 2nd image slot
+#define FPDKPROTO_BUFACK_OK 0x00                                                                   //BUFACK payload: {cmd, status} for SETBUF/INITBUF executed while IC command runs
+#define FPDKPROTO_BUFACK_ERR 0x01
+#define FPDKPROTO_BUF_POOL_SIZE 0x2000                                                             //image memory for both slots (bit packed), e.g. 2 x PFS173 (2 x 5760 bytes) do not fit
+#define FPDKPROTO_INITBUF_NOSPACE_SIZE 2                                                           //INITBUF ERROR payload when slot does not fit in image memory: {bytes available for slot u16}
+
+#define FPDKPROTO_CHARDAT_SIZE 8                                                                   //CHARDAT payload: {vdd mV u16, trim u8, 0, frequency Hz u32} for every measured trim
+#define FPDKPROTO_TIMING_SIZE 20                                                                   //SETTIMING payload: {leave progmode, erase wait, write wait, erase pulse, write clock half period} us u32, 0 = default
+#define FPDKPROTO_DBGCREDIT_SIZE 2                                                                 //DBGCREDIT payload: {bytes u16} of debug data transmitted to IC, EXECUTEIC ACK: initial credit u16
+#define FPDKPROTO_EXEC_TRACE 0x01                                                                  //EXECUTEIC flags (u8 after latency): record IC output in programmer, read with GETTRACE
+#define FPDKPROTO_TRACE_HDR_SIZE 6                                                                 //GETTRACE ACK payload: {dropped bytes u32, records...}, record: {timestamp us u32, len u16, data}
+#define FPDKPROTO_DBGSTATS_SIZE 12                                                                 //STOPIC ACK payload: {bytes, packets, dropped bytes} u32 of debug forwarding
+#define FPDKPROTO_CALIB_MEASUREMENTS_SHIFT 8                                                       //calibration response word 0: bit 0-7 value, bit 8-31 number of frequency measurements
+#define FPDKPROTO_CALIB_TRIM_MAX 0x9F                                                              //highest trim value calibration / characterization sets (0x9F seems maximum for IHRCR, upper bits unknown)
+
+typedef enum FPDKPROTO_CALIBTYPE                                                                   //same order as FPDKCALIBTYPE of host
+{
+  FPDKPROTO_CALIB_IHRC       = 0,
+  FPDKPROTO_CALIB_ILRC       = 1,
+  FPDKPROTO_CALIB_BG         = 2,
+  FPDKPROTO_CALIB_IHRC_BG    = 3,
+  FPDKPROTO_CALIB_ILRC_BG    = 4,
+
+} FPDKPROTO_CALIBTYPE;
+
+typedef enum FPDKPROTO_PHASE
+{
+  FPDKPROTO_PHASE_IDLE       = 0,
+  FPDKPROTO_PHASE_BLANKCHECK = 1,
+  FPDKPROTO_PHASE_ERASE      = 2,
+  FPDKPROTO_PHASE_READ       = 3,
+  FPDKPROTO_PHASE_WRITE      = 4,
+  FPDKPROTO_PHASE_VERIFY     = 5,
+  FPDKPROTO_PHASE_CALIBRATE  = 6,
+  FPDKPROTO_PHASE_CHARACTERIZE = 7,
+
+} FPDKPROTO_PHASE;
+
 typedef enum FPDK_ERR
 {
   FPDK_ERR_UKNOWN            = 0xFFFF,
@@ -62,6 +118,7 @@ typedef enum FPDK_ERR
   FPDK_ERR_CMDRSP            = 0xFFFC,
   FPDK_ERR_VERIFY            = 0xFFFB,
   FPDK_ERR_NOTBLANK          = 0xFFFA,
+  FPDK_ERR_ABORTED           = 0xFFF9,
 
   FPDK_ERR_ERROR             = 0xFFF0
 } FPDK_ERR;
@@ -21,86 +21,321 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "main.h"
 
-#define FPDKUART_QUEUE_SIZE 32                                                                     //32 byte internal RX queue (-> 32 bytes transmitted from IC during debug can be buffered, sending out via USB us MUCH faster)
+#define FPDKUART_DMA_SIZE   512                                                                    //circular DMA RX buffer, handed off in chunks on half/full transfer and idle line
+#define FPDKUART_CHUNK_MAX  255                                                                    //max payload of one debug response (host limit)
+#define FPDKUART_COALESCE   61                                                                     //send as soon as one full speed USB packet (64 - 3 byte header) is filled
+#define FPDKUART_LATENCY_MS 5                                                                      //default: send smaller chunks when oldest byte waits this long
+#define FPDKUART_TX_SIZE    256                                                                    //TX ring for data from host, host may only send as much as credited
+#define FPDKUART_CREDIT_MIN 32                                                                     //report freed TX space in batches (or when TX ring is empty)
+#define FPDKUART_TRACE_HDR  FPDKPROTO_TRACE_HDR_SIZE                                               //trace record: {timestamp us u32, length u16, data}
+#define FPDKUART_RX_GUARD   32                                                                     //bytes DMA may receive while a chunk is copied for the host (< half buffer)
 
 extern UART_HandleTypeDef huart1;
 
-static uint8_t  _uartRXBuffer[2*1];                                                                //double buffer DMA 1 byte each
-static uint8_t  _uartRXQueue[FPDKUART_QUEUE_SIZE];
-static uint32_t _uartRXQueueWPos;
-static uint32_t _uartRXQueueRPos;
-static bool     _uartRXAutoBaudFinished;
+static uint8_t           _uartRXBuffer[FPDKUART_DMA_SIZE];
+static uint32_t          _uartRXDMAIdx;                                                            //DMA write index at last hand off
+static volatile uint32_t _uartRXWPos;                                                              //total bytes handed off by interrupts
+static uint32_t          _uartRXRPos;                                                              //total bytes sent to host
+static bool              _uartRXAutoBaudFinished;
+static bool              _uartActive;                                                              //between init and deinit (DMA counter is only valid then)
+static uint32_t          _uartRXLatencyMS = FPDKUART_LATENCY_MS;
+static uint32_t          _uartRXPendingTick;                                                       //tick when first unsent byte was seen
+static bool              _uartRXPending;
+static uint32_t          _uartStatBytes;
+static uint32_t          _uartStatPackets;
+static uint32_t          _uartStatDrops;
 
-static void _FPDKUART_HandleRx(UART_HandleTypeDef *huart, uint8_t c)
+static uint8_t           _uartTXBuffer[FPDKUART_TX_SIZE];
+static uint32_t          _uartTXWPos;                                                              //total bytes queued
+static volatile uint32_t _uartTXRPos;                                                              //total bytes transmitted
+static volatile uint32_t _uartTXSending;                                                           //bytes of running interrupt transfer
+static uint32_t          _uartTXCredited;                                                          //TX position up to which space was reported to host
+
+static uint8_t*          _uartTrace;                                                               //trace capture ring (NULL: live forwarding)
+static uint32_t          _uartTraceSize;
+static volatile uint32_t _uartTraceWPos;                                                           //written by RX interrupts
+static uint32_t          _uartTraceRPos;                                                           //read by host
+static volatile uint32_t _uartTraceDrops;
+static uint32_t          _uartTraceStartUS;                                                        //time base, record timestamps are relative to trace start
+
+static uint32_t _FPDKUART_GetTimeUS(void)                                                           //SysTick based, wraps after ~71 minutes
+{
+  uint32_t ms = HAL_GetTick();
+  uint32_t val = SysTick->VAL;
+  if( (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) && (val > (SysTick->LOAD/2)) )                          //called from interrupt: reload happened, tick not counted yet
+    ms++;
+  return ms*1000 + ((SysTick->LOAD - val)*1000) / (SysTick->LOAD+1);
+}
+
+static void _FPDKUART_TracePut(const uint8_t* dat, const uint32_t len)
 {
-  if( _uartRXQueueWPos - _uartRXQueueRPos < FPDKUART_QUEUE_SIZE )
-    _uartRXQueue[(_uartRXQueueWPos++) % FPDKUART_QUEUE_SIZE] = c;
+  for( uint32_t i=0; i<len; i++ )
+    _uartTrace[(_uartTraceWPos+i) % _uartTraceSize] = dat[i];
+  _uartTraceWPos += len;
+}
+
+static void _FPDKUART_TraceRecord(uint32_t pos, uint32_t len)                                      //called from RX interrupts, pos/len in received stream
+{
+  if( (0 == pos) && len && ('U' == _uartRXBuffer[0]) )                                             //skip special auto baud char if detected as first char
+  {
+    pos++;
+    len--;
+  }
+  if( !len )
+    return;
+
+  if( (_uartTraceSize - (_uartTraceWPos - _uartTraceRPos)) < (FPDKUART_TRACE_HDR + len) )         //full: keep old data, host reads dropped count
+  {
+    _uartTraceDrops += len;
+    return;
+  }
+
+  uint32_t ts = _FPDKUART_GetTimeUS() - _uartTraceStartUS;
+  uint8_t hdr[FPDKUART_TRACE_HDR] = { ts, ts>>8, ts>>16, ts>>24, len, len>>8 };
+  uint32_t wpos = _uartTraceWPos;
+  _FPDKUART_TracePut(hdr, sizeof(hdr));
+  uint32_t rpos = pos % FPDKUART_DMA_SIZE;
+  uint32_t first = ((rpos+len) > FPDKUART_DMA_SIZE) ? (FPDKUART_DMA_SIZE-rpos) : len;
+  _FPDKUART_TracePut(&_uartRXBuffer[rpos], first);
+  _FPDKUART_TracePut(&_uartRXBuffer[0], len-first);
+  _uartTraceWPos = wpos + FPDKUART_TRACE_HDR + len;                                                //publish complete record
+}
+
+static void _FPDKUART_HandOff(void)
+{
+  uint32_t idx = FPDKUART_DMA_SIZE - __HAL_DMA_GET_COUNTER(huart1.hdmarx);
+  _uartRXWPos += (idx + FPDKUART_DMA_SIZE - _uartRXDMAIdx) % FPDKUART_DMA_SIZE;                    //at most half buffer between 2 hand offs, so wrap is unambiguous
+  _uartRXDMAIdx = idx;
+
+  if( _uartTrace && _uartRXAutoBaudFinished )                                                      //trace mode: record chunk with time of hand off
+  {
+    _FPDKUART_TraceRecord(_uartRXRPos, _uartRXWPos - _uartRXRPos);
+    _uartRXRPos = _uartRXWPos;
+  }
+}
+
+static uint32_t _FPDKUART_RxLivePos(uint32_t* wpos)                                               //total bytes written by DMA, including part not handed off yet
+{
+  __disable_irq();
+  uint32_t idx = FPDKUART_DMA_SIZE - __HAL_DMA_GET_COUNTER(huart1.hdmarx);
+  *wpos = _uartRXWPos;
+  uint32_t live = *wpos + (idx + FPDKUART_DMA_SIZE - _uartRXDMAIdx) % FPDKUART_DMA_SIZE;
+  __enable_irq();
+  return live;
 }
 
 void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart)
 {
-  _FPDKUART_HandleRx( huart, _uartRXBuffer[0] );
+  _FPDKUART_HandOff();
 }
+
 void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
 {
-  _FPDKUART_HandleRx( huart, _uartRXBuffer[1] );
+  _FPDKUART_HandOff();
 }
 
-void FPDKUART_Init(void)
+static void _FPDKUART_TxKick(void)                                                                  //call with interrupts disabled or from UART interrupt
+{
+  if( _uartTXSending )
+    return;
+
+  uint32_t len = _uartTXWPos - _uartTXRPos;
+  uint32_t pos = _uartTXRPos % FPDKUART_TX_SIZE;
+  if( (pos + len) > FPDKUART_TX_SIZE )                                                             //contiguous part only, wrap is sent from TX complete
+    len = FPDKUART_TX_SIZE - pos;
+  if( !len )
+    return;
+
+  _uartTXSending = len;
+  if( HAL_OK != HAL_UART_Transmit_IT(&huart1, &_uartTXBuffer[pos], len) )
+    _uartTXSending = 0;                                                                            //retried from main loop
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+  _uartTXRPos += _uartTXSending;
+  _uartTXSending = 0;
+  _FPDKUART_TxKick();
+}
+
+void FPDKUART_HandleIRQ(void)
+{
+  if( __HAL_UART_GET_FLAG(&huart1, UART_FLAG_IDLE) != RESET )                                      //line idle after reception: hand off partial chunk
+  {
+    __HAL_UART_CLEAR_IDLEFLAG(&huart1);
+    if( huart1.hdmarx && (HAL_UART_STATE_BUSY_RX & huart1.RxState) )
+      _FPDKUART_HandOff();
+  }
+}
+
+static void _FPDKUART_StartRx(void)
+{
+  _uartRXDMAIdx = 0;
+  _uartRXWPos = 0;
+  _uartRXRPos = 0;
+  HAL_UART_Receive_DMA( &huart1, _uartRXBuffer, sizeof(_uartRXBuffer));
+  __HAL_UART_CLEAR_IDLEFLAG(&huart1);
+  __HAL_UART_ENABLE_IT(&huart1, UART_IT_IDLE);
+}
+
+static void _FPDKUART_Restart(void)
 {
-  _uartRXQueueWPos = 0;
-  _uartRXQueueRPos = 0;
   _uartRXAutoBaudFinished = false;
+  _uartRXPending = false;
   HAL_UART_Abort(&huart1);
   HAL_UART_DeInit(&huart1);
   HAL_UART_Init(&huart1);
-  HAL_UART_Receive_DMA( &huart1, _uartRXBuffer, sizeof(_uartRXBuffer));
+  _FPDKUART_StartRx();
+}
+
+void FPDKUART_Init(void)
+{
+  _uartTXWPos = 0;
+  _uartTXRPos = 0;
+  _uartTXSending = 0;
+  _uartTXCredited = 0;
+  _uartStatBytes = 0;
+  _uartStatPackets = 0;
+  _uartStatDrops = 0;
+  _FPDKUART_Restart();
+  _uartActive = true;
+}
+
+void FPDKUART_SetLatency(const uint32_t ms)
+{
+  _uartRXLatencyMS = ms?ms:FPDKUART_LATENCY_MS;
+}
+
+void FPDKUART_SetTrace(uint8_t* buf, const uint32_t size)
+{
+  __disable_irq();
+  _uartTrace = buf;
+  _uartTraceSize = size;
+  _uartTraceWPos = 0;
+  _uartTraceRPos = 0;
+  _uartTraceDrops = 0;
+  _uartTraceStartUS = _FPDKUART_GetTimeUS();
+  __enable_irq();
+}
+
+uint32_t FPDKUART_TraceAvailable(uint32_t* dropped)
+{
+  *dropped = _uartTraceDrops;
+  return _uartTrace ? (_uartTraceWPos - _uartTraceRPos) : 0;
+}
+
+void FPDKUART_TraceRead(uint8_t* dat, const uint32_t len)
+{
+  for( uint32_t i=0; i<len; i++ )
+    dat[i] = _uartTrace[(_uartTraceRPos+i) % _uartTraceSize];
+  _uartTraceRPos += len;
+}
+
+void FPDKUART_GetStats(uint32_t* bytes, uint32_t* packets, uint32_t* drops)
+{
+  *bytes = _uartStatBytes;
+  *packets = _uartStatPackets;
+  *drops = _uartStatDrops;
 }
 
 void FPDKUART_DeInit(void)
 {
+  _uartActive = false;
+  __HAL_UART_DISABLE_IT(&huart1, UART_IT_IDLE);
   HAL_UART_Abort(&huart1);
   HAL_UART_DeInit(&huart1);
 }
 
-void FPDKUART_SendData(const uint8_t* dat, const uint16_t len)
+uint32_t FPDKUART_GetTxCredit(void)
 {
-  while( HAL_BUSY == HAL_UART_Transmit_IT( &huart1, (uint8_t*)dat, len) ) {;}
+  return FPDKUART_TX_SIZE;
+}
+
+uint32_t FPDKUART_SendData(const uint8_t* dat, const uint32_t len)
+{
+  uint32_t space = FPDKUART_TX_SIZE - (_uartTXWPos - _uartTXRPos);
+  uint32_t count = (len>space)?space:len;                                                          //host exceeding its credit loses the excess
+  for( uint32_t i=0; i<count; i++ )
+    _uartTXBuffer[(_uartTXWPos+i) % FPDKUART_TX_SIZE] = dat[i];
+  _uartTXWPos += count;
+
+  __disable_irq();
+  _FPDKUART_TxKick();
+  __enable_irq();
+
+  return count;
 }
 
 void FPDKUART_HandleQueue(void)
 {
+  if( !_uartActive )
+    return;
+
+  __disable_irq();
+  _FPDKUART_TxKick();                                                                              //restart TX if it could not be started before
+  uint32_t txrpos = _uartTXRPos;
+  __enable_irq();
+
+  uint32_t credit = txrpos - _uartTXCredited;
+  if( ((credit >= FPDKUART_CREDIT_MIN) || (credit && (txrpos == _uartTXWPos))) && FPDKUSB_SendDebugCredit(credit) )
+    _uartTXCredited = txrpos;                                                                      //USB queue full: reported next time
+
   if( !_uartRXAutoBaudFinished )
   {
     if( __HAL_UART_GET_FLAG(&huart1,UART_FLAG_ABRF) != RESET)                                      //auto baud detection on STM finished?
     {
       if( __HAL_UART_GET_FLAG(&huart1, UART_FLAG_ABRE) != RESET )                                  //auto baud error occured ?
-        FPDKUART_Init();                                                                           //restart uart on error
+        _FPDKUART_Restart();                                                                       //restart uart on error
       else
       {
+        __HAL_UART_DISABLE_IT(&huart1, UART_IT_IDLE);
         HAL_UART_Abort(&huart1);                                                                   //reset DMA with new baud rate
-        HAL_UART_Receive_DMA( &huart1, _uartRXBuffer, sizeof(_uartRXBuffer));
+        _FPDKUART_StartRx();
         _uartRXAutoBaudFinished = true;
       }
     }
   }
   else
+  if( !_uartTrace )
   {
-    if( _uartRXQueueWPos > _uartRXQueueRPos )
+    uint32_t wpos;
+    uint32_t live = _FPDKUART_RxLivePos(&wpos);                                                    //DMA runs up to half a buffer ahead of last hand off
+    if( (live - _uartRXRPos) > (FPDKUART_DMA_SIZE - FPDKUART_RX_GUARD) )                           //host did not keep up, DMA overwrote (or overwrites while copying) oldest data
     {
-      if( (0 == _uartRXQueueRPos) && ('U' == _uartRXQueue[0]) )                                    //skip special auto baud char if detected as first char
-        _uartRXQueueRPos++;
+      uint32_t rpos = live - (FPDKUART_DMA_SIZE - FPDKUART_RX_GUARD);                              //still before wpos, guard is less than half buffer
+      _uartStatDrops += rpos - _uartRXRPos;
+      _uartRXRPos = rpos;
+    }
 
-      uint32_t sendlen = _uartRXQueueWPos - _uartRXQueueRPos;
-      if( sendlen )
-      {
-        uint32_t rpos = _uartRXQueueRPos % FPDKUART_QUEUE_SIZE;
-        if( (rpos + sendlen) > FPDKUART_QUEUE_SIZE )
-          sendlen = FPDKUART_QUEUE_SIZE - rpos;
-        FPDKUSB_SendDebug(&_uartRXQueue[rpos],sendlen);
-        _uartRXQueueRPos += sendlen;
-      }
+    if( (0 == _uartRXRPos) && (wpos > 0) && ('U' == _uartRXBuffer[0]) )                            //skip special auto baud char if detected as first char
+      _uartRXRPos++;
+
+    uint32_t sendlen = wpos - _uartRXRPos;
+    if( !sendlen )
+    {
+      _uartRXPending = false;
+      return;
+    }
+
+    if( !_uartRXPending )
+    {
+      _uartRXPending = true;
+      _uartRXPendingTick = HAL_GetTick();
+    }
+
+    if( (sendlen >= FPDKUART_COALESCE) || ((HAL_GetTick() - _uartRXPendingTick) >= _uartRXLatencyMS) )
+    {
+      uint32_t rpos = _uartRXRPos % FPDKUART_DMA_SIZE;
+      if( (rpos + sendlen) > FPDKUART_DMA_SIZE )                                                   //contiguous part only, wrap is sent next time
+        sendlen = FPDKUART_DMA_SIZE - rpos;
+      if( sendlen > FPDKUART_CHUNK_MAX )
+        sendlen = FPDKUART_CHUNK_MAX;
+      if( !FPDKUSB_SendDebug(&_uartRXBuffer[rpos],sendlen) )                                       //USB queue full: data stays in DMA buffer, retried next time
+        return;
+      _uartRXRPos += sendlen;
+      _uartRXPending = false;                                                                      //deadline restarts for remaining bytes
+      _uartStatBytes += sendlen;
+      _uartStatPackets++;
     }
   }
 }
-
@@ -7,8 +7,16 @@
 void FPDKUART_Init(void);
 void FPDKUART_DeInit(void);
 
-void FPDKUART_SendData(const uint8_t* dat, const uint16_t len);
+uint32_t FPDKUART_SendData(const uint8_t* dat, const uint32_t len);                                //queue for IC, returns bytes accepted
+uint32_t FPDKUART_GetTxCredit(void);                                                               //initial credit (TX ring size) for host
 
 void FPDKUART_HandleQueue(void);
+void FPDKUART_HandleIRQ(void);
+
+void FPDKUART_SetLatency(const uint32_t ms);                                                       //0 = default
+void FPDKUART_SetTrace(uint8_t* buf, const uint32_t size);                                         //record RX with timestamps in buf instead of forwarding, NULL: off
+uint32_t FPDKUART_TraceAvailable(uint32_t* dropped);
+void FPDKUART_TraceRead(uint8_t* dat, const uint32_t len);
+void FPDKUART_GetStats(uint32_t* bytes, uint32_t* packets, uint32_t* drops);
 
 #endif //__FPDKUART_H_
@@ -24,25 +24,167 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <string.h>
 
 static const uint8_t FPDKVER[] = "FREE-PDK EASY PROG - HW:" __FPDKHW__ " SW:" __FPDKSW__ " PROTO:" __FPDKPROTO__ "\n";
+static const uint8_t FPDKABORTACK[] = FPDKPROTO_ABORT_ACK;
 
 static const uint32_t FPDK_LED_UART_RX = 1;
 static const uint32_t FPDK_LED_UART_TX = 2;
 static const uint32_t FPDK_LED_IC      = 3;
 
-static uint8_t  _packetbuf[256+2];
-static uint32_t _packetbufpos = 0;
+#define FPDKUSB_RX_QUEUE_SIZE 1024                                                                 //power of 2
+#define FPDKUSB_RX_PACKET_SIZE 64                                                                  //full speed bulk packet
+#define FPDKUSB_CMD_HANDLED 0x00                                                                   //command byte of queued frames already handled from interrupt
 
-static uint16_t _ic_rw_buffer[0x1000];
+static uint8_t           _rxqueue[FPDKUSB_RX_QUEUE_SIZE];                                          //single producer (USB interrupt) / single consumer (main loop)
+static volatile uint32_t _rxqueue_head;                                                            //free running positions, only written by producer
+static volatile uint32_t _rxqueue_tail;                                                            //only written by consumer
+static volatile uint32_t _rxqueue_discard;                                                         //consumer drops everything before (port open/close)
+static volatile bool     _rxqueue_stalled;                                                         //USB reception paused until queue has room for a packet
+
+static uint8_t  _cmdbuf[FPDKPROTO_EXTFRAME_MAX];                                                   //payload of frame executed by main loop
+static uint8_t  _oobbuf[FPDKPROTO_EXTFRAME_MAX];                                                   //payload of frame executed from interrupt
+
+#define FPDKUSB_BUF_POOL_SIZE FPDKPROTO_BUF_POOL_SIZE                                              //8KB image memory shared by 2 bit packed slots (slot 0 from start, slot 1 from end)
+
+static uint8_t     _ic_buf_pool[FPDKUSB_BUF_POOL_SIZE+2];                                          //+2 bytes for packed word access at end
+static FPDKBUFSLOT _ic_buf[2];
+static volatile int32_t _ic_buf_busy = -1;                                                         //slot accessed by executing command (-1: none)
 
 static bool _ic_is_running;
+static bool _ic_trace;                                                                             //image buffer pool is used as trace ring while IC runs
+
+static volatile bool _cmd_executing;                                                               //command in _cmdbuf is executed, following commands are queued
+static volatile bool _rsp_sending;                                                                 //response (header+payload) transmission in progress from main loop
+
+#define FPDKUSB_TX_QUEUE_SIZE 512                                                                  //power of 2
+#define FPDKUSB_TX_PACKET_SIZE 64                                                                  //full speed bulk packet
+
+static uint8_t           _txqueue[FPDKUSB_TX_QUEUE_SIZE];                                          //responses are assembled here and sent in full packets chained from TX complete callback
+static volatile uint32_t _txqueue_head;                                                            //free running positions
+static volatile uint32_t _txqueue_tail;
+static volatile uint32_t _txqueue_inflight;                                                        //length of packet currently transmitted by USB
+static volatile bool     _txqueue_zlp;                                                             //last packet was full size, terminate transfer with zero length packet
+static volatile uint32_t _txqueue_port;                                                            //changes on port open / close (queue reset), stream of large response stops
 
 static const uint32_t _dbg_led_on_time = 50;
 static volatile uint32_t _dbg_led_rx_off_tick = 0;
 static volatile uint32_t _dbg_led_tx_off_tick = 0;
 
+static uint32_t _FPDKUSB_BufSlotBytes(const uint8_t bits, const uint32_t words)
+{
+  return (words*bits+7)/8;
+}
+
+static uint32_t _FPDKUSB_BufSlotSpace(const uint32_t slot)                                           //bytes available for slot next to the other one
+{
+  return FPDKUSB_BUF_POOL_SIZE - _FPDKUSB_BufSlotBytes(_ic_buf[slot^1].bits, _ic_buf[slot^1].words);
+}
+
+static bool _FPDKUSB_InitBufSlot(const uint32_t slot, const uint8_t bits, const uint32_t words, const bool execute)
+{
+  if( (slot>1) || !bits || (bits>16) || _ic_trace )
+    return false;
+
+  uint32_t bytes = _FPDKUSB_BufSlotBytes(bits, words);
+  if( bytes > _FPDKUSB_BufSlotSpace(slot) )
+    return false;
+
+  if( execute )
+  {
+    _ic_buf[slot].data = slot?&_ic_buf_pool[FPDKUSB_BUF_POOL_SIZE-bytes]:_ic_buf_pool;
+    _ic_buf[slot].words = words;
+    _ic_buf[slot].bits = bits;
+    memset(_ic_buf[slot].data, 0xFF, bytes);
+  }
+  return true;
+}
+
+static void _FPDKUSB_ResetBufSlots(void)
+{
+  _ic_buf[1].words = 0;                                                                            //default: slot 0 with 0x1000 16 bit words, slot 1 empty
+  _ic_buf[1].bits = 16;
+  _ic_buf[1].data = &_ic_buf_pool[FPDKUSB_BUF_POOL_SIZE];
+  _ic_buf[0].words = 0;
+  _FPDKUSB_InitBufSlot(0, 16, FPDKUSB_BUF_POOL_SIZE/sizeof(uint16_t), true);
+}
+
+static void _FPDKUSB_StopTrace(void)
+{
+  FPDKUART_SetTrace(0, 0);
+  if( _ic_trace )
+  {
+    _ic_trace = false;
+    _FPDKUSB_ResetBufSlots();                                                                      //content is lost, host uploads image again
+  }
+}
+
+static FPDKBUFSLOT* _FPDKUSB_GetBufSlot(const uint16_t offs)
+{
+  return &_ic_buf[(offs & FPDKPROTO_BUF_SLOT1)?1:0];
+}
+
+static bool _FPDKUSB_SetBuf(const uint8_t* dat, const uint32_t len, const bool execute)
+{
+  if( len<sizeof(uint16_t) )
+    return false;
+  uint16_t data_offs;
+  memcpy( &data_offs, &dat[0], sizeof(uint16_t) );
+
+  FPDKBUFSLOT* buf = _FPDKUSB_GetBufSlot(data_offs);
+  data_offs &= ~FPDKPROTO_BUF_SLOT1;
+  uint32_t cpylen = len-sizeof(uint16_t);
+
+  if( (data_offs+cpylen) > (buf->words*sizeof(uint16_t)) )
+    return false;
+
+  if( execute )
+  {
+    for( uint32_t p=0; p<cpylen; p++ )                                                             //protocol uses 16 bit little endian words, store bit packed
+    {
+      uint32_t o = data_offs+p;
+      uint16_t w = FPDK_BufGetWord(buf, o>>1);
+      if( o&1 )
+        w = (w&0x00FF) | (((uint16_t)dat[2+p])<<8);
+      else
+        w = (w&0xFF00) | dat[2+p];
+      FPDK_BufSetWord(buf, o>>1, w);
+    }
+  }
+  return true;
+}
+
+static bool _FPDKUSB_InitBuf(const uint8_t* dat, const uint32_t len, const bool execute)
+{
+  if( len<(2*sizeof(uint8_t)+sizeof(uint16_t)) )
+    return false;
+  uint16_t words;
+  memcpy( &words, &dat[2], sizeof(uint16_t) );
+  return _FPDKUSB_InitBufSlot(dat[0], dat[1], words, execute);
+}
+
+//slot a command is accessing (-1: none)
+static int32_t _FPDKUSB_GetCmdBufSlot(const FPDKPROTO_CMD cmd, const uint8_t* dat, const uint32_t len)
+{
+  uint32_t offspos;
+  switch( cmd )
+  {
+    case FPDKPROTO_CMD_INITBUF:  return (len>0)?(dat[0]?1:0):-1;
+    case FPDKPROTO_CMD_SETBUF:   offspos = 0; break;
+    case FPDKPROTO_CMD_GETBUF:   offspos = 0; break;
+    case FPDKPROTO_CMD_READIC:   offspos = 14; break;
+    case FPDKPROTO_CMD_VERIFYIC: offspos = 14; break;
+    case FPDKPROTO_CMD_WRITEIC:  offspos = 22; break;
+    default:
+      return -1;
+  }
+  if( len<(offspos+sizeof(uint16_t)) )
+    return -1;
+  return (dat[offspos+1] & (FPDKPROTO_BUF_SLOT1>>8))?1:0;
+}
+
 void FPDKUSB_Init(void)
 {
-  _packetbufpos = 0;
+  _rxqueue_head = _rxqueue_tail = _rxqueue_discard = 0;
+  _FPDKUSB_ResetBufSlots();
 }
 
 void FPDKUSB_DeInit(void)
@@ -51,12 +193,21 @@ void FPDKUSB_DeInit(void)
 
 void FPDKUSB_USBSignalPortOpenClose(void)
 {
-  _packetbufpos = 0;
-  memset(_ic_rw_buffer, 0xFF, sizeof(_ic_rw_buffer));
+  uint32_t primask = __get_PRIMASK();                                                              //queue positions are shared with TX complete and main loop
+  __disable_irq();
+  _rxqueue_discard = _rxqueue_head;
+  _txqueue_head = _txqueue_tail + _txqueue_inflight;                                               //drop responses not sent yet
+  _txqueue_port++;
+  __set_PRIMASK(primask);
+  _FPDKUSB_ResetBufSlots();
+
+  const FPDKTIMING deftiming = { 0 };                                                              //next host might not send a profile (no IC selected)
+  FPDK_SetTiming(&deftiming);
 
   if( _ic_is_running )
   {
     FPDKUART_DeInit();
+    _FPDKUSB_StopTrace();
     FPDK_SetVDD(0,0);
     FPDK_SetLed(FPDK_LED_IC,false);
     _ic_is_running = false;
@@ -68,36 +219,258 @@ bool FPDKUSB_IsConnected(void)
   return CDC_IsHostPortOpen();
 }
 
-bool FPDKUSB_USBHandleReceive(const uint8_t* dat, const uint32_t len)
+//start next packet if USB is idle, called with interrupts disabled or from USB interrupt
+static void _FPDKUSB_TxKick(void)
 {
-  uint32_t cpylen;
-  if( _packetbufpos+len < sizeof(_packetbuf) )
-    cpylen = len;
+  if( _txqueue_inflight )
+    return;
+
+  uint32_t used = _txqueue_head - _txqueue_tail;
+  if( !used )
+  {
+    if( _txqueue_zlp && (USBD_OK == CDC_Transmit_FS( _txqueue, 0 )) )
+      _txqueue_zlp = false;
+    return;
+  }
+
+  uint32_t pos = _txqueue_tail & (FPDKUSB_TX_QUEUE_SIZE-1);
+  uint32_t len = FPDKUSB_TX_QUEUE_SIZE - pos;                                                      //contiguous part only, wrap is sent with next packet
+  if( len>used )
+    len = used;
+  if( len>FPDKUSB_TX_PACKET_SIZE )
+    len = FPDKUSB_TX_PACKET_SIZE;
+
+  if( USBD_OK == CDC_Transmit_FS( &_txqueue[pos], len ) )
+  {
+    _txqueue_inflight = len;
+    _txqueue_zlp = (FPDKUSB_TX_PACKET_SIZE == len);
+  }
+}
+
+//append complete data to queue or nothing (no space), safe from main loop and interrupt
+static bool _FPDKUSB_TxEnqueue(const uint8_t* hdr, const uint32_t hdrlen, const uint8_t* dat, const uint32_t len)
+{
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  bool ok = (FPDKUSB_TX_QUEUE_SIZE - (_txqueue_head - _txqueue_tail)) >= (hdrlen+len);
+  if( ok )
+  {
+    for( uint32_t i=0; i<hdrlen; i++ )
+      _txqueue[(_txqueue_head++) & (FPDKUSB_TX_QUEUE_SIZE-1)] = hdr[i];
+    for( uint32_t i=0; i<len; i++ )
+      _txqueue[(_txqueue_head++) & (FPDKUSB_TX_QUEUE_SIZE-1)] = dat[i];
+    _FPDKUSB_TxKick();
+  }
+
+  __set_PRIMASK(primask);
+  return ok;
+}
+
+void FPDKUSB_USBHandleTransmitComplete(void)
+{
+  _txqueue_tail += _txqueue_inflight;
+  _txqueue_inflight = 0;
+  _FPDKUSB_TxKick();
+}
+
+static void _FPDKUSB_SendProgressFromIRQ(void)
+{
+  if( _rsp_sending )                                                                               //never split a response from main loop
+    return;
+
+  uint32_t phase, done, total;
+  FPDK_GetProgress(&phase, &done, &total);
+  uint8_t rsp[3+3*sizeof(uint32_t)] = { FPDKPROTO_RSP_PROGRESS, 3*sizeof(uint32_t), 0 };
+  memcpy( &rsp[3], &phase, sizeof(uint32_t) );
+  memcpy( &rsp[7], &done, sizeof(uint32_t) );
+  memcpy( &rsp[11], &total, sizeof(uint32_t) );
+  _FPDKUSB_TxEnqueue( rsp, sizeof(rsp), 0, 0 );                                                    //single try, no waiting inside interrupt (host polls again)
+}
+
+//buffer commands for the slot not used by executing command are executed directly from interrupt (upload next image while programing)
+static bool _FPDKUSB_HandleBufCmdFromIRQ(const FPDKPROTO_CMD cmd, const uint8_t* dat, const uint32_t len)
+{
+  if( _rsp_sending || (_ic_buf_busy == _FPDKUSB_GetCmdBufSlot(cmd, dat, len)) )
+    return false;
+
+  bool valid;
+  if( FPDKPROTO_CMD_SETBUF == cmd )
+    valid = _FPDKUSB_SetBuf(dat, len, false);
   else
-    cpylen = sizeof(_packetbuf)-_packetbufpos;
+    valid = _FPDKUSB_InitBuf(dat, len, false);
+
+  uint8_t rsp[] = { FPDKPROTO_RSP_BUFACK, 2, 0,                                                    //own response type, host can not confuse it with response of executing command
+                    cmd, valid?FPDKPROTO_BUFACK_OK:FPDKPROTO_BUFACK_ERR };
+  if( !_FPDKUSB_TxEnqueue( rsp, sizeof(rsp), 0, 0 ) )                                             //queue full, leave command in queue for main loop
+    return false;
+
+  if( valid )
+  {
+    if( FPDKPROTO_CMD_SETBUF == cmd )
+      _FPDKUSB_SetBuf(dat, len, true);
+    else
+      _FPDKUSB_InitBuf(dat, len, true);
+  }
+  return true;
+}
 
-  memcpy( &_packetbuf[_packetbufpos], dat, cpylen );
-  _packetbufpos += cpylen;
+static inline uint8_t _FPDKUSB_RxPeek(const uint32_t pos)
+{
+  return _rxqueue[pos & (FPDKUSB_RX_QUEUE_SIZE-1)];
+}
+
+static void _FPDKUSB_RxCopy(uint8_t* dst, const uint32_t pos, const uint32_t len)
+{
+  for( uint32_t i=0; i<len; i++ )
+    dst[i] = _FPDKUSB_RxPeek(pos+i);
+}
+
+//start of data consumer did not take yet (skipping data to discard, can be ahead of producer for dropped oversized frame)
+static uint32_t _FPDKUSB_RxStart(void)
+{
+  uint32_t tail = _rxqueue_tail;
+  uint32_t discard = _rxqueue_discard;
+  return ((int32_t)(discard-tail) > 0)?discard:tail;
+}
 
+//frame header at pos: {cmd, length u8} or {FPDKPROTO_CMD_EXTFRAME, cmd, length u16}, false while incomplete
+static bool _FPDKUSB_RxFrameHeader(const uint32_t pos, const uint32_t avail, uint32_t* cmdpos, uint32_t* hdrlen, uint32_t* len)
+{
+  if( avail<2 )
+    return false;
+
+  if( FPDKPROTO_CMD_EXTFRAME != _FPDKUSB_RxPeek(pos) )
+  {
+    *cmdpos = pos;
+    *hdrlen = 2;
+    *len = _FPDKUSB_RxPeek(pos+1);
+    return true;
+  }
+
+  if( avail<FPDKPROTO_EXTFRAME_HDR_SIZE )
+    return false;
+  *cmdpos = pos+1;                                                                                 //handled marker replaces command, extension prefix stays
+  *hdrlen = FPDKPROTO_EXTFRAME_HDR_SIZE;
+  *len = _FPDKUSB_RxPeek(pos+2) | (((uint32_t)_FPDKUSB_RxPeek(pos+3))<<8);
   return true;
 }
 
-static void _FPDKUSB_TransmitBuffer(const uint8_t* dat, const uint16_t len)
+//called from USB interrupt: look at queued commands (executing one was taken already) for ABORT, GETPROGRESS, SETBUF and INITBUF
+//handled frames stay in queue with command byte overwritten, main loop skips them (no data is moved, consumer position untouched)
+static void _FPDKUSB_HandleOutOfBandCommands(void)
 {
-  uint32_t tickstimeout = HAL_GetTick()+500;
-  while( USBD_BUSY == CDC_Transmit_FS( (uint8_t*)dat, len ) ) 
+  uint32_t head = _rxqueue_head;
+  bool inorder = true;                                                                             //buffer commands only while all commands before got handled
+  for( uint32_t pos = _FPDKUSB_RxStart(); (int32_t)(head-pos) > 0; )
   {
-    if( HAL_GetTick()>tickstimeout )
+    uint32_t cmdpos, hdrlen, len;
+    if( !_FPDKUSB_RxFrameHeader(pos, head-pos, &cmdpos, &hdrlen, &len) || (len>FPDKPROTO_EXTFRAME_MAX) || ((head-pos) < (hdrlen+len)) )
       break;
+
+    uint8_t  cmd = _FPDKUSB_RxPeek(cmdpos);
+
+    if( FPDKPROTO_CMD_ABORTIC == cmd )
+    {
+      FPDK_Abort();                                                                                //ABORT stays in queue and gets ACK after current command finished
+      break;
+    }
+
+    bool handled = (FPDKUSB_CMD_HANDLED == cmd);
+    if( _cmd_executing && !handled )
+    {
+      if( FPDKPROTO_CMD_GETPROGRESS == cmd )
+      {
+        _FPDKUSB_SendProgressFromIRQ();
+        handled = true;
+      }
+      else
+      if( inorder && ((FPDKPROTO_CMD_SETBUF == cmd) || (FPDKPROTO_CMD_INITBUF == cmd)) )
+      {
+        _FPDKUSB_RxCopy(_oobbuf, pos+hdrlen, len);
+        handled = _FPDKUSB_HandleBufCmdFromIRQ(cmd, _oobbuf, len);
+      }
+
+      if( handled )
+        _rxqueue[cmdpos & (FPDKUSB_RX_QUEUE_SIZE-1)] = FPDKUSB_CMD_HANDLED;
+    }
+
+    if( !handled )
+      inorder = false;
+    pos += hdrlen+len;
   }
 }
 
-void _FPDKUSB_SendResponse(const FPDKPROTO_RSP rtype, const uint8_t* dat, const uint32_t len )
+bool FPDKUSB_USBHandleReceive(const uint8_t* dat, const uint32_t len)
+{
+  uint32_t head = _rxqueue_head;
+  uint32_t space = FPDKUSB_RX_QUEUE_SIZE - (head - _rxqueue_tail);
+  if( len>space )                                                                                  //can not happen, reception is paused before queue gets full
+    return false;
+
+  for( uint32_t i=0; i<len; i++ )
+    _rxqueue[(head+i) & (FPDKUSB_RX_QUEUE_SIZE-1)] = dat[i];
+  _rxqueue_head = head+len;
+
+  _FPDKUSB_HandleOutOfBandCommands();
+
+  return true;
+}
+
+bool FPDKUSB_USBCanReceive(void)
+{
+  if( (FPDKUSB_RX_QUEUE_SIZE - (_rxqueue_head - _rxqueue_tail)) >= FPDKUSB_RX_PACKET_SIZE )
+    return true;
+
+  _rxqueue_stalled = true;                                                                         //back pressure: host waits, main loop resumes reception
+  return false;
+}
+
+#define FPDKUSB_TX_TIMEOUT_MS 500                                                                  //response is dropped when host takes no packet for this long
+
+//queue complete response frame or nothing, waits for space while host takes packets (never half a frame in queue)
+static bool _FPDKUSB_SendResponse(const FPDKPROTO_RSP rtype, const uint8_t* dat, const uint32_t len )
 {
   uint8_t tmp[] = { rtype, len&0xFF, (len>>8)&0xFF };
-  _FPDKUSB_TransmitBuffer(tmp, sizeof(tmp));
-  if( len )
-    _FPDKUSB_TransmitBuffer(dat, len);
+  uint32_t tail = _txqueue_tail;
+  uint32_t tickstimeout = HAL_GetTick()+FPDKUSB_TX_TIMEOUT_MS;
+  while( !_FPDKUSB_TxEnqueue(tmp, sizeof(tmp), dat, len) )                                         //header and payload in one transfer
+  {
+    if( ((sizeof(tmp)+len) > FPDKUSB_TX_QUEUE_SIZE) || !FPDKUSB_IsConnected() )                    //can never fit / nobody reads: drop it
+      return false;
+    if( tail != _txqueue_tail )
+    {
+      tail = _txqueue_tail;
+      tickstimeout = HAL_GetTick()+FPDKUSB_TX_TIMEOUT_MS;
+    }
+    else
+    if( HAL_GetTick()>tickstimeout )                                                               //host stalled: drop it, host times out
+      return false;
+  }
+  return true;
+}
+
+//queue part of a response frame larger than queue, frame is only started when all parts follow or the queue is reset by port open / close
+static bool _FPDKUSB_TxStream(const uint8_t* dat, const uint32_t len, const uint32_t port)
+{
+  for( uint32_t p=0; p<len; )
+  {
+    if( !FPDKUSB_IsConnected() )
+      return false;
+
+    __disable_irq();
+    bool reset = (port != _txqueue_port);                                                          //checked together with enqueue, rest of old frame must not go to new host
+    uint32_t chunk = FPDKUSB_TX_QUEUE_SIZE - (_txqueue_head - _txqueue_tail);
+    if( chunk>(len-p) )
+      chunk = len-p;
+    if( !reset && chunk && _FPDKUSB_TxEnqueue(&dat[p], chunk, 0, 0) )
+      p += chunk;
+    __enable_irq();
+
+    if( reset )
+      return false;
+  }
+  return true;
 }
 
 void _FPDKUSB_SendError(const uint8_t* dat, const uint32_t len)
@@ -110,11 +483,53 @@ void _FPDKUSB_Ack(const uint8_t* dat, const uint32_t len)
   _FPDKUSB_SendResponse( FPDKPROTO_RSP_ACK, dat, len );
 }
 
-void FPDKUSB_SendDebug(const uint8_t* dat, const uint32_t len)
+static void _FPDKUSB_AckBuf(const FPDKBUFSLOT* buf, const uint32_t offs, const uint32_t len)
+{
+  uint8_t stage[64];                                                                               //unpack to 16 bit words in chunks, queue copies them
+  uint8_t tmp[] = { FPDKPROTO_RSP_ACK, len&0xFF, (len>>8)&0xFF };
+  uint32_t port = _txqueue_port;
+  _rsp_sending = true;
+  bool ok = _FPDKUSB_TxStream(tmp, sizeof(tmp), port);
+  for( uint32_t p=0; ok && (p<len); )
+  {
+    uint32_t chunk = ((len-p)>sizeof(stage))?sizeof(stage):(len-p);
+    for( uint32_t c=0; c<chunk; c++ )
+    {
+      uint32_t o = offs+p+c;
+      uint16_t w = FPDK_BufGetWord(buf, o>>1);
+      stage[c] = (o&1)?(w>>8):(w&0xFF);
+    }
+    ok = _FPDKUSB_TxStream(stage, chunk, port);
+    p += chunk;
+  }
+  _rsp_sending = false;
+}
+
+//every measured trim is sent immediately as own frame (no buffering of complete curve)
+static void _FPDKUSB_SendCharacterizeSample(const uint32_t vdd, const uint8_t trim, const uint32_t frequency)
+{
+  uint8_t r[FPDKPROTO_CHARDAT_SIZE] = { vdd&0xFF, (vdd>>8)&0xFF, trim, 0 };
+  memcpy( &r[4], &frequency, sizeof(uint32_t) );
+  _FPDKUSB_SendResponse( FPDKPROTO_RSP_CHARDAT, r, sizeof(r) );
+}
+
+//debug responses are queued when they fit or not at all (no waiting in main loop), caller keeps data and retries
+bool FPDKUSB_SendDebug(const uint8_t* dat, const uint32_t len)
 {
+  uint8_t tmp[] = { FPDKPROTO_RSP_DBGDAT, len&0xFF, (len>>8)&0xFF };
+  if( !_FPDKUSB_TxEnqueue(tmp, sizeof(tmp), dat, len) )
+    return false;
+
   FPDK_SetLed(FPDK_LED_UART_RX, true);
   _dbg_led_rx_off_tick = HAL_GetTick() + _dbg_led_on_time;
-  _FPDKUSB_SendResponse( FPDKPROTO_RSP_DBGDAT, dat, len );
+  return true;
+}
+
+bool FPDKUSB_SendDebugCredit(const uint32_t bytes)
+{
+  uint16_t credit = bytes;
+  uint8_t tmp[] = { FPDKPROTO_RSP_DBGCREDIT, sizeof(credit), 0 };
+  return _FPDKUSB_TxEnqueue(tmp, sizeof(tmp), (uint8_t*)&credit, sizeof(credit));
 }
 
 bool _FPDKUSB_HandleCmd(const FPDKPROTO_CMD cmd, const uint8_t* dat, const uint32_t len)
@@ -162,17 +577,24 @@ bool _FPDKUSB_HandleCmd(const FPDKPROTO_CMD cmd, const uint8_t* dat, const uint3
       }
       break;
 
-    case FPDKPROTO_CMD_SETBUF:
+    case FPDKPROTO_CMD_INITBUF:
       {
-        if( len<sizeof(uint16_t) )
-          return false;
-        uint16_t data_offs;
-        memcpy( &data_offs, &dat[0], sizeof(uint16_t) );
+        if( !_FPDKUSB_InitBuf(dat, len, true) )
+        {
+          if( (len<4) || (dat[0]>1) || !dat[1] || (dat[1]>16) || _ic_trace )
+            return false;
+          uint16_t space = _FPDKUSB_BufSlotSpace(dat[0]);                                          //slot does not fit: tell host what is available
+          _FPDKUSB_SendError((uint8_t*)&space, FPDKPROTO_INITBUF_NOSPACE_SIZE);
+          break;
+        }
+        _FPDKUSB_Ack(0, 0);
+      }
+      break;
 
-        if( (data_offs>(sizeof(_ic_rw_buffer)*sizeof(uint16_t))) || ((data_offs+len-sizeof(uint16_t))>(sizeof(_ic_rw_buffer)*sizeof(uint16_t))) )
+    case FPDKPROTO_CMD_SETBUF:
+      {
+        if( !_FPDKUSB_SetBuf(dat, len, true) )
           return false;
-
-        memcpy( ((uint8_t*)_ic_rw_buffer) + data_offs, &dat[2], len-sizeof(uint16_t) );
         _FPDKUSB_Ack(0, 0);
       }
       break;
@@ -186,10 +608,13 @@ bool _FPDKUSB_HandleCmd(const FPDKPROTO_CMD cmd, const uint8_t* dat, const uint3
         uint16_t outlen;
         memcpy( &outlen, &dat[2], sizeof(uint16_t) );
 
-        if( (data_offs>(sizeof(_ic_rw_buffer)*sizeof(uint16_t))) || ((data_offs+outlen)>(sizeof(_ic_rw_buffer)*sizeof(uint16_t))) )
+        FPDKBUFSLOT* buf = _FPDKUSB_GetBufSlot(data_offs);
+        data_offs &= ~FPDKPROTO_BUF_SLOT1;
+
+        if( (data_offs+outlen) > (buf->words*sizeof(uint16_t)) )
           return false;
 
-        _FPDKUSB_Ack( ((uint8_t*)_ic_rw_buffer) + data_offs, outlen);
+        _FPDKUSB_AckBuf(buf, data_offs, outlen);
       }
       break;
 
@@ -235,6 +660,24 @@ bool _FPDKUSB_HandleCmd(const FPDKPROTO_CMD cmd, const uint8_t* dat, const uint3
       }
       break;
 
+    case FPDKPROTO_CMD_SETTIMING:
+      {
+        if( len<FPDKPROTO_TIMING_SIZE )
+          return false;
+
+        FPDKTIMING timing;
+        memcpy( &timing.leave_progmode_us,   &dat[0],  sizeof(uint32_t) );
+        memcpy( &timing.erase_wait_us,       &dat[4],  sizeof(uint32_t) );
+        memcpy( &timing.write_wait_us,       &dat[8],  sizeof(uint32_t) );
+        memcpy( &timing.erase_pulse_us,      &dat[12], sizeof(uint32_t) );
+        memcpy( &timing.write_clock_half_us, &dat[16], sizeof(uint32_t) );
+        if( !FPDK_SetTiming(&timing) )
+          return false;
+
+        _FPDKUSB_Ack(0, 0);
+      }
+      break;
+
     case FPDKPROTO_CMD_ERASEIC:
       {
         if( len<(2*sizeof(uint8_t)+sizeof(uint16_t)+4*sizeof(uint32_t)) )
@@ -282,11 +725,14 @@ bool _FPDKUSB_HandleCmd(const FPDKPROTO_CMD cmd, const uint8_t* dat, const uint3
         uint16_t count;
         memcpy( &count, &dat[17], sizeof(uint16_t) );
  
-        if( (data_offs>sizeof(_ic_rw_buffer)) || ((data_offs+len)>sizeof(_ic_rw_buffer)) )
+        FPDKBUFSLOT* buf = _FPDKUSB_GetBufSlot(data_offs);
+        data_offs &= ~FPDKPROTO_BUF_SLOT1;
+
+        if( ((data_offs+count) > buf->words) || (data_bits > buf->bits) )
           return false;
 
         FPDK_SetLed(FPDK_LED_IC,true);
-        ic_id = FPDK_ReadIC(ic_id, type, vpp_cmd, vdd_cmd, addr, addr_bits, &_ic_rw_buffer[data_offs], data_bits, count );
+        ic_id = FPDK_ReadIC(ic_id, type, vpp_cmd, vdd_cmd, addr, addr_bits, buf, data_offs, data_bits, count );
         FPDK_SetLed(FPDK_LED_IC,false);
 
         _FPDKUSB_Ack((uint8_t*)&ic_id, sizeof(ic_id));
@@ -321,11 +767,14 @@ bool _FPDKUSB_HandleCmd(const FPDKPROTO_CMD cmd, const uint8_t* dat, const uint3
         uint8_t write_block_clock_groups = dat[28];
         uint8_t write_block_clocks_per_group = dat[29];
  
-        if( (data_offs>sizeof(_ic_rw_buffer)) || ((data_offs+len)>sizeof(_ic_rw_buffer)) )
+        FPDKBUFSLOT* buf = _FPDKUSB_GetBufSlot(data_offs);
+        data_offs &= ~FPDKPROTO_BUF_SLOT1;
+
+        if( ((data_offs+count) > buf->words) || (data_bits > buf->bits) )
           return false;
 
         FPDK_SetLed(FPDK_LED_IC,true);
-        ic_id = FPDK_WriteIC(ic_id, type, vpp_cmd, vdd_cmd, vpp_write, vdd_write, addr, addr_bits, &_ic_rw_buffer[data_offs], data_bits, count, write_block_size, write_block_clock_groups, write_block_clocks_per_group );
+        ic_id = FPDK_WriteIC(ic_id, type, vpp_cmd, vdd_cmd, vpp_write, vdd_write, addr, addr_bits, buf, data_offs, data_bits, count, write_block_size, write_block_clock_groups, write_block_clocks_per_group );
         FPDK_SetLed(FPDK_LED_IC,false);
 
         _FPDKUSB_Ack((uint8_t*)&ic_id, sizeof(ic_id));
@@ -358,11 +807,14 @@ bool _FPDKUSB_HandleCmd(const FPDKPROTO_CMD cmd, const uint8_t* dat, const uint3
         uint16_t addr_exclude_end;
         memcpy( &addr_exclude_end, &dat[22], sizeof(uint16_t) );
  
-        if( (data_offs>sizeof(_ic_rw_buffer)) || ((data_offs+len)>sizeof(_ic_rw_buffer)) )
+        FPDKBUFSLOT* buf = _FPDKUSB_GetBufSlot(data_offs);
+        data_offs &= ~FPDKPROTO_BUF_SLOT1;
+
+        if( ((data_offs+count) > buf->words) || (data_bits > buf->bits) )
           return false;
 
         FPDK_SetLed(FPDK_LED_IC,true);
-        ic_id = FPDK_VerifyIC(ic_id, type, vpp_cmd, vdd_cmd, addr, addr_bits, &_ic_rw_buffer[data_offs], data_bits, count, addr_exclude_first_instr, addr_exclude_start, addr_exclude_end );
+        ic_id = FPDK_VerifyIC(ic_id, type, vpp_cmd, vdd_cmd, addr, addr_bits, buf, data_offs, data_bits, count, addr_exclude_first_instr, addr_exclude_start, addr_exclude_end );
         FPDK_SetLed(FPDK_LED_IC,false);
 
         _FPDKUSB_Ack((uint8_t*)&ic_id, sizeof(ic_id));
@@ -385,8 +837,8 @@ bool _FPDKUSB_HandleCmd(const FPDKPROTO_CMD cmd, const uint8_t* dat, const uint3
         FPDK_SetLed(FPDK_LED_IC,true);
 
         uint8_t fcalval, bgcalval;
-        uint32_t fcalfreq;
-        if( !FPDK_Calibrate(type, vdd, freq, mult, &fcalval, &fcalfreq, &bgcalval) )
+        uint32_t fcalfreq, measurements;
+        if( !FPDK_Calibrate(type, vdd, freq, mult, &fcalval, &fcalfreq, &bgcalval, &measurements) )
         {
           FPDK_SetLed(FPDK_LED_IC,false);
           return false;
@@ -394,11 +846,52 @@ bool _FPDKUSB_HandleCmd(const FPDKPROTO_CMD cmd, const uint8_t* dat, const uint3
 
         FPDK_SetLed(FPDK_LED_IC,false);
 
-        uint32_t r[] = {fcalval, fcalfreq, bgcalval}; 
+        uint32_t r[] = {fcalval | (measurements<<FPDKPROTO_CALIB_MEASUREMENTS_SHIFT), fcalfreq, bgcalval}; 
         _FPDKUSB_Ack((uint8_t*)&r, sizeof(r));
       }
       break;
 
+    case FPDKPROTO_CMD_CHARACTERIZEIC:
+      {
+        if( len<(6*sizeof(uint32_t)) )
+          return false;
+        uint32_t type;
+        memcpy( &type, &dat[0], sizeof(uint32_t) );
+        uint32_t vdd_first;
+        memcpy( &vdd_first, &dat[4], sizeof(uint32_t) );
+        uint32_t vdd_last;
+        memcpy( &vdd_last, &dat[8], sizeof(uint32_t) );
+        uint32_t vdd_step;
+        memcpy( &vdd_step, &dat[12], sizeof(uint32_t) );
+        uint32_t mult;
+        memcpy( &mult, &dat[16], sizeof(uint32_t) );
+        uint32_t trims;
+        memcpy( &trims, &dat[20], sizeof(uint32_t) );
+
+        FPDK_SetLed(FPDK_LED_IC,true);
+        uint32_t samples = FPDK_Characterize(type, vdd_first, vdd_last, vdd_step, mult, trims&0xFF, (trims>>8)&0xFF, _FPDKUSB_SendCharacterizeSample);
+        FPDK_SetLed(FPDK_LED_IC,false);
+
+        if( !samples )
+          return false;
+
+        _FPDKUSB_Ack((uint8_t*)&samples, sizeof(samples));
+      }
+      break;
+
+    case FPDKPROTO_CMD_GETPROGRESS:
+      {
+        uint32_t r[3];
+        FPDK_GetProgress(&r[0], &r[1], &r[2]);
+        _FPDKUSB_SendResponse(FPDKPROTO_RSP_PROGRESS, (uint8_t*)&r, sizeof(r));
+      }
+      break;
+
+    case FPDKPROTO_CMD_ABORTIC:
+      FPDK_ClearAbort();
+      _FPDKUSB_Ack( FPDKABORTACK, strlen((char*)FPDKABORTACK) );
+      break;
+
     case FPDKPROTO_CMD_EXECUTEIC:
       {
         if( len<sizeof(uint32_t) )
@@ -413,20 +906,72 @@ bool _FPDKUSB_HandleCmd(const FPDKPROTO_CMD cmd, const uint8_t* dat, const uint3
         
         FPDKUART_Init();
 
+        uint16_t latency = 0;                                                                      //optional: debug forwarding latency ms
+        if( len>=(sizeof(uint32_t)+sizeof(uint16_t)) )
+          memcpy( &latency, &dat[4], sizeof(uint16_t) );
+        FPDKUART_SetLatency(latency);
+
+        _FPDKUSB_StopTrace();
+        if( (len>=(sizeof(uint32_t)+sizeof(uint16_t)+sizeof(uint8_t))) && (dat[6] & FPDKPROTO_EXEC_TRACE) )
+        {
+          _ic_buf[0].words = 0;                                                                    //no buffer commands while pool holds the trace
+          _ic_buf[1].words = 0;
+          _ic_trace = true;
+          FPDKUART_SetTrace(_ic_buf_pool, FPDKUSB_BUF_POOL_SIZE);
+        }
+
         FPDK_SetLed(FPDK_LED_IC,true);
         _ic_is_running = true;
 
-        _FPDKUSB_Ack(0, 0);
+        uint16_t credit = FPDKUART_GetTxCredit();                                                  //host may send this many debug bytes before credits are returned
+        _FPDKUSB_Ack((uint8_t*)&credit, sizeof(credit));
       }
       break;
 
     case FPDKPROTO_CMD_STOPIC:
-      FPDKUART_DeInit();
-      FPDK_SetVDD(0, 0);
-      FPDK_SetLed(FPDK_LED_IC,false);
-      FPDK_SetLed(FPDK_LED_UART_RX, false);
-      FPDK_SetLed(FPDK_LED_UART_TX, false);
-      _FPDKUSB_Ack(0, 0);
+      {
+        FPDKUART_DeInit();
+        _FPDKUSB_StopTrace();
+        FPDK_SetVDD(0, 0);
+        FPDK_SetLed(FPDK_LED_IC,false);
+        FPDK_SetLed(FPDK_LED_UART_RX, false);
+        FPDK_SetLed(FPDK_LED_UART_TX, false);
+
+        uint32_t stats[3];
+        FPDKUART_GetStats(&stats[0], &stats[1], &stats[2]);
+        _FPDKUSB_Ack((uint8_t*)stats, sizeof(stats));
+      }
+      break;
+
+    case FPDKPROTO_CMD_GETTRACE:
+      {
+        if( len<sizeof(uint16_t) )
+          return false;
+        uint16_t maxlen;
+        memcpy( &maxlen, &dat[0], sizeof(uint16_t) );
+
+        uint32_t dropped;
+        uint32_t outlen = FPDKUART_TraceAvailable(&dropped);
+        if( outlen > maxlen )
+          outlen = maxlen;
+        if( outlen > (0xFFFF-sizeof(dropped)) )
+          outlen = 0xFFFF-sizeof(dropped);
+
+        uint8_t stage[64];                                                                         //copy out of ring in chunks, queue copies them
+        uint32_t rsplen = sizeof(dropped)+outlen;
+        uint8_t tmp[] = { FPDKPROTO_RSP_ACK, rsplen&0xFF, (rsplen>>8)&0xFF };
+        uint32_t port = _txqueue_port;
+        _rsp_sending = true;
+        bool ok = _FPDKUSB_TxStream(tmp, sizeof(tmp), port) && _FPDKUSB_TxStream((uint8_t*)&dropped, sizeof(dropped), port);
+        for( uint32_t p=0; ok && (p<outlen); )
+        {
+          uint32_t chunk = ((outlen-p)>sizeof(stage))?sizeof(stage):(outlen-p);
+          FPDKUART_TraceRead(stage, chunk);
+          ok = _FPDKUSB_TxStream(stage, chunk, port);
+          p += chunk;
+        }
+        _rsp_sending = false;
+      }
       break;
 
     case FPDKPROTO_CMD_DBGDAT:
@@ -458,23 +1003,55 @@ void FPDKUSB_HandleCommands(void)
     _dbg_led_tx_off_tick = 0;
   }
 
-  if( _packetbufpos<2 )
-    return;
+  uint32_t discard = _rxqueue_discard;
+  if( (int32_t)(discard-_rxqueue_tail) > 0 )
+  {
+    uint32_t head = _rxqueue_head;
+    _rxqueue_tail = ((int32_t)(discard-head) > 0)?head:discard;                                    //rest of dropped oversized frame is discarded when it arrives
+  }
 
-  uint32_t cmd_length = _packetbuf[1];
+  if( _rxqueue_stalled && ((FPDKUSB_RX_QUEUE_SIZE - (_rxqueue_head - _rxqueue_tail)) >= FPDKUSB_RX_PACKET_SIZE) )
+  {
+    _rxqueue_stalled = false;
+    __disable_irq();
+    CDC_ResumeReceive();
+    __enable_irq();
+  }
 
-  if( _packetbufpos < (2+cmd_length) )
+  uint32_t tail = _rxqueue_tail;
+  uint32_t avail = _rxqueue_head - tail;
+  uint32_t cmdpos, hdrlen, cmd_length;
+  if( (int32_t)(_rxqueue_discard-tail) > 0 )                                                       //dropping oversized frame
+    return;
+  if( !_FPDKUSB_RxFrameHeader(tail, avail, &cmdpos, &hdrlen, &cmd_length) )
     return;
 
-  if( !_FPDKUSB_HandleCmd(_packetbuf[0], &_packetbuf[2], cmd_length) )
+  if( cmd_length > FPDKPROTO_EXTFRAME_MAX )                                                        //does not fit in command buffer: drop it
+  {
+    __disable_irq();
+    _rxqueue_discard = tail+hdrlen+cmd_length;
+    __enable_irq();
     _FPDKUSB_SendError(0, 0);
+    return;
+  }
+
+  if( avail < (hdrlen+cmd_length) )
+    return;
+
+  uint8_t cmd = _FPDKUSB_RxPeek(cmdpos);
+  _FPDKUSB_RxCopy(_cmdbuf, tail+hdrlen, cmd_length);
+  _rxqueue_tail = tail+hdrlen+cmd_length;                                                          //frame taken, following frames are out of band candidates now
+
+  if( FPDKUSB_CMD_HANDLED == cmd )
+    return;
 
+  _ic_buf_busy = _FPDKUSB_GetCmdBufSlot(cmd, _cmdbuf, cmd_length);
+  _cmd_executing = true;
   __disable_irq();
-  if( _packetbufpos )
-  {
-    uint32_t cpylen = _packetbufpos-(2+cmd_length);
-    memmove( _packetbuf, &_packetbuf[2+cmd_length], cpylen );
-    _packetbufpos = cpylen;
-  }
+  _FPDKUSB_HandleOutOfBandCommands();                                                              //frames which arrived before command started
   __enable_irq();
+  if( !_FPDKUSB_HandleCmd(cmd, _cmdbuf, cmd_length) )
+    _FPDKUSB_SendError(0, 0);
+  _cmd_executing = false;
+  _ic_buf_busy = -1;
 }
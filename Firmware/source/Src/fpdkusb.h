@@ -31,9 +31,12 @@ bool FPDKUSB_IsConnected(void);
 
 void FPDKUSB_USBSignalPortOpenClose(void);
 bool FPDKUSB_USBHandleReceive(const uint8_t* dat, const uint32_t len);
+bool FPDKUSB_USBCanReceive(void);
+void FPDKUSB_USBHandleTransmitComplete(void);
 
 void FPDKUSB_HandleCommands(void);
 
-void FPDKUSB_SendDebug(const uint8_t* dat, const uint32_t len);
+bool FPDKUSB_SendDebug(const uint8_t* dat, const uint32_t len);
+bool FPDKUSB_SendDebugCredit(const uint32_t bytes);
 
 #endif //__FPDKUSB_H_
@@ -30,6 +30,8 @@ extern DMA_HandleTypeDef hdma_spi1_rx;
 
 extern DMA_HandleTypeDef hdma_usart1_rx;
 
+extern DMA_HandleTypeDef hdma_tim2_ch2;
+
 /* Private typedef -----------------------------------------------------------*/
 /* USER CODE BEGIN TD */
 /* USER CODE END TD */
@@ -344,6 +346,25 @@ void HAL_TIM_Base_MspInit(TIM_HandleTypeDef* htim_base)
     __HAL_RCC_TIM2_CLK_ENABLE();
   /* USER CODE BEGIN TIM2_MspInit 1 */
 
+    /* TIM2 DMA Init */
+    /* TIM2_CH2 Init (input capture timestamps for IC frequency measurement) */
+    hdma_tim2_ch2.Instance = DMA1_Channel7;
+    hdma_tim2_ch2.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_tim2_ch2.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_tim2_ch2.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_tim2_ch2.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+    hdma_tim2_ch2.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+    hdma_tim2_ch2.Init.Mode = DMA_NORMAL;
+    hdma_tim2_ch2.Init.Priority = DMA_PRIORITY_VERY_HIGH;
+    if (HAL_DMA_Init(&hdma_tim2_ch2) != HAL_OK)
+    {
+      Error_Handler();
+    }
+
+    __HAL_DMA_REMAP_CHANNEL_ENABLE(DMA_REMAP_TIM2_DMA_CH7);                                         //channel 3 (default) is used by SPI1 TX
+
+    __HAL_LINKDMA(htim_base,hdma[TIM_DMA_ID_CC2],hdma_tim2_ch2);
+
   /* USER CODE END TIM2_MspInit 1 */
   }
   else if(htim_base->Instance==TIM15)
@@ -411,6 +432,9 @@ void HAL_TIM_Base_MspDeInit(TIM_HandleTypeDef* htim_base)
     __HAL_RCC_TIM2_CLK_DISABLE();
   /* USER CODE BEGIN TIM2_MspDeInit 1 */
 
+    /* TIM2 DMA DeInit */
+    HAL_DMA_DeInit(htim_base->hdma[TIM_DMA_ID_CC2]);
+
   /* USER CODE END TIM2_MspDeInit 1 */
   }
   else if(htim_base->Instance==TIM15)
@@ -62,7 +62,7 @@
 /* USER CODE BEGIN PRIVATE_DEFINES */
 /* Define size for the receive and transmit buffer over CDC */
 /* It's up to user to redefine and/or remove those define */
-#define APP_RX_DATA_SIZE  512
+#define APP_RX_DATA_SIZE  CDC_DATA_FS_MAX_PACKET_SIZE
 #define APP_TX_DATA_SIZE  1
 /* USER CODE END PRIVATE_DEFINES */
 
@@ -126,6 +126,7 @@ static int8_t CDC_Init_FS(void);
 static int8_t CDC_DeInit_FS(void);
 static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length);
 static int8_t CDC_Receive_FS(uint8_t* pbuf, uint32_t *Len);
+static int8_t CDC_TransmitCplt_FS(uint8_t *pbuf, uint32_t *Len, uint8_t epnum);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
@@ -139,7 +140,8 @@ USBD_CDC_ItfTypeDef USBD_Interface_fops_FS =
   CDC_Init_FS,
   CDC_DeInit_FS,
   CDC_Control_FS,
-  CDC_Receive_FS
+  CDC_Receive_FS,
+  CDC_TransmitCplt_FS
 };
 
 /* Private functions ---------------------------------------------------------*/
@@ -254,7 +256,8 @@ static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
   bool bOK = FPDKUSB_USBHandleReceive( Buf, *Len );
 
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
-  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+  if( FPDKUSB_USBCanReceive() )                                   /* otherwise FPDKUSB calls CDC_ResumeReceive() when it has room again */
+    USBD_CDC_ReceivePacket(&hUsbDeviceFS);
   return (bOK?USBD_OK:USBD_FAIL);
   /* USER CODE END 6 */
 }
@@ -284,6 +287,26 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
   return result;
 }
 
+/**
+  * @brief  CDC_TransmitCplt_FS
+  *         Data transmitted callback
+  *
+  *         @note
+  *         This function is IN transfer complete callback used to inform user that
+  *         the submitted Data is successfully sent over USB.
+  *
+  * @param  Buf: Buffer of data to be received
+  * @param  Len: Number of data received (in bytes)
+  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+  */
+static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
+{
+  /* USER CODE BEGIN 13 */
+  FPDKUSB_USBHandleTransmitComplete();
+  return (USBD_OK);
+  /* USER CODE END 13 */
+}
+
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
 bool CDC_IsConnected(void)
 {
@@ -293,6 +316,10 @@ bool CDC_IsHostPortOpen(void)
 {
   return (hUsbDeviceFS.dev_state == USBD_STATE_CONFIGURED) && host_port_open;
 }
+void CDC_ResumeReceive(void)
+{
+  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+}
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
 /**
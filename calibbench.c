@@ -0,0 +1,115 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fpdkicdata.h"
+#include "fpdkiccalib.h"
+
+//micro benchmark + check for FPDKCALIB_InsertCalibrations: synthetic 14 bit images with IHRC / ILRC calibration stubs at known positions
+
+#define BENCH_WORDS      0x4000                                                                    //16k words (32k bytes) per image
+#define BENCH_PASSES     2000
+
+static uint16_t _image[BENCH_WORDS];
+static uint16_t _work[BENCH_WORDS];
+
+static uint32_t _lcg = 12345;
+static uint16_t _BENCH_Random(void)
+{
+  _lcg = _lcg*1103515245 + 12345;
+  return _lcg>>16;
+}
+
+//stub as emitted by EASY_PDK_CALIBRATE_IHRC / _ILRC macros (14 bit): AND A,'H'|'L' / AND A,'8' / AND A,<freq 4 bytes> / AND A,<mV 2 bytes>
+static void _BENCH_PlaceStub(uint16_t pos, const bool ilrc, const uint32_t frequency, const uint32_t millivolt)
+{
+  _image[pos++] = ilrc?0x2C4C:0x2C48;
+  _image[pos++] = 0x2C38;
+  for( uint32_t b=0; b<4; b++ )
+    _image[pos++] = 0x2C00 | ((frequency>>(8*b))&0xFF);
+  _image[pos++] = 0x2C00 | (millivolt&0xFF);
+  _image[pos++] = 0x2C00 | ((millivolt>>8)&0xFF);
+}
+
+int main( int argc, const char * argv [] )
+{
+  const FPDKICDATA* icdata = FPDKICDATA_GetICDataByName("PFS154");
+  if( !icdata || (14 != icdata->codebits) )
+  {
+    printf("FAIL: no 14 bit IC definition\n");
+    return -1;
+  }
+
+  //filler never starts with AND A,* (0x2Cxx) so only placed stubs can match
+  for( uint32_t i=0; i<BENCH_WORDS; i++ )
+  {
+    uint16_t w = _BENCH_Random() & 0x3FFF;
+    if( 0x2C00 == (w & 0xFF00) )
+      w ^= 0x0100;
+    _image[i] = w;
+  }
+
+  uint16_t pos[FPDKCALIB_MAX_SITES];
+  uint32_t freq[FPDKCALIB_MAX_SITES];
+  uint32_t mvol[FPDKCALIB_MAX_SITES];
+  for( uint32_t s=0; s<FPDKCALIB_MAX_SITES; s++ )
+  {
+    pos[s] = 0x10 + s*(BENCH_WORDS/FPDKCALIB_MAX_SITES) + (_BENCH_Random()&0xFF);
+    if( (FPDKCALIB_MAX_SITES-1) == s )
+      pos[s] = BENCH_WORDS-8;                                                                      //last stub ends exactly at image end
+    freq[s] = (s&1)?(55000+s*1000):(8000000+s*100000);
+    mvol[s] = 3000 + s*250;
+    _BENCH_PlaceStub(pos[s], s&1, freq[s], mvol[s]);
+  }
+
+  FPDKCALIBSITE sites[FPDKCALIB_MAX_SITES];
+  uint16_t found = 0;
+  clock_t start = clock();
+  for( uint32_t r=0; r<BENCH_PASSES; r++ )
+  {
+    memcpy(_work, _image, sizeof(_work));
+    found = FPDKCALIB_InsertCalibrations(icdata, (uint8_t*)_work, sizeof(_work), sites, FPDKCALIB_MAX_SITES);
+  }
+  double secs = (double)(clock()-start)/CLOCKS_PER_SEC;
+
+  int fail = 0;
+  if( FPDKCALIB_MAX_SITES != found )
+  {
+    printf("FAIL: found %d of %d calibration sites\n", found, FPDKCALIB_MAX_SITES);
+    fail = 1;
+  }
+  for( uint32_t s=0; (s<found) && (s<FPDKCALIB_MAX_SITES); s++ )
+  {
+    FPDKCALIBTYPE type = (s&1)?FPDKCALIB_ILRC:FPDKCALIB_IHRC;
+    if( (sites[s].pos != pos[s]) || (sites[s].type != type) || (sites[s].frequency != freq[s]) || (sites[s].millivolt != mvol[s]) ||
+        (0x2FFF != _work[pos[s]]) )
+    {
+      printf("FAIL: site %d: pos 0x%04X type %d freq %d mV %d, expected pos 0x%04X type %d freq %d mV %d\n", s,
+             sites[s].pos, sites[s].type, sites[s].frequency, sites[s].millivolt, pos[s], type, freq[s], mvol[s]);
+      fail = 1;
+    }
+  }
+
+  printf("%s: %d sites in %d words, %.2f us per image (%d passes)\n", fail?"FAIL":"OK", found, BENCH_WORDS,
+         secs*1000000.0/BENCH_PASSES, BENCH_PASSES);
+
+  return fail?-1:0;
+}
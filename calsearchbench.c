@@ -0,0 +1,168 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fpdkcalsearch.h"
+#include "fpdkproto.h"
+
+//check for calibration search of firmware (FPDKCALSEARCH_Frequency): same best trim as linear sweep 0..FPDKPROTO_CALIB_TRIM_MAX
+//on non monotonic oscillator models (step back up to FPDKCALSEARCH_REFINE), trims are only incremented (IC calibration loop) or
+//restarted from 0xFF (power cycle)
+
+#define BENCH_MODELS      200
+#define BENCH_TARGETS     400
+#define BENCH_NOMINAL     16000000
+#define BENCH_MAX_MEASUREMENTS 24                                                                    //range ends + binary search + probes + refinement
+
+static uint32_t _model[FPDKPROTO_CALIB_TRIM_MAX+1];
+static uint8_t  _trim;                                                                             //trim in IC calibration loop
+static uint32_t _measurements;
+static uint32_t _restarts;
+static uint32_t _wraps;                                                                            //trim incremented past FPDKPROTO_CALIB_TRIM_MAX
+
+static uint32_t _lcg = 12345;
+static uint32_t _BENCH_Random(void)
+{
+  _lcg = _lcg*1103515245 + 12345;
+  return _lcg>>8;
+}
+
+//binary weighted trim with weight mismatch (non monotonic at carries) and slight curvature, rising or falling
+static void _BENCH_Model(const uint32_t mismatch_ppm, const bool falling)
+{
+  double lsb = (double)BENCH_NOMINAL/FPDKPROTO_CALIB_TRIM_MAX;
+  double w[8];
+  for( uint32_t b=0; b<8; b++ )
+    w[b] = (1<<b) * lsb * (1.0 + ((double)(_BENCH_Random()%(2*mismatch_ppm+1)) - mismatch_ppm)/1000000.0);
+
+  for( uint32_t t=0; t<=FPDKPROTO_CALIB_TRIM_MAX; t++ )
+  {
+    double f = 0;
+    for( uint32_t b=0; b<8; b++ )
+      if( t & (1<<b) )
+        f += w[b];
+    f = f*(1.0 - 0.1*f/(2*BENCH_NOMINAL));
+    _model[t] = BENCH_NOMINAL/2 + (falling ? (BENCH_NOMINAL - (uint32_t)f) : (uint32_t)f);
+  }
+}
+
+//largest step back between any two trims in LSB (average step), 0 = monotonic
+static double _BENCH_Backstep(void)
+{
+  double lsb = ((double)_model[FPDKPROTO_CALIB_TRIM_MAX] - (double)_model[0])/FPDKPROTO_CALIB_TRIM_MAX;
+  double back = 0, peak = _model[0];
+  for( uint32_t t=1; t<=FPDKPROTO_CALIB_TRIM_MAX; t++ )
+  {
+    if( (((double)_model[t] - peak)/lsb) < -back )
+      back = -((double)_model[t] - peak)/lsb;
+    if( (((double)_model[t] - peak)/lsb) > 0 )
+      peak = _model[t];
+  }
+  return back;
+}
+
+static uint32_t _BENCH_Measure(const uint8_t trim, const uint32_t resolution_ppm)
+{
+  if( trim < _trim )                                                                               //calibration loop only increments: power cycle
+  {
+    _trim = 0xFF;
+    _restarts++;
+  }
+  for( ; _trim != trim; _trim++ )
+    if( (uint8_t)(_trim+1) > FPDKPROTO_CALIB_TRIM_MAX )
+      _wraps++;
+  _measurements++;
+  return _model[trim];
+}
+
+static uint8_t _BENCH_Sweep(const uint32_t tune_frequency, uint32_t* actual_frequency)
+{
+  uint32_t bestDistance = 0xFFFFFFFF;
+  uint8_t bestMatch = 0;
+  for( uint32_t t=0; t<=FPDKPROTO_CALIB_TRIM_MAX; t++ )
+  {
+    uint32_t distance = abs((int32_t)_model[t] - (int32_t)tune_frequency);
+    if( distance < bestDistance )
+    {
+      bestDistance = distance;
+      bestMatch = t;
+      *actual_frequency = _model[t];
+    }
+  }
+  return bestMatch;
+}
+
+int main( int argc, const char * argv [] )
+{
+  uint32_t mismatch_ppm = (argc>1)?strtoul(argv[1], NULL, 0):20000;                                //default: 2% weight mismatch
+  static const volatile bool noabort = false;
+
+  uint32_t runs = 0, fail = 0, maxmeasurements = 0, maxrestarts = 0, nonmonotonic = 0;
+  double maxbackstep = 0;
+  uint64_t summeasurements = 0;
+  clock_t start = clock();
+  for( uint32_t m=0; m<BENCH_MODELS; m++ )
+  {
+    double backstep;
+    do
+    {
+      _BENCH_Model(mismatch_ppm, m&1);
+      backstep = _BENCH_Backstep();
+    } while( backstep > FPDKCALSEARCH_REFINE );                                                    //search is exact up to this step back
+    if( backstep>0 )
+      nonmonotonic++;
+    if( backstep>maxbackstep )
+      maxbackstep = backstep;
+    uint32_t fmin = (m&1)?_model[FPDKPROTO_CALIB_TRIM_MAX]:_model[0];
+    uint32_t fmax = (m&1)?_model[0]:_model[FPDKPROTO_CALIB_TRIM_MAX];
+
+    for( uint32_t i=0; i<BENCH_TARGETS; i++ )
+    {
+      uint32_t tune = fmin - (fmax-fmin)/20 + (uint64_t)(fmax-fmin)*11*i/(10*BENCH_TARGETS);       //whole range + 5% outside on both ends
+      uint32_t sweep_freq = 0, search_freq = 0;
+      uint8_t sweep = _BENCH_Sweep(tune, &sweep_freq);
+
+      _trim = 0xFF;
+      _measurements = _restarts = _wraps = 0;
+      uint8_t search = FPDKCALSEARCH_Frequency(tune, FPDKPROTO_CALIB_TRIM_MAX, _BENCH_Measure, &noabort, &search_freq);
+
+      runs++;
+      summeasurements += _measurements;
+      if( _measurements>maxmeasurements ) maxmeasurements = _measurements;
+      if( _restarts>maxrestarts ) maxrestarts = _restarts;
+      if( (search != sweep) || (search_freq != sweep_freq) || _wraps || (_measurements > BENCH_MAX_MEASUREMENTS) )
+      {
+        if( fail++ < 10 )
+          printf("FAIL: model %d tune %dHz: search 0x%02X (%dHz, %d measurements, %d wraps), sweep 0x%02X (%dHz)\n", m, tune,
+                 search, search_freq, _measurements, _wraps, sweep, sweep_freq);
+      }
+    }
+  }
+  double secs = (double)(clock()-start)/CLOCKS_PER_SEC;
+
+  printf("%s: %d searches (%d failed) on %d models (%d non monotonic, backstep max %.2f LSB), measurements avg %.1f max %d (sweep %d), "
+         "restarts max %d, %.2f us per search\n", fail?"FAIL":"OK", runs, fail, BENCH_MODELS, nonmonotonic, maxbackstep,
+         (double)summeasurements/runs, maxmeasurements, FPDKPROTO_CALIB_TRIM_MAX+1, maxrestarts, secs*1000000.0/runs);
+
+  return fail?-1:0;
+}
@@ -25,21 +25,31 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "fpdkicdata.h"
 #include "fpdkiccalib.h"
 #include "fpdkihex8.h"
+#include "fpdkimage.h"
+#include "fpdkplan.h"
 #include "argp.h"
 
 const char *argp_program_version                = "easypdkprog 1.0";
 static const char easypdkprog_doc[]             = "easypdkprog -- read, write and execute programs on PADAUK microcontroller\nhttps://free-pdk.github.io";
-static const char easypdkprog_args_doc[]        = "list|probe|read|write|erase|start [FILE]";
+static const char easypdkprog_args_doc[]        = "list|probe|read|write|erase|start|compile [FILE] [PLANFILE]";
 
 static struct argp_option easypdkprog_options[] = {
   {"verbose",     'v', 0,      0,  "Verbose output" },
   {"port",        'p', "PORT", 0,  "COM port of programmer. Default: Auto search" },
-  {"bin",         'b', 0,      0,  "Binary file output. Default: ihex8" },
+  {"bin",         'b', 0,      0,  "Binary file output. Default: ihex8 / raw debug output (start)" },
+  {"skipblank",  447,  0,      0,  "Skip blank (unprogrammed) records in ihex8 output" },
   {"noerase",    555,  0,      0,  "Skip erase before write" },
   {"noblankchk", 666,  0,      0,  "Skip blank check before write" },
   {"securefill", 777,  0,      0,  "Fill unused space with 0 (NOP) to prevent readout" },
   {"noverify",   888,  0,      0,  "Skip verify after write" },
   {"nocalibrate",999,  0,      0,  "Skip calibration after write." },
+  {"characterize",444, "CSVFILE", 0, "Measure frequency of all calibration trim values before calibration and write them to CSV file (write)" },
+  {"calibalgos", 446,  "FILE", 0,  "Load additional calibration algorithms from descriptor file" },
+  {"log",        450,  "FILE", 0,  "Log IC debug output with timestamps to binary file (start)" },
+  {"dbglatency", 449,  "MS",   0,  "Max. delay for forwarding IC debug output (start). Default: 5 ms" },
+  {"trace",      451,  0,      0,  "Capture IC debug output with programmer timestamps, download periodically (start)" },
+  {"icdb",       448,  "FILE", 0,  "Load additional / modified IC definitions from file" },
+  {"charvdd",    445,  "VDD[:VDD:STEP]", 0, "VDD levels for characterization, e.g. 3.0:5.0:0.5. Default: calibration VDD" },
   {"fuse",        'f', "FUSE", 0,  "FUSE value, e.g. 0x31FD"},
   {"runvdd",      'r', "VDD",  0,  "Voltage for running the IC. Default: 5.0" },
   {"icname",      'n', "NAME", 0,  "IC name, e.g. PFS154" },
@@ -52,9 +62,20 @@ struct easypdkprog_args {
   int      verbose;
   char     *port;
   int      binout;
+  int      skipblank;
   char     *inoutfile;
+  char     *planfile;
   int      securefill;
   int      nocalibrate;
+  char     *charfile;
+  uint32_t charvdd_first;                                                                          //mV, 0 = calibration VDD
+  uint32_t charvdd_last;
+  uint32_t charvdd_step;
+  char     *calibalgos;
+  char     *icdb;
+  uint16_t dbglatency;
+  char     *logfile;
+  int      trace;
   int      noerase;
   int      noblankcheck;
   int      noverify;
@@ -72,11 +93,33 @@ static error_t easypdkprog_parse_opt(int key, char *arg, struct argp_state *stat
     case 'v': arguments->verbose = 1; break;
     case 'p': arguments->port = arg; break;
     case 'b': arguments->binout = 1; break;
+    case 447: arguments->skipblank = 1; break;
     case 555: arguments->noerase = 1; break;
     case 666: arguments->noblankcheck = 1; break;
     case 777: arguments->securefill = 1; break;
     case 888: arguments->noverify = 1; break;
     case 999: arguments->nocalibrate = 1; break;
+    case 444: arguments->charfile = arg; break;
+    case 445: 
+      {
+        float cf, cl, cs;
+        int n = sscanf(arg, "%f:%f:%f", &cf, &cl, &cs);
+        if( (1 != n) && ((3 != n) || (cl < cf) || (cs <= 0)) )                                     //FIRST:LAST without STEP is ambiguous
+          argp_error(state, "invalid --charvdd '%s', use VDD or FIRST:LAST:STEP", arg);
+        arguments->charvdd_first = arguments->charvdd_last = cf*1000;
+        arguments->charvdd_step = 0;
+        if( 3 == n )
+        {
+          arguments->charvdd_last = cl*1000;
+          arguments->charvdd_step = cs*1000;
+        }
+      }
+      break;
+    case 446: arguments->calibalgos = arg; break;
+    case 448: arguments->icdb = arg; break;
+    case 449: if(arg) arguments->dbglatency = atoi(arg); break;
+    case 450: arguments->logfile = arg; break;
+    case 451: arguments->trace = 1; break;
     case 'f': if(arg) arguments->fuse = strtol(arg,NULL,16); break;
     case 'n': arguments->ic = arg; break;
     case 'i': if(arg) arguments->icid = strtol(arg,NULL,16); break;
@@ -90,7 +133,8 @@ static error_t easypdkprog_parse_opt(int key, char *arg, struct argp_state *stat
             !strcmp(arg,"read") && 
             !strcmp(arg,"write") && 
             !strcmp(arg,"erase") && 
-            !strcmp(arg,"start") )
+            !strcmp(arg,"start") &&
+            !strcmp(arg,"compile") )
         {
           argp_usage(state);
         }
@@ -100,6 +144,10 @@ static error_t easypdkprog_parse_opt(int key, char *arg, struct argp_state *stat
       {
         arguments->inoutfile = arg;
       }
+      else if(2 == state->arg_num)
+      {
+        arguments->planfile = arg;
+      }
       else
         argp_usage(state);
       break;
@@ -115,6 +163,142 @@ static error_t easypdkprog_parse_opt(int key, char *arg, struct argp_state *stat
   return 0;
 }
 
+struct easypdkprog_characterize_ctx {
+  FILE     *f;
+  uint16_t site;
+};
+
+static void easypdkprog_characterize_sample(void* ctx, const uint32_t vdd, const uint8_t trim, const uint32_t frequency)
+{
+  struct easypdkprog_characterize_ctx *cctx = ctx;
+  fprintf(cctx->f, "%d,%d,%d,%d\n", cctx->site, vdd, trim, frequency);
+}
+
+//prepare everything for writing: image with calibration code inserted, regions to write, calibration sites
+static int easypdkprog_compile_plan(const struct easypdkprog_args *arguments, const FPDKICDATA* icdata, FPDKPLAN* plan)
+{
+  memset(plan, 0, sizeof(FPDKPLAN));
+  memcpy(&plan->icdata, icdata, sizeof(FPDKICDATA));
+  plan->fuse = arguments->fuse;
+
+  static uint16_t write_data[FPDKPLAN_MAX_CODE];
+  FPDKIMAGE image;
+  if( FPDKIMAGE_ReadFile(arguments->inoutfile, write_data, FPDKPLAN_MAX_CODE, &image) < 0 )
+    return -1;
+  verbose_printf("Input: %s, %d regions, %d symbols\n", image.format, image.regioncount, image.symbolcount);
+  FPDKIMAGE_Free(&image);
+
+  memset(plan->data, arguments->securefill?0x00:0xFF, sizeof(plan->data));
+  for( uint32_t p=0; p<sizeof(plan->data); p++)
+  {
+    if( write_data[p] & 0xFF00 )
+    {
+      plan->data[p] = write_data[p]&0xFF;
+      plan->len = p;
+    }
+  }
+
+  if( arguments->securefill )
+  {
+    uint16_t fillend = icdata->codewords - 8;
+    if( icdata->exclude_code_start && (icdata->exclude_code_start < fillend) )
+      fillend = icdata->exclude_code_start;
+
+    plan->len = fillend*sizeof(uint16_t);
+  }
+
+  if( 0 == plan->len )
+    return -2;
+
+  //only populated regions are sent and written (extended to complete write blocks, small gaps are merged)
+  plan->regions[0].start = 0;
+  plan->regions[0].len = plan->len;
+  plan->regioncount = 1;
+  if( !arguments->securefill )
+  {
+    uint32_t block = icdata->write_block_size*sizeof(uint16_t);
+    plan->regioncount = FPDKIMAGE_GetRegions(write_data, sizeof(plan->data), block, 4*block, plan->regions, FPDKIMAGE_MAX_REGIONS);
+  }
+
+  if( !arguments->nocalibrate )
+    plan->calibcount = FPDKCALIB_InsertCalibrations(icdata, plan->data, plan->len, plan->calib, FPDKCALIB_MAX_SITES);
+
+  return 0;
+}
+
+//debug log: "FPDKLOG1", then per chunk: {timestamp us u64, direction u8 (0: from IC, 1: to IC), length u16, data} little endian
+#define EASYPDKPROG_LOG_MAGIC "FPDKLOG1"
+#define EASYPDKPROG_TRACE_INTERVAL 1000                                                            //ms between trace downloads
+
+static void easypdkprog_log_chunk(FILE* f, const uint64_t us, const uint8_t dir, const uint8_t* dat, const uint16_t len)
+{
+  uint8_t hdr[11];
+  for( uint32_t i=0; i<8; i++ )
+    hdr[i] = us>>(8*i);
+  hdr[8] = dir;
+  hdr[9] = len;
+  hdr[10] = len>>8;
+  fwrite(hdr, 1, sizeof(hdr), f);
+  fwrite(dat, 1, len, f);
+}
+
+static void easypdkprog_dbg_output(FILE* flog, const uint64_t us, uint8_t* dat, int len, const bool binout)
+{
+  if( flog )
+    easypdkprog_log_chunk(flog, us, 0, dat, len);
+
+  if( !binout )                                                                                    //text mode: drop NUL bytes
+  {
+    int t = 0;
+    for( int i=0; i<len; i++ )
+      if( dat[i] )
+        dat[t++] = dat[i];
+    len = t;
+  }
+  fpdkutil_out_write(dat, len);
+}
+
+//trace download: records {timestamp us u32, length u16, data} may be split between reads
+typedef struct EASYPDKPROG_TRACE
+{
+  uint8_t  dat[FPDKCOM_TRACE_READ_MAX+FPDKPROTO_TRACE_HDR_SIZE+0xFFFF];
+  uint32_t len;
+  uint32_t lastts;
+  uint64_t tsbase;                                                                                 //programmer timestamp wraps after ~71 minutes
+  uint32_t dropped;
+} EASYPDKPROG_TRACE;
+
+static bool easypdkprog_trace_download(const int comfd, EASYPDKPROG_TRACE* trc, FILE* flog, const bool binout)
+{
+  for( ;; )
+  {
+    int r = FPDKCOM_IC_ReadTrace(comfd, &trc->dat[trc->len], FPDKCOM_TRACE_READ_MAX, &trc->dropped);
+    if( r<0 )
+      return false;
+    trc->len += r;
+
+    uint32_t p = 0;
+    while( (trc->len-p) >= FPDKPROTO_TRACE_HDR_SIZE )
+    {
+      const uint8_t* hdr = &trc->dat[p];
+      uint32_t ts = hdr[0] | (hdr[1]<<8) | (hdr[2]<<16) | ((uint32_t)hdr[3]<<24);
+      uint32_t reclen = hdr[4] | (hdr[5]<<8);
+      if( (trc->len-p) < (FPDKPROTO_TRACE_HDR_SIZE+reclen) )
+        break;
+      if( ts < trc->lastts )
+        trc->tsbase += 0x100000000ULL;
+      trc->lastts = ts;
+      easypdkprog_dbg_output(flog, trc->tsbase+ts, &trc->dat[p+FPDKPROTO_TRACE_HDR_SIZE], reclen, binout);
+      p += FPDKPROTO_TRACE_HDR_SIZE+reclen;
+    }
+    trc->len -= p;
+    memmove(trc->dat, &trc->dat[p], trc->len);
+
+    if( r<FPDKCOM_TRACE_READ_MAX )                                                                 //ring drained (IC may keep it filling, continue next time)
+      return true;
+  }
+}
+
 static struct argp argp = { easypdkprog_options, easypdkprog_parse_opt, easypdkprog_args_doc, easypdkprog_doc };
 
 int main( int argc, const char * argv [] )
@@ -127,27 +311,53 @@ int main( int argc, const char * argv [] )
 
   verbose_set(arguments.verbose);
 
+  if( arguments.icdb )
+  {
+    int r = FPDKICDATA_LoadDefinitions(arguments.icdb);
+    if( r<0 )
+    {
+      printf("ERROR: Could not load IC definitions from: %s\n", arguments.icdb);
+      return -2;
+    }
+    verbose_printf("Loaded %d IC definitions from: %s\n", r, arguments.icdb);
+  }
+
+  if( arguments.calibalgos )
+  {
+    int r = FPDKCALIB_LoadAlgorithms(arguments.calibalgos);
+    if( -3 == r )
+    {
+      printf("ERROR: Calibration algorithm of type BG in: %s (bandgap only calibration is not supported by programmer)\n", arguments.calibalgos);
+      return -2;
+    }
+    if( r<0 )
+    {
+      printf("ERROR: Could not load calibration algorithms from: %s\n", arguments.calibalgos);
+      return -2;
+    }
+    verbose_printf("Loaded %d calibration algorithms from: %s\n", r, arguments.calibalgos);
+  }
+
   if( 'l'==arguments.command )
   {
     printf("Supported ICs:\n");
-    for( uint16_t id=1; id<0xFFF; id++ )
+    unsigned int iter = 0;
+    FPDKICDATA* icdata;
+    while( (icdata = FPDKICDATA_GetNext(&iter)) )
     {
-      FPDKICDATA* icdata = FPDKICDATA_GetICDataById12Bit(id);
-      if( icdata )
-      {
-        printf(" %-8s (0x%03X): %s: %d (%d bit), RAM: %3d bytes\n", icdata->name, icdata->id12bit, (FPDK_IC_FLASH==icdata->type)?"FLASH":"OTP  ", icdata->codewords, icdata->codebits, icdata->ramsize);
-        if( icdata->name_variant_1[0] )
-          printf(" %-8s (0x%03X): %s: %d (%d bit), RAM: %3d bytes\n", icdata->name_variant_1, icdata->id12bit, (FPDK_IC_FLASH==icdata->type)?"FLASH":"OTP  ", icdata->codewords, icdata->codebits, icdata->ramsize);
-        if( icdata->name_variant_2[0] )
-          printf(" %-8s (0x%03X): %s: %d (%d bit), RAM: %3d bytes\n", icdata->name_variant_2, icdata->id12bit, (FPDK_IC_FLASH==icdata->type)?"FLASH":"OTP  ", icdata->codewords, icdata->codebits, icdata->ramsize);
-      }
+      printf(" %-8s (0x%03X): %s: %d (%d bit), RAM: %3d bytes\n", icdata->name, icdata->id12bit, (FPDK_IC_FLASH==icdata->type)?"FLASH":"OTP  ", icdata->codewords, icdata->codebits, icdata->ramsize);
+      if( icdata->name_variant_1[0] )
+        printf(" %-8s (0x%03X): %s: %d (%d bit), RAM: %3d bytes\n", icdata->name_variant_1, icdata->id12bit, (FPDK_IC_FLASH==icdata->type)?"FLASH":"OTP  ", icdata->codewords, icdata->codebits, icdata->ramsize);
+      if( icdata->name_variant_2[0] )
+        printf(" %-8s (0x%03X): %s: %d (%d bit), RAM: %3d bytes\n", icdata->name_variant_2, icdata->id12bit, (FPDK_IC_FLASH==icdata->type)?"FLASH":"OTP  ", icdata->codewords, icdata->codebits, icdata->ramsize);
     }
     return 0;
   }
 
   //pre checks
   FPDKICDATA* icdata = NULL;
-  if( ('r'==arguments.command) || ('w'==arguments.command) || ('e'==arguments.command) )
+  bool use_plan = ('w'==arguments.command) && arguments.inoutfile && FPDKPLAN_IsPlanFile(arguments.inoutfile);
+  if( ('r'==arguments.command) || (('w'==arguments.command) && !use_plan) || ('e'==arguments.command) || ('c'==arguments.command) )
   {
     if( !arguments.icid && !arguments.ic)
     {
@@ -174,6 +384,51 @@ int main( int argc, const char * argv [] )
     return -2;
   }
 
+  static FPDKPLAN plan;
+  if( 'c'==arguments.command )
+  {
+    if( !arguments.inoutfile || !arguments.planfile )
+    {
+      printf("ERROR: Compile requires an input file and a plan file.\n");
+      return -2;
+    }
+
+    int r = easypdkprog_compile_plan(&arguments, icdata, &plan);
+    if( r<0 )
+    {
+      printf((-1==r)?"ERROR: Invalid input file / not ihex, srec or elf format.\n":"Nothing to write\n");
+      return -2;
+    }
+    if( FPDKPLAN_WriteFile(arguments.planfile, &plan) < 0 )
+    {
+      printf("ERROR: Could not write file: %s\n", arguments.planfile);
+      return -2;
+    }
+    printf("Plan for %s: %d regions, %d calibrations\n", icdata->name, plan.regioncount, plan.calibcount);
+    return 0;
+  }
+
+  if( use_plan )
+  {
+    if( FPDKPLAN_ReadFile(arguments.inoutfile, &plan) < 0 )
+    {
+      printf("ERROR: Invalid plan file: %s\n", arguments.inoutfile);
+      return -2;
+    }
+    icdata = &plan.icdata;
+    FPDKICDATA* reqic = arguments.ic?FPDKICDATA_GetICDataByName(arguments.ic):NULL;
+    if( (arguments.icid && (arguments.icid != icdata->id12bit)) || (arguments.ic && (!reqic || (reqic->id12bit != icdata->id12bit))) )
+    {
+      printf("ERROR: Plan file was compiled for %s.\n", icdata->name);
+      return -2;
+    }
+    if( arguments.nocalibrate && plan.calibcount )                                                 //calibration code is already inserted in plan image
+    {
+      printf("ERROR: Plan file contains calibrations, compile it with --nocalibrate instead.\n");
+      return -2;
+    }
+  }
+
   //open programmer
   int comfd = -1;
   if( !arguments.port )
@@ -202,6 +457,13 @@ int main( int argc, const char * argv [] )
 
   verbose_printf("FREE-PDK EASY PROG - Hardware:%.1f Firmware:%.1f Protocol:%.1f\n", hw, sw, proto);
 
+  if( icdata )
+  {
+    //send timing profile of IC once, older firmware does not know the command and uses its (conservative) defaults
+    if( !FPDKCOM_IC_SetTiming(comfd, icdata->leave_progmode_us, icdata->erase_wait_us, icdata->write_wait_us, icdata->erase_pulse_us, icdata->write_clock_half_us) )
+      verbose_printf("Programmer did not accept timing profile, using firmware defaults\n");
+  }
+
   switch( arguments.command )
   {
     case 'p': //probe
@@ -272,7 +534,8 @@ int main( int argc, const char * argv [] )
             }
             else
             {
-              if( FPDKIHEX8_WriteFile(arguments.inoutfile, buf, icdata->codewords*sizeof(uint16_t)) < 0 )
+              uint16_t blankword = arguments.skipblank?((1<<icdata->codebits)-1):0;
+              if( FPDKIHEX8_WriteFile(arguments.inoutfile, buf, icdata->codewords*sizeof(uint16_t), blankword) < 0 )
                 printf("ERROR: Could not write file: %s\n", arguments.inoutfile);
             }
           }
@@ -285,13 +548,36 @@ int main( int argc, const char * argv [] )
 
     case 'w': //write
     {
-      uint16_t write_data[0x1800];
-      if( FPDKIHEX8_ReadFile(arguments.inoutfile, write_data, 0x1800) < 0 )
+      if( !use_plan )
       {
-        printf("ERROR: Invalid input file / not ihex8 format.\n");
+        int r = easypdkprog_compile_plan(&arguments, icdata, &plan);
+        if( -1 == r )
+        {
+          printf("ERROR: Invalid input file / not ihex, srec or elf format.\n");
+          break;
+        }
+        if( r<0 )
+        {
+          printf("Nothing to write\n");
+          break;
+        }
+      }
+
+      int ib = FPDKCOM_InitBuffer(comfd, 0, icdata->codebits, icdata->codewords);                    //bit packed image memory sized for IC (older firmware: fixed 16 bit buffer)
+      if( !ib )
+      {
+        printf("ERROR: Image of %s does not fit in programmer memory\n", icdata->name);
         break;
       }
 
+      uint32_t ustart = plan.regioncount?(plan.regions[0].start&~1):0;                             //image is uploaded while IC gets erased / blank checked
+      uint32_t uend = ustart;
+      for( uint16_t i=0; i<plan.regioncount; i++ )
+        if( (plan.regions[i].start+plan.regions[i].len) > uend )
+          uend = plan.regions[i].start+plan.regions[i].len;
+      uend = (uend+1)&~1;
+      FPDKCOM_QueueBufferUpload(ustart, &plan.data[ustart], uend-ustart);
+
       if( (FPDK_IC_FLASH == icdata->type) && !arguments.noerase )
       {
         printf("Erasing IC... ");
@@ -323,62 +609,31 @@ int main( int argc, const char * argv [] )
         verbose_printf("done.\n");
       }
 
-      //TODO: OPTIMIZE: loop through data and only write used regions
+      uint8_t*         data = plan.data;
+      uint32_t         len = plan.len;
+      FPDKIMAGEREGION* regions = plan.regions;
+      uint16_t         regioncount = plan.regioncount;
+      FPDKCALIBSITE*   calibrate_sites = plan.calib;
+      uint16_t         calibrate_count = plan.calibcount;
+      uint16_t         fuse = (0xFFFF != arguments.fuse)?arguments.fuse:plan.fuse;
 
-      //QUICK IMPLEMENTATION FOR NOW: find end of data and program everything
-      uint8_t data[0x1800];
-      memset(data, arguments.securefill?0x00:0xFF, sizeof(data));
-      uint32_t len = 0;
-      for( uint32_t p=0; p<sizeof(data); p++)
-      {
-        if( write_data[p] & 0xFF00 )
-        {
-          data[p] = write_data[p]&0xFF;
-          len = p;
-        }
-      }
+      printf("Writing IC... ");
 
-      if( arguments.securefill )
+      int r = FPDKCOM_FinishBufferUpload(comfd)?icdata->id12bit:-1;                                 //rest of image not sent during erase / blank check
+      for( uint16_t i=0; (i<regioncount) && (r == icdata->id12bit); i++ )
       {
-        uint16_t fillend = icdata->codewords - 8;
-        if( icdata->exclude_code_start && (icdata->exclude_code_start < fillend) )
-          fillend = icdata->exclude_code_start;
-
-        len = fillend*sizeof(uint16_t);
+        uint16_t waddr = regions[i].start/2;
+        uint16_t wcount = (regions[i].len+1)/2;
+        r = FPDKCOM_IC_Write(comfd, icdata->id12bit, icdata->type, 
+                             icdata->vdd_cmd_write, icdata->vpp_cmd_write, icdata->vdd_write_hv, icdata->vpp_write_hv,
+                             waddr, icdata->addressbits, waddr, icdata->codebits, wcount, 
+                             icdata->write_block_size, icdata->write_block_clock_groups, icdata->write_block_clocks_per_group);
       }
-
-      if( 0 == len )
-      {
-        printf("Nothing to write\n");
-        break;
-      }
-
-      bool do_calibration = false;
-      
-      uint32_t       calibrate_frequency = 0;
-      uint32_t       calibrate_millivolt = 5000;
-      FPDKCALIBTYPE  calibrate_prg_type;
-      uint8_t        calibrate_prg_algo;
-      uint32_t       calibrate_prg_loopcycles;
-      uint16_t       calibrate_prg_pos;
-
-      if( !arguments.nocalibrate )
-        do_calibration = FPDKCALIB_InsertCalibration(icdata, data, len, &calibrate_frequency, &calibrate_millivolt, &calibrate_prg_type, &calibrate_prg_algo, &calibrate_prg_loopcycles, &calibrate_prg_pos);
-
-      printf("Writing IC... ");
-
-      if( !FPDKCOM_SetBuffer(comfd, 0, data, len) )
+      if( r<0 )
       {
         printf("ERROR: Could not send data to programmer\n");
         break;
       }
-
-      uint32_t codewords = (len+1)/2;
-
-      int r = FPDKCOM_IC_Write(comfd, icdata->id12bit, icdata->type, 
-                               icdata->vdd_cmd_write, icdata->vpp_cmd_write, icdata->vdd_write_hv, icdata->vpp_write_hv,
-                               0, icdata->addressbits, 0, icdata->codebits, codewords, 
-                               icdata->write_block_size, icdata->write_block_clock_groups, icdata->write_block_clocks_per_group);
       if( r>=FPDK_ERR_ERROR )
       {
         printf("FPDK_ERROR: %s\n",FPDK_ERR_MSG[r&0x000F]);
@@ -394,7 +649,12 @@ int main( int argc, const char * argv [] )
       if( !arguments.noverify )
       {
         verbose_printf("Verifiying IC... ");
-        int r = FPDKCOM_IC_Verify(comfd, icdata->id12bit, icdata->type, icdata->vdd_cmd_read, icdata->vpp_cmd_read, 0, icdata->addressbits, 0, icdata->codebits, codewords, icdata->exclude_code_first_instr, icdata->exclude_code_start, icdata->exclude_code_end);
+        for( uint16_t i=0; (i<regioncount) && (r == icdata->id12bit); i++ )
+        {
+          uint16_t waddr = regions[i].start/2;
+          uint16_t wcount = (regions[i].len+1)/2;
+          r = FPDKCOM_IC_Verify(comfd, icdata->id12bit, icdata->type, icdata->vdd_cmd_read, icdata->vpp_cmd_read, waddr, icdata->addressbits, waddr, icdata->codebits, wcount, icdata->exclude_code_first_instr, icdata->exclude_code_start, icdata->exclude_code_end);
+        }
         if( r>=FPDK_ERR_ERROR )
         {
           printf("FPDK_ERROR: %s\n",FPDK_ERR_MSG[r&0x000F]);
@@ -408,10 +668,10 @@ int main( int argc, const char * argv [] )
         verbose_printf("done.\n");
       }
 
-      if( 0xFFFF != arguments.fuse )
+      if( 0xFFFF != fuse )
       {
         printf("Writing IC Fuse... ");
-        uint8_t fusedata[] = {arguments.fuse, arguments.fuse>>8};
+        uint8_t fusedata[] = {fuse, fuse>>8};
 
         uint16_t fuseaddr = icdata->codewords-1;
 
@@ -438,41 +698,68 @@ int main( int argc, const char * argv [] )
         printf("done.\n");
       }
 
-      if( do_calibration )
+      //calibration sites are executed in address order: every calibrated site is removed before the next one gets reached
+      struct easypdkprog_characterize_ctx cctx = { .f = 0 };
+      if( calibrate_count && arguments.charfile )
       {
-        printf("Calibrating IC (@%.2fV ", (float)calibrate_millivolt/1000.0);
-        switch( calibrate_prg_type )
+        cctx.f = fopen(arguments.charfile,"w");
+        if( !cctx.f )
+        {
+          printf("ERROR: Could not write file: %s\n", arguments.charfile);
+          break;
+        }
+        fprintf(cctx.f, "site,vdd_mv,trim,frequency_hz\n");
+      }
+
+      for( uint16_t site=0; site<calibrate_count; site++ )
+      {
+        uint32_t      calibrate_frequency = calibrate_sites[site].frequency;
+        uint32_t      calibrate_millivolt = calibrate_sites[site].millivolt;
+        FPDKCALIBTYPE calibrate_prg_type = calibrate_sites[site].type;
+        uint32_t      calibrate_prg_loopcycles = calibrate_sites[site].loopcycles;
+        uint16_t      calibrate_prg_pos = calibrate_sites[site].pos;
+
+        if( cctx.f )
         {
-          case FPDKCALIB_IHRC:         printf("IHRC SYSCLK=%dHz", calibrate_frequency); break;
-          case FPDKCALIB_ILRC:         printf("ILRC SYSCLK=%dHz", calibrate_frequency); break;
-          case FPDKCALIB_BG:           printf("BG"); break;
-          case FPDKCALIB_IHRC_BG:      printf("BG / IHRC SYSCLK=%dHz", calibrate_frequency); break;
-          case FPDKCALIB_ILRC_BG:      printf("BG / ILRC SYSCLK=%dHz", calibrate_frequency); break;
+          uint32_t vdd_first = calibrate_millivolt, vdd_last = calibrate_millivolt, vdd_step = 0;
+          if( arguments.charvdd_first )
+          {
+            vdd_first = arguments.charvdd_first;
+            vdd_last = arguments.charvdd_last;
+            vdd_step = arguments.charvdd_step;
+          }
+
+          printf("Characterizing IC calibration... ");
+          cctx.site = site;
+          int samples = FPDKCOM_IC_Characterize(comfd, calibrate_prg_type, vdd_first, vdd_last, vdd_step, calibrate_prg_loopcycles, 0x00, FPDKPROTO_CALIB_TRIM_MAX, easypdkprog_characterize_sample, &cctx);
+          if( samples<=0 )
+          {
+            printf("failed.\n");
+            break;
+          }
+          printf("done (%d samples).\n", samples);
         }
-        printf(")... ");
+
+        printf("Calibrating IC (@%.2fV ", (float)calibrate_millivolt/1000.0);
+        if( calibrate_count>1 )
+          printf("site %d/%d @0x%03X ", site+1, calibrate_count, calibrate_prg_pos);
+        bool calibrate_ilrc = (FPDKCALIB_ILRC == calibrate_prg_type) || (FPDKCALIB_ILRC_BG == calibrate_prg_type);
+        printf("%s SYSCLK=%dHz)... ", calibrate_ilrc?"ILRC":"IHRC", calibrate_frequency);          //_BG types: frequency only
         
         uint8_t fcalval, bgcalval;
-        uint32_t fcalfreq;
+        uint32_t fcalfreq, measurements;
 
-        if( !FPDKCOM_IC_Calibrate(comfd, calibrate_prg_type, calibrate_millivolt, calibrate_frequency, calibrate_prg_loopcycles, &fcalval, &fcalfreq, &bgcalval) )
+        if( !FPDKCOM_IC_Calibrate(comfd, calibrate_prg_type, calibrate_millivolt, calibrate_frequency, calibrate_prg_loopcycles, &fcalval, &fcalfreq, &bgcalval, &measurements) )
         {
           printf("failed.\n");
           break;
         }
 
-        switch( calibrate_prg_type )
-        {
-          case FPDKCALIB_BG: 
-            break;
-          case FPDKCALIB_IHRC:         
-          case FPDKCALIB_ILRC:
-          case FPDKCALIB_IHRC_BG:
-          case FPDKCALIB_ILRC_BG:
-            printf("calibration result: %dHz (0x%02X)  ", fcalfreq, fcalval); 
-            break;
-        }
+        printf("calibration result: %dHz (0x%02X)  ", fcalfreq, fcalval);
+        if( arguments.verbose && measurements )
+          printf("(%d measurements)  ", measurements);
 
-        if( FPDKCALIB_RemoveCalibration(calibrate_prg_algo, data, calibrate_prg_pos, fcalval) )
+        if( FPDKCALIB_RemoveCalibration(&calibrate_sites[site], data, fcalval) )
         {
           //TODO: OPTIMIZE: only write part
           if( !FPDKCOM_SetBuffer(comfd, 0, data, len) )
@@ -505,6 +792,9 @@ int main( int argc, const char * argv [] )
         }
         printf("done.\n");
       }
+
+      if( cctx.f )
+        fclose(cctx.f);
     }
     break;
 
@@ -549,33 +839,102 @@ int main( int argc, const char * argv [] )
 
     case 's':
     {
+      FILE* flog = 0;
+      if( arguments.logfile )
+      {
+        flog = fopen(arguments.logfile, "wb");
+        if( !flog )
+        {
+          printf("ERROR: Could not write file: %s\n", arguments.logfile);
+          break;
+        }
+        fwrite(EASYPDKPROG_LOG_MAGIC, 1, strlen(EASYPDKPROG_LOG_MAGIC), flog);
+      }
+
+      static EASYPDKPROG_TRACE trc;
+      memset(&trc, 0, sizeof(trc));
+
       printf("Running IC (%.2fV)... ", arguments.runvdd);
-      if( !FPDKCOM_IC_StartExecution(comfd, arguments.runvdd) )
+      if( !FPDKCOM_IC_StartExecution(comfd, arguments.runvdd, arguments.dbglatency, arguments.trace?FPDKPROTO_EXEC_TRACE:0) )
       {
         printf("ERROR: Could not start IC.\n");
+        if( flog )
+          fclose(flog);
         break;
       }
       printf("IC started, press [Esc] to stop.\n");
-
-      for( ;; )
+      fflush(stdout);
+
+      uint64_t tstart = fpdkutil_getMicroTicks();
+      uint8_t  keybuf[1024];                                                                       //keyboard input waiting for programmer credit
+      uint32_t keylen = 0;
+      unsigned long tracetick = fpdkutil_getTickCount() + EASYPDKPROG_TRACE_INTERVAL;
+      bool stop = false;
+      while( !stop )
       {
-        fpdkutil_waitfdorkeypress(comfd, 1000);
-        unsigned char dbgmsg[256] = {0};
-        int dbgd = FPDKCOM_IC_ReceiveDebugData(comfd, dbgmsg, 255);
-        if( dbgd>0 )
+        int ev = fpdkutil_waitevents(comfd, keylen<sizeof(keybuf), arguments.trace?EASYPDKPROG_TRACE_INTERVAL:1000);
+
+        if( arguments.trace && (fpdkutil_getTickCount() >= tracetick) )
         {
-          dbgmsg[dbgd]=0;
-          printf("%s", dbgmsg);
+          if( !easypdkprog_trace_download(comfd, &trc, flog, arguments.binout) )
+            printf("\nERROR: Could not read trace from programmer.\n");
+          tracetick = fpdkutil_getTickCount() + EASYPDKPROG_TRACE_INTERVAL;
         }
-        int c = fpdkutil_getchar();
-        if( 27 == c )
-          break;
-        if( -1 != c )
-          FPDKCOM_IC_SendDebugData(comfd, (uint8_t*)&c, 1);
+        else if( ev & FPDKUTIL_EV_FD )                                                             //trace download consumed pending credits already
+        {
+          uint8_t dbgmsg[256];
+          int dbgd = FPDKCOM_IC_ReceiveDebugData(comfd, dbgmsg, 255);
+          if( dbgd>0 )
+            easypdkprog_dbg_output(flog, fpdkutil_getMicroTicks()-tstart, dbgmsg, dbgd, arguments.binout);
+        }
+
+        for( int c; (keylen<sizeof(keybuf)) && (-1 != (c = fpdkutil_getchar())); )                //also enables raw keyboard input on first call
+        {
+          if( 27 == c )
+          {
+            stop = true;
+            break;
+          }
+          keybuf[keylen++] = c;
+        }
+
+        while( keylen && !stop )
+        {
+          int sent = FPDKCOM_IC_SendDebugData(comfd, keybuf, (keylen>255)?255:keylen);
+          if( sent<=0 )
+            break;                                                                                 //no credit, wait for programmer
+          if( flog )
+            easypdkprog_log_chunk(flog, fpdkutil_getMicroTicks()-tstart, 1, keybuf, sent);
+          keylen -= sent;
+          memmove(keybuf, &keybuf[sent], keylen);
+        }
+      }
+      if( arguments.trace )
+      {
+        if( !easypdkprog_trace_download(comfd, &trc, flog, arguments.binout) )                    //remaining records, ring is released on stop
+          printf("\nERROR: Could not read trace from programmer.\n");
+        if( trc.dropped )
+          verbose_printf("\nTrace buffer full, %u bytes dropped\n", trc.dropped);
       }
+      int outerr = fpdkutil_out_flush();
+      if( outerr<0 )
+        fprintf(stderr, "\nERROR: Could not write IC output: %s\n", strerror(-outerr));
 
-      if( FPDKCOM_IC_StopExecution(comfd) )
+      if( flog )
+      {
+        fclose(flog);
+        verbose_printf("\nDebug log written to: %s\n", arguments.logfile);
+      }
+
+      uint32_t dbgbytes, dbgpackets, dbgdrops;
+      if( FPDKCOM_IC_StopExecution(comfd, &dbgbytes, &dbgpackets, &dbgdrops) )
+      {
         printf("\nIC stopped\n");
+        verbose_printf("Debug output: %u bytes in %u packets, %u bytes dropped\n", dbgbytes, dbgpackets, dbgdrops);
+      }
+
+      if( outerr<0 )
+        return -2;
     }
     break;
 
@@ -33,40 +33,234 @@ static const char FPDK_VERSCAN[] = "FREE-PDK EASY PROG - HW:%f SW:%f PROTO:%f\n"
 #define FPDKCOM_CMDRSP_ERASE_TIMEOUT        1000
 #define FPDKCOM_CMDRSP_WRITE_TIMEOUT        2000
 #define FPDKCOM_CMDRSP_CALIBRATEIC_TIMEOUT  3000
+#define FPDKCOM_CMDRSP_CHARACTERIZE_TIMEOUT 3000                                                   //restarts with every received sample
+#define FPDKCOM_CMDRSP_ABORT_TIMEOUT        500
 
-static bool _FPDKCOM_SendCommand(const int fd, const FPDKPROTO_CMD cmd, const uint8_t* dat, const uint8_t len)
+#define FPDKCOM_PROGRESS_POLL_INTERVAL      100
+
+static FPDKCOM_PROGRESSCB _progresscb = 0;
+
+static FPDKCOM_CHARACTERIZECB _characterizecb = 0;
+static void*                  _characterizectx = 0;
+
+static int32_t _dbgcredit = -1;                                                                   //debug bytes programmer can accept, -1: no flow control (older firmware)
+
+static struct
+{
+  const uint8_t* dat;
+  uint16_t       woffset;
+  uint16_t       len;
+  uint16_t       pos;
+  uint16_t       inflight;                                                                         //length of chunk sent but not acknowledged yet
+  bool           failed;
+} _upload;
+
+static bool _extframes;                                                                            //programmer accepts extended frames (protocol 1.1)
+
+static uint16_t _FPDKCOM_SetBufChunk(void)                                                         //data bytes per SETBUF frame
+{
+  return (_extframes?FPDKPROTO_EXTFRAME_MAX:(FPDKPROTO_FRAME_MAX-1)) - sizeof(uint16_t);
+}
+
+static bool _FPDKCOM_SendCommand(const int fd, const FPDKPROTO_CMD cmd, const uint8_t* dat, const uint16_t len)
 {
-  uint8_t scmd[2+256] = {cmd,len};
+  uint8_t scmd[FPDKPROTO_EXTFRAME_HDR_SIZE+FPDKPROTO_EXTFRAME_MAX] = {cmd,len};
+  uint16_t hdrlen = 2;
+  if( len>FPDKPROTO_FRAME_MAX )                                                                    //length extension
+  {
+    if( !_extframes || (len>FPDKPROTO_EXTFRAME_MAX) )
+      return false;
+    scmd[0] = FPDKPROTO_CMD_EXTFRAME;
+    scmd[1] = cmd;
+    scmd[2] = len&0xFF;
+    scmd[3] = len>>8;
+    hdrlen = FPDKPROTO_EXTFRAME_HDR_SIZE;
+  }
   if( len )
-    memcpy(&scmd[2], dat, len);
+    memcpy(&scmd[hdrlen], dat, len);
+
+  return( (hdrlen+len) == serialcom_write(fd, scmd, hdrlen+len) );
+}
+
+static void _FPDKCOM_ReceiveProgress(const int fd, const uint32_t plen, const unsigned long timeouttick)
+{
+  uint8_t prg[3*sizeof(uint32_t)];
+  uint32_t rcvlen = 0;
+  for( ;rcvlen<plen; )
+  {
+    uint8_t c;
+    if( sizeof(uint8_t) == serialcom_read(fd, &c, sizeof(uint8_t)) )
+    {
+      if( rcvlen<sizeof(prg) )
+        prg[rcvlen] = c;
+      rcvlen++;
+    }
+    else
+    if( fpdkutil_getTickCount()>timeouttick )
+      return;
+  }
+
+  if( _progresscb && (sizeof(prg) == plen) )
+  {
+    uint32_t phase = prg[0] | (((uint32_t)prg[1])<<8) | (((uint32_t)prg[ 2])<<16) | (((uint32_t)prg[ 3])<<24);
+    uint32_t done  = prg[4] | (((uint32_t)prg[5])<<8) | (((uint32_t)prg[ 6])<<16) | (((uint32_t)prg[ 7])<<24);
+    uint32_t total = prg[8] | (((uint32_t)prg[9])<<8) | (((uint32_t)prg[10])<<16) | (((uint32_t)prg[11])<<24);
+    _progresscb(phase, done, total);
+  }
+}
+
+static void _FPDKCOM_ReceiveCharData(const int fd, const uint32_t plen, const unsigned long timeouttick)
+{
+  uint8_t smp[FPDKPROTO_CHARDAT_SIZE];
+  uint32_t rcvlen = 0;
+  for( ;rcvlen<plen; )
+  {
+    uint8_t c;
+    if( sizeof(uint8_t) == serialcom_read(fd, &c, sizeof(uint8_t)) )
+    {
+      if( rcvlen<sizeof(smp) )
+        smp[rcvlen] = c;
+      rcvlen++;
+    }
+    else
+    if( fpdkutil_getTickCount()>timeouttick )
+      return;
+  }
+
+  if( _characterizecb && (sizeof(smp) == plen) )
+  {
+    uint32_t vdd  = smp[0] | (((uint32_t)smp[1])<<8);
+    uint32_t freq = smp[4] | (((uint32_t)smp[5])<<8) | (((uint32_t)smp[6])<<16) | (((uint32_t)smp[7])<<24);
+    _characterizecb(_characterizectx, vdd, smp[2], freq);
+  }
+}
+
+static void _FPDKCOM_ReceiveBufAck(const int fd, const uint32_t plen, const unsigned long timeouttick)
+{
+  uint8_t ack[2] = {0,FPDKPROTO_BUFACK_ERR};
+  uint32_t rcvlen = 0;
+  for( ;rcvlen<plen; )
+  {
+    uint8_t c;
+    if( sizeof(uint8_t) == serialcom_read(fd, &c, sizeof(uint8_t)) )
+    {
+      if( rcvlen<sizeof(ack) )
+        ack[rcvlen] = c;
+      rcvlen++;
+    }
+    else
+    if( fpdkutil_getTickCount()>timeouttick )
+      break;
+  }
+
+  if( (FPDKPROTO_BUFACK_OK != ack[1]) || (rcvlen<plen) )
+    _upload.failed = true;
+  _upload.pos += _upload.inflight;
+  _upload.inflight = 0;
+}
+
+static void _FPDKCOM_ReceiveDbgCredit(const int fd, const uint32_t plen, const unsigned long timeouttick)
+{
+  uint8_t credit[FPDKPROTO_DBGCREDIT_SIZE] = {0,0};
+  uint32_t rcvlen = 0;
+  for( ;rcvlen<plen; )
+  {
+    uint8_t c;
+    if( sizeof(uint8_t) == serialcom_read(fd, &c, sizeof(uint8_t)) )
+    {
+      if( rcvlen<sizeof(credit) )
+        credit[rcvlen] = c;
+      rcvlen++;
+    }
+    else
+    if( fpdkutil_getTickCount()>timeouttick )
+      break;
+  }
 
-  return( (2+len) == serialcom_write(fd, scmd, 2+len) );
+  if( _dbgcredit>=0 )
+    _dbgcredit += credit[0] | (credit[1]<<8);
+}
+
+static void _FPDKCOM_PumpBufferUpload(const int fd)
+{
+  if( !_upload.dat || _upload.failed || _upload.inflight || (_upload.pos>=_upload.len) )
+    return;
+
+  uint8_t cdata[FPDKPROTO_EXTFRAME_MAX] = { (_upload.pos+_upload.woffset)&0xFF, (_upload.pos+_upload.woffset)>>8 };
+  uint16_t slen = _upload.len-_upload.pos;
+  if( slen>_FPDKCOM_SetBufChunk() )
+    slen = _FPDKCOM_SetBufChunk();
+  memcpy( &cdata[2], _upload.dat+_upload.pos, slen );
+
+  if( _FPDKCOM_SendCommand(fd, FPDKPROTO_CMD_SETBUF, cdata, sizeof(uint16_t)+slen) )
+    _upload.inflight = slen;
+  else
+    _upload.failed = true;
 }
 
 static int _FPDKCOM_ReceiveResponse(const int fd, uint8_t* rsp, const uint32_t len, const uint32_t timeout)
 {
+  if( (len>3) && (timeout>FPDKCOM_CMDRSP_TIMEOUT) )                                                 //long running command: upload queued buffer data meanwhile
+    _FPDKCOM_PumpBufferUpload(fd);
+
   unsigned long timeouttick = fpdkutil_getTickCount() + timeout;
+  unsigned long progresstick = fpdkutil_getTickCount() + FPDKCOM_PROGRESS_POLL_INTERVAL;
   uint32_t rcvlen = 0;
   for( ;rcvlen<len; )
   {
     if( sizeof(uint8_t) == serialcom_read(fd, &rsp[rcvlen], sizeof(uint8_t)) )
     {
       rcvlen++;
+      if( (1 == rcvlen) && (timeouttick < (fpdkutil_getTickCount()+FPDKCOM_CMDRSP_TIMEOUT)) )      //response started: rest follows in next USB packets, don't cut it off
+        timeouttick = fpdkutil_getTickCount() + FPDKCOM_CMDRSP_TIMEOUT;
       if( rcvlen>=3 )
       {
         uint32_t plen = rsp[1] | (((uint32_t)rsp[2])<<8);
+        if( FPDKPROTO_RSP_PROGRESS == rsp[0] )                                                     //progress reports are out of band, never part of a command response
+        {
+          _FPDKCOM_ReceiveProgress(fd, plen, timeouttick);
+          rcvlen = 0;
+          continue;
+        }
+        if( FPDKPROTO_RSP_CHARDAT == rsp[0] )                                                      //characterization sample, programmer is alive: restart timeout
+        {
+          _FPDKCOM_ReceiveCharData(fd, plen, timeouttick);
+          timeouttick = fpdkutil_getTickCount() + timeout;
+          rcvlen = 0;
+          continue;
+        }
+        if( FPDKPROTO_RSP_DBGCREDIT == rsp[0] )                                                    //debug data was transmitted to IC
+        {
+          _FPDKCOM_ReceiveDbgCredit(fd, plen, timeouttick);
+          rcvlen = 0;
+          continue;
+        }
+        if( FPDKPROTO_RSP_BUFACK == rsp[0] )                                                       //buffer upload executed by programmer while command is executing
+        {
+          _FPDKCOM_ReceiveBufAck(fd, plen, timeouttick);
+          if( (len>3) && (timeout>FPDKCOM_CMDRSP_TIMEOUT) )
+            _FPDKCOM_PumpBufferUpload(fd);
+          rcvlen = 0;
+          continue;
+        }
         if( rcvlen>=(3+plen) )
           return rcvlen;
       }
     }
     if( fpdkutil_getTickCount()>timeouttick )
       break;
+
+    if( _progresscb && (timeout>FPDKCOM_PROGRESS_POLL_INTERVAL) && (fpdkutil_getTickCount()>progresstick) )
+    {
+      _FPDKCOM_SendCommand(fd, FPDKPROTO_CMD_GETPROGRESS, 0, 0);                                   //answered by programmer while command is still executing
+      progresstick = fpdkutil_getTickCount() + FPDKCOM_PROGRESS_POLL_INTERVAL;
+    }
   }
   return -1;
 }
 
 static int _FPDKCOM_SendReceiveCommandWithTimeout(const int fd,
-                                                  const FPDKPROTO_CMD cmd, const uint8_t* datin, const uint8_t lenin,
+                                                  const FPDKPROTO_CMD cmd, const uint8_t* datin, const uint16_t lenin,
                                                   uint8_t* datout, const uint16_t lenout,
                                                   const uint32_t timeout
                                                  )
@@ -88,14 +282,36 @@ static int _FPDKCOM_SendReceiveCommandWithTimeout(const int fd,
   if( resplen < 3 )
     return -2;
 
+  if( _upload.inflight )                                                                           //upload chunk was queued behind command, regular ACK follows response
+  {
+    uint8_t ack[3];
+    if( (3 != _FPDKCOM_ReceiveResponse(fd, ack, sizeof(ack), FPDKCOM_CMDRSP_TIMEOUT)) || (FPDKPROTO_RSP_ACK != ack[0]) )
+      _upload.failed = true;
+    _upload.pos += _upload.inflight;
+    _upload.inflight = 0;
+  }
+
   if( FPDKPROTO_RSP_ACK != resp[0] )
     return -3;
 
   return resplen;
 }
 
+static int _FPDKCOM_SendReceiveICCommand(const int fd,
+                                         const FPDKPROTO_CMD cmd, const uint8_t* datin, const uint16_t lenin,
+                                         uint8_t* datout, const uint16_t lenout,
+                                         const uint32_t timeout
+                                        )
+{
+  int r = _FPDKCOM_SendReceiveCommandWithTimeout(fd, cmd, datin, lenin, datout, lenout, timeout);
+  if( -2 == r )
+    FPDKCOM_IC_Abort(fd);                                                                          //no response in time, stop programmer and drop stale response
+
+  return r;
+}
+
 static int _FPDKCOM_SendReceiveCommand(const int fd,
-                                       const FPDKPROTO_CMD cmd, const uint8_t* datin, const uint8_t lenin,
+                                       const FPDKPROTO_CMD cmd, const uint8_t* datin, const uint16_t lenin,
                                        uint8_t* datout, const uint16_t lenout
                                       )
 {
@@ -145,11 +361,13 @@ int FPDKCOM_Open(const char* devname)
     return -2;
   }
 
-  if( __FPDKPROTOF__ != proto )
+  int protov = proto*10+0.5;                                                                       //protocol 1.0 (regular frames only) is still supported
+  if( (protov<10) || (protov>(int)(__FPDKPROTOF__*10+0.5)) )
   {
     serialcom_close(fd);
     return -3;
   }
+  _extframes = (protov>=11);
 
   return fd;
 }
@@ -222,11 +440,11 @@ bool FPDKCOM_SetBuffer(const int fd, const uint16_t woffset, const uint8_t* dat,
 {
   for( uint16_t p=0; p<len; )
   {
-    uint8_t cdata[254] = { (p+woffset)&0xFF, (p+woffset)>>8 };
+    uint8_t cdata[FPDKPROTO_EXTFRAME_MAX] = { (p+woffset)&0xFF, (p+woffset)>>8 };
 
-    uint16_t slen = len;
-    if( slen>(sizeof(cdata)-sizeof(uint16_t)) )
-      slen = sizeof(cdata)-sizeof(uint16_t);
+    uint16_t slen = len-p;
+    if( slen>_FPDKCOM_SetBufChunk() )
+      slen = _FPDKCOM_SetBufChunk();
    
     memcpy( &cdata[2], dat+p, slen );
     
@@ -238,6 +456,39 @@ bool FPDKCOM_SetBuffer(const int fd, const uint16_t woffset, const uint8_t* dat,
   return true;
 }
 
+int FPDKCOM_InitBuffer(const int fd, const uint8_t slot, const uint8_t data_bits, const uint16_t words)
+{
+  uint8_t cdata[] = { slot, data_bits, words&0xFF, words>>8 };
+  uint8_t resp[3+FPDKPROTO_INITBUF_NOSPACE_SIZE];
+  int r = _FPDKCOM_SendReceiveCommand(fd, FPDKPROTO_CMD_INITBUF, cdata, sizeof(cdata), resp, sizeof(resp));
+  if( r>=0 )
+    return 1;
+  if( (-3 == r) && (FPDKPROTO_RSP_ERROR == resp[0]) && (FPDKPROTO_INITBUF_NOSPACE_SIZE == (resp[1] | (resp[2]<<8))) )
+    return 0;                                                                                      //slot does not fit in image memory of programmer
+  return -1;
+}
+
+void FPDKCOM_QueueBufferUpload(const uint16_t woffset, const uint8_t* dat, const uint16_t len)
+{
+  memset( &_upload, 0, sizeof(_upload) );
+  _upload.dat = dat;
+  _upload.woffset = woffset;
+  _upload.len = len;
+}
+
+bool FPDKCOM_FinishBufferUpload(const int fd)
+{
+  if( !_upload.dat )
+    return true;
+
+  bool ok = !_upload.failed;
+  if( ok && (_upload.pos<_upload.len) )
+    ok = FPDKCOM_SetBuffer(fd, _upload.woffset+_upload.pos, _upload.dat+_upload.pos, _upload.len-_upload.pos);
+
+  memset( &_upload, 0, sizeof(_upload) );
+  return ok;
+}
+
 int FPDKCOM_GetBuffer(const int fd, const uint16_t roffset, uint8_t* dat, const uint16_t len)
 {
   uint8_t cdata[] = { roffset&0xFF, roffset>>8, len&0xFF, len>>8 };
@@ -250,10 +501,25 @@ int FPDKCOM_GetBuffer(const int fd, const uint16_t roffset, uint8_t* dat, const
   return(len);
 }
 
+bool FPDKCOM_IC_SetTiming(const int fd, const uint32_t leave_progmode_us, const uint32_t erase_wait_us, const uint32_t write_wait_us,
+                          const uint32_t erase_pulse_us, const uint32_t write_clock_half_us)
+{
+  const uint32_t t[] = { leave_progmode_us, erase_wait_us, write_wait_us, erase_pulse_us, write_clock_half_us };
+  uint8_t dat[FPDKPROTO_TIMING_SIZE];
+  for( uint32_t i=0; i<sizeof(t)/sizeof(uint32_t); i++ )
+  {
+    dat[i*4+0] = t[i];
+    dat[i*4+1] = t[i]>>8;
+    dat[i*4+2] = t[i]>>16;
+    dat[i*4+3] = t[i]>>24;
+  }
+  return( _FPDKCOM_SendReceiveCommand(fd, FPDKPROTO_CMD_SETTIMING, dat, sizeof(dat), 0, 0) > 0 );
+}
+
 int FPDKCOM_IC_Probe(const int fd, float* vpp_found, float* vdd_found, FPDKICTYPE* type)
 {
   uint8_t resp[3+4*sizeof(uint32_t)];
-  if( sizeof(resp) != _FPDKCOM_SendReceiveCommandWithTimeout(fd, FPDKPROTO_CMD_PROBEIC, 0,0, resp, sizeof(resp), FPDKCOM_CMDRSP_PROBEIC_TIMEOUT) )
+  if( sizeof(resp) != _FPDKCOM_SendReceiveICCommand(fd, FPDKPROTO_CMD_PROBEIC, 0,0, resp, sizeof(resp), FPDKCOM_CMDRSP_PROBEIC_TIMEOUT) )
     return -1;
 
   uint32_t icid = resp[3] | (((uint32_t)resp[4])<<8) | (((uint32_t)resp[5])<<16) | (((uint32_t)resp[6])<<24);
@@ -284,7 +550,7 @@ int FPDKCOM_IC_BlankCheck(const int fd,
                     exclude_first_instruction, exclude_start,exclude_start>>8, exclude_end,exclude_end>>8 };
 
   uint8_t resp[3+sizeof(uint16_t)];
-  if( sizeof(resp) != _FPDKCOM_SendReceiveCommandWithTimeout(fd, FPDKPROTO_CMD_BLANKCKIC, dat,sizeof(dat), resp, sizeof(resp), FPDKCOM_CMDRSP_READIC_TIMEOUT) )
+  if( sizeof(resp) != _FPDKCOM_SendReceiveICCommand(fd, FPDKPROTO_CMD_BLANKCKIC, dat,sizeof(dat), resp, sizeof(resp), FPDKCOM_CMDRSP_READIC_TIMEOUT) )
     return -1;
 
   return( resp[3] | (((int)resp[4])<<8) );
@@ -307,7 +573,7 @@ int FPDKCOM_IC_Erase(const int fd,
                     erase_clocks };
 
   uint8_t resp[3+sizeof(uint16_t)];
-  if( sizeof(resp) != _FPDKCOM_SendReceiveCommandWithTimeout(fd, FPDKPROTO_CMD_ERASEIC, dat,sizeof(dat), resp, sizeof(resp), FPDKCOM_CMDRSP_ERASE_TIMEOUT) )
+  if( sizeof(resp) != _FPDKCOM_SendReceiveICCommand(fd, FPDKPROTO_CMD_ERASEIC, dat,sizeof(dat), resp, sizeof(resp), FPDKCOM_CMDRSP_ERASE_TIMEOUT) )
     return -1;
 
   return( resp[3] | (((int)resp[4])<<8) );
@@ -330,7 +596,7 @@ int FPDKCOM_IC_Read(const int fd,
                     count,count>>8 };
 
   uint8_t resp[3+sizeof(uint16_t)];
-  if( sizeof(resp) != _FPDKCOM_SendReceiveCommandWithTimeout(fd, FPDKPROTO_CMD_READIC, dat,sizeof(dat), resp, sizeof(resp), FPDKCOM_CMDRSP_READIC_TIMEOUT) )
+  if( sizeof(resp) != _FPDKCOM_SendReceiveICCommand(fd, FPDKPROTO_CMD_READIC, dat,sizeof(dat), resp, sizeof(resp), FPDKCOM_CMDRSP_READIC_TIMEOUT) )
     return -1;
 
   return( resp[3] | (((int)resp[4])<<8) );
@@ -358,7 +624,7 @@ int FPDKCOM_IC_Write(const int fd,
                     count,count>>8, write_block_size, write_block_clock_groups, write_block_clocks_per_group };
 
   uint8_t resp[3+sizeof(uint16_t)];
-  if( sizeof(resp) != _FPDKCOM_SendReceiveCommandWithTimeout(fd, FPDKPROTO_CMD_WRITEIC, dat,sizeof(dat), resp, sizeof(resp), FPDKCOM_CMDRSP_READIC_TIMEOUT) )
+  if( sizeof(resp) != _FPDKCOM_SendReceiveICCommand(fd, FPDKPROTO_CMD_WRITEIC, dat,sizeof(dat), resp, sizeof(resp), FPDKCOM_CMDRSP_WRITE_TIMEOUT) )
     return -1;
 
   return( resp[3] | (((int)resp[4])<<8) );
@@ -383,39 +649,164 @@ int FPDKCOM_IC_Verify(const int fd,
                     exclude_first_instruction, exclude_start,exclude_start>>8, exclude_end,exclude_end>>8 };
 
   uint8_t resp[3+sizeof(uint16_t)];
-  if( sizeof(resp) != _FPDKCOM_SendReceiveCommandWithTimeout(fd, FPDKPROTO_CMD_VERIFYIC, dat,sizeof(dat), resp, sizeof(resp), FPDKCOM_CMDRSP_READIC_TIMEOUT) )
+  if( sizeof(resp) != _FPDKCOM_SendReceiveICCommand(fd, FPDKPROTO_CMD_VERIFYIC, dat,sizeof(dat), resp, sizeof(resp), FPDKCOM_CMDRSP_READIC_TIMEOUT) )
     return -1;
 
   return( resp[3] | (((int)resp[4])<<8) );
 }
 
 bool FPDKCOM_IC_Calibrate(const int fd, const uint32_t type, const uint32_t vdd, const uint32_t freq, const uint32_t mult,
-                          uint8_t* fcalval, uint32_t* fcalfreq, uint8_t* bgcalval)
+                          uint8_t* fcalval, uint32_t* fcalfreq, uint8_t* bgcalval, uint32_t* measurements)
 {
   uint8_t dat[] = {type,type>>8,type>>16,type>>24, vdd,vdd>>8,vdd>>16,vdd>>24, 
                    freq,freq>>8,freq>>16,freq>>24, mult,mult>>8,mult>>16,mult>>24};
 
   uint8_t resp[3+3*sizeof(uint32_t)];
-  if( sizeof(resp) != _FPDKCOM_SendReceiveCommandWithTimeout(fd, FPDKPROTO_CMD_CALIBRATEIC, (uint8_t*)dat, sizeof(dat), resp, sizeof(resp), FPDKCOM_CMDRSP_CALIBRATEIC_TIMEOUT) )
+  if( sizeof(resp) != _FPDKCOM_SendReceiveICCommand(fd, FPDKPROTO_CMD_CALIBRATEIC, (uint8_t*)dat, sizeof(dat), resp, sizeof(resp), FPDKCOM_CMDRSP_CALIBRATEIC_TIMEOUT) )
     return false;
 
   *fcalval = resp[3];
   *fcalfreq = resp[ 7] | (((uint32_t)resp[ 8])<<8) | (((uint32_t)resp[ 9])<<16) | (((uint32_t)resp[10])<<24);
   *bgcalval = resp[11];
+  if( measurements )
+    *measurements = (resp[3] | (((uint32_t)resp[4])<<8) | (((uint32_t)resp[5])<<16) | (((uint32_t)resp[6])<<24)) >> FPDKPROTO_CALIB_MEASUREMENTS_SHIFT;
+
+  return true;
+}
+
+int FPDKCOM_IC_Characterize(const int fd, const uint32_t type, const uint32_t vdd_first, const uint32_t vdd_last, const uint32_t vdd_step,
+                            const uint32_t mult, const uint8_t trim_first, const uint8_t trim_last,
+                            FPDKCOM_CHARACTERIZECB cb, void* ctx)
+{
+  uint8_t dat[] = {type,type>>8,type>>16,type>>24, vdd_first,vdd_first>>8,vdd_first>>16,vdd_first>>24,
+                   vdd_last,vdd_last>>8,vdd_last>>16,vdd_last>>24, vdd_step,vdd_step>>8,vdd_step>>16,vdd_step>>24,
+                   mult,mult>>8,mult>>16,mult>>24, trim_first,trim_last,0,0};
+
+  _characterizecb = cb;
+  _characterizectx = ctx;
+
+  uint8_t resp[3+sizeof(uint32_t)];
+  int r = _FPDKCOM_SendReceiveICCommand(fd, FPDKPROTO_CMD_CHARACTERIZEIC, (uint8_t*)dat, sizeof(dat), resp, sizeof(resp), FPDKCOM_CMDRSP_CHARACTERIZE_TIMEOUT);
+
+  _characterizecb = 0;
+  _characterizectx = 0;
+
+  if( sizeof(resp) != r )
+    return -1;
+
+  return resp[3] | (((uint32_t)resp[4])<<8) | (((uint32_t)resp[5])<<16) | (((uint32_t)resp[6])<<24);
+}
+
+bool FPDKCOM_IC_GetProgress(const int fd, uint32_t* phase, uint32_t* done, uint32_t* total)
+{
+  if( !_FPDKCOM_SendCommand(fd, FPDKPROTO_CMD_GETPROGRESS, 0, 0) )
+    return false;
+
+  uint8_t resp[3+3*sizeof(uint32_t)];
+  unsigned long timeouttick = fpdkutil_getTickCount() + FPDKCOM_CMDRSP_TIMEOUT;
+  uint32_t rcvlen = 0;
+  for( ;rcvlen<sizeof(resp); )
+  {
+    if( sizeof(uint8_t) == serialcom_read(fd, &resp[rcvlen], sizeof(uint8_t)) )
+      rcvlen++;
+    if( fpdkutil_getTickCount()>timeouttick )
+      return false;
+  }
+
+  if( (FPDKPROTO_RSP_PROGRESS != resp[0]) || ((3*sizeof(uint32_t)) != (resp[1] | (((uint32_t)resp[2])<<8))) )
+    return false;
+
+  *phase = resp[ 3] | (((uint32_t)resp[ 4])<<8) | (((uint32_t)resp[ 5])<<16) | (((uint32_t)resp[ 6])<<24);
+  *done  = resp[ 7] | (((uint32_t)resp[ 8])<<8) | (((uint32_t)resp[ 9])<<16) | (((uint32_t)resp[10])<<24);
+  *total = resp[11] | (((uint32_t)resp[12])<<8) | (((uint32_t)resp[13])<<16) | (((uint32_t)resp[14])<<24);
 
   return true;
 }
 
-bool FPDKCOM_IC_StartExecution(const int fd, const float vdd)
+void FPDKCOM_IC_SetProgressCallback(FPDKCOM_PROGRESSCB cb)
+{
+  _progresscb = cb;
+}
+
+bool FPDKCOM_IC_Abort(const int fd)
+{
+  if( _upload.inflight )                                                                           //ack of upload chunk gets drained, state unknown
+  {
+    _upload.inflight = 0;
+    _upload.failed = true;
+  }
+
+  if( !_FPDKCOM_SendCommand(fd, FPDKPROTO_CMD_ABORTIC, 0, 0) )
+    return false;
+
+  //drain everything (late response of aborted command, debug data, ...) until abort is acknowledged
+  unsigned long timeouttick = fpdkutil_getTickCount() + FPDKCOM_CMDRSP_ABORT_TIMEOUT;
+  uint32_t acklen = strlen(FPDKPROTO_ABORT_ACK);
+  for( ;; )
+  {
+    unsigned long now = fpdkutil_getTickCount();
+    if( now>timeouttick )
+      break;
+
+    uint8_t resp[3+0x1000*sizeof(uint16_t)];
+    int resplen = _FPDKCOM_ReceiveResponse(fd, resp, sizeof(resp), timeouttick-now);
+    if( resplen<3 )
+      break;
+
+    if( (FPDKPROTO_RSP_ACK == resp[0]) && ((3+acklen) == (uint32_t)resplen) && !memcmp(&resp[3], FPDKPROTO_ABORT_ACK, acklen) )
+      return true;
+  }
+  return false;
+}
+
+bool FPDKCOM_IC_StartExecution(const int fd, const float vdd, const uint16_t latency_ms, const uint8_t flags)
 {
   uint32_t vdd_u = vdd*1000;
-  uint8_t dat[] = {vdd_u,vdd_u>>8,vdd_u>>16,vdd_u>>24};
-  return( _FPDKCOM_SendReceiveCommand(fd, FPDKPROTO_CMD_EXECUTEIC, (uint8_t*)dat, sizeof(dat), 0, 0) > 0);
+  uint8_t dat[] = {vdd_u,vdd_u>>8,vdd_u>>16,vdd_u>>24, latency_ms,latency_ms>>8, flags};
+  uint8_t resp[3+FPDKPROTO_DBGCREDIT_SIZE];
+  int r = _FPDKCOM_SendReceiveCommand(fd, FPDKPROTO_CMD_EXECUTEIC, (uint8_t*)dat, sizeof(dat), resp, sizeof(resp));
+  if( r<=0 )
+    return false;
+
+  _dbgcredit = (r >= (int)sizeof(resp)) ? (resp[3] | (resp[4]<<8)) : -1;                           //older firmware: no credit, unlimited
+  return true;
+}
+
+bool FPDKCOM_IC_StopExecution(const int fd, uint32_t* dbgbytes, uint32_t* dbgpackets, uint32_t* dbgdrops)
+{
+  uint8_t resp[3+FPDKPROTO_DBGSTATS_SIZE];
+  int r = _FPDKCOM_SendReceiveCommand(fd, FPDKPROTO_CMD_STOPIC, 0, 0, resp, sizeof(resp));
+  if( r<=0 )
+    return false;
+
+  uint32_t stats[3] = {0,0,0};                                                                     //older firmware sends no statistics
+  if( r >= (int)sizeof(resp) )
+  {
+    for( uint32_t i=0; i<3; i++ )
+      stats[i] = resp[3+i*4] | (resp[4+i*4]<<8) | (resp[5+i*4]<<16) | ((uint32_t)resp[6+i*4]<<24);
+  }
+  if( dbgbytes )   *dbgbytes = stats[0];
+  if( dbgpackets ) *dbgpackets = stats[1];
+  if( dbgdrops )   *dbgdrops = stats[2];
+
+  return true;
 }
 
-bool FPDKCOM_IC_StopExecution(const int fd)
+int FPDKCOM_IC_ReadTrace(const int fd, uint8_t* dat, const uint16_t maxlen, uint32_t* dropped)
 {
-  return( _FPDKCOM_SendReceiveCommand(fd, FPDKPROTO_CMD_STOPIC, 0, 0, 0, 0) > 0 );
+  uint8_t resp[3+sizeof(uint32_t)+FPDKCOM_TRACE_READ_MAX];
+  uint16_t len = (maxlen>FPDKCOM_TRACE_READ_MAX)?FPDKCOM_TRACE_READ_MAX:maxlen;
+  uint8_t req[] = {len, len>>8};
+  int r = _FPDKCOM_SendReceiveCommand(fd, FPDKPROTO_CMD_GETTRACE, req, sizeof(req), resp, 3+sizeof(uint32_t)+len);
+  if( r < (int)(3+sizeof(uint32_t)) )
+    return -1;
+
+  if( dropped )
+    *dropped = resp[3] | (resp[4]<<8) | (resp[5]<<16) | ((uint32_t)resp[6]<<24);
+
+  r -= 3+sizeof(uint32_t);
+  memcpy( dat, &resp[3+sizeof(uint32_t)], r );
+  return r;
 }
 
 int FPDKCOM_IC_ReceiveDebugData(const int fd, uint8_t* dat, const uint8_t len)
@@ -437,7 +828,16 @@ int FPDKCOM_IC_ReceiveDebugData(const int fd, uint8_t* dat, const uint8_t len)
   return resplen-3;
 }
 
-bool FPDKCOM_IC_SendDebugData(const int fd, const uint8_t* dat, const uint8_t len)
+int FPDKCOM_IC_SendDebugData(const int fd, const uint8_t* dat, const uint8_t len)
 {
-  return _FPDKCOM_SendCommand(fd, FPDKPROTO_CMD_DBGDAT, dat, len);
+  uint8_t count = ((_dbgcredit>=0) && (len>_dbgcredit)) ? _dbgcredit : len;
+  if( !count )
+    return 0;
+
+  if( !_FPDKCOM_SendCommand(fd, FPDKPROTO_CMD_DBGDAT, dat, count) )
+    return -1;
+
+  if( _dbgcredit>=0 )
+    _dbgcredit -= count;
+  return count;
 }
@@ -23,6 +23,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "fpdkproto.h"
 #include "fpdkicdata.h"
 
+typedef void (*FPDKCOM_PROGRESSCB)(const uint32_t phase, const uint32_t done, const uint32_t total);
+typedef void (*FPDKCOM_CHARACTERIZECB)(void* ctx, const uint32_t vdd, const uint8_t trim, const uint32_t frequency);
+
 int      FPDKCOM_OpenAuto(char portpath[64]);
 
 int      FPDKCOM_Open(const char* devname);
@@ -43,6 +46,15 @@ bool     FPDKCOM_SetBuffer(const int fd, const uint16_t woffset, const uint8_t*
 
 int      FPDKCOM_GetBuffer(const int fd, const uint16_t roffset, uint8_t* dat, const uint16_t len);
 
+int      FPDKCOM_InitBuffer(const int fd, const uint8_t slot, const uint8_t data_bits, const uint16_t words);  //1: ok, 0: does not fit in image memory, <0: error / not supported
+
+void     FPDKCOM_QueueBufferUpload(const uint16_t woffset, const uint8_t* dat, const uint16_t len);
+
+bool     FPDKCOM_FinishBufferUpload(const int fd);
+
+
+bool     FPDKCOM_IC_SetTiming(const int fd, const uint32_t leave_progmode_us, const uint32_t erase_wait_us, const uint32_t write_wait_us,
+                              const uint32_t erase_pulse_us, const uint32_t write_clock_half_us);
 
 int      FPDKCOM_IC_Probe(const int fd, float* vpp_found, float* vdd_found, FPDKICTYPE* type);
 
@@ -77,16 +89,30 @@ int      FPDKCOM_IC_Verify(const int fd, const uint16_t icid, const FPDKICTYPE t
 
 
 bool     FPDKCOM_IC_Calibrate(const int fd, const uint32_t type, const uint32_t vdd, const uint32_t freq, const uint32_t mult, 
-                              uint8_t* fcalval, uint32_t* fcalfreq, uint8_t* bgcalval);
+                              uint8_t* fcalval, uint32_t* fcalfreq, uint8_t* bgcalval, uint32_t* measurements);
+
+int      FPDKCOM_IC_Characterize(const int fd, const uint32_t type, const uint32_t vdd_first, const uint32_t vdd_last, const uint32_t vdd_step,
+                                 const uint32_t mult, const uint8_t trim_first, const uint8_t trim_last,
+                                 FPDKCOM_CHARACTERIZECB cb, void* ctx);
 
 
-bool     FPDKCOM_IC_StartExecution(const int fd, const float vdd);
+bool     FPDKCOM_IC_GetProgress(const int fd, uint32_t* phase, uint32_t* done, uint32_t* total);
 
-bool     FPDKCOM_IC_StopExecution(const int fd);
+void     FPDKCOM_IC_SetProgressCallback(FPDKCOM_PROGRESSCB cb);
+
+bool     FPDKCOM_IC_Abort(const int fd);
+
+
+bool     FPDKCOM_IC_StartExecution(const int fd, const float vdd, const uint16_t latency_ms, const uint8_t flags);
+
+bool     FPDKCOM_IC_StopExecution(const int fd, uint32_t* dbgbytes, uint32_t* dbgpackets, uint32_t* dbgdrops);
 
 
 int      FPDKCOM_IC_ReceiveDebugData(const int fd, uint8_t* dat, const uint8_t len);
 
-bool     FPDKCOM_IC_SendDebugData(const int fd, const uint8_t* dat, const uint8_t len);
+int      FPDKCOM_IC_SendDebugData(const int fd, const uint8_t* dat, const uint8_t len);            //returns bytes sent (limited by programmer credit)
+
+#define FPDKCOM_TRACE_READ_MAX 4096
+int      FPDKCOM_IC_ReadTrace(const int fd, uint8_t* dat, const uint16_t maxlen, uint32_t* dropped); //returns raw trace records read from programmer ring
 
 #endif //__FPDKCOM_H_
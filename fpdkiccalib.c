@@ -17,7 +17,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "fpdkiccalib.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
 #define FPDKCALIBCP_MAXWORDS 32
+#define FPDKCALIB_MAX_ALGOS  255                                                                   //algo index is passed as uint8_t
+
+#define FPDKCALIB_CACHE_MAGIC "FPDKCAL1"
+#define FPDKCALIB_CACHE_EXT   ".cache"
 
 #define CO_REPL        0x8000
 #define CO_IGNR        0x4000
@@ -55,7 +64,7 @@ typedef struct FPDKCALIBALGO
 } FPDKCALIBALGO;
 
 
-static const FPDKCALIBALGO fpdk_calib_algos[] = { 
+static const FPDKCALIBALGO fpdk_calib_algos_builtin[] = { 
  {
   .type=FPDKCALIB_IHRC,
   .codebits=14,
@@ -124,6 +133,9 @@ static const FPDKCALIBALGO fpdk_calib_algos[] = {
 
 };
 
+static const FPDKCALIBALGO* fpdk_calib_algos = fpdk_calib_algos_builtin;                            //built in algorithms + loaded ones appended
+static uint16_t             fpdk_calib_algos_count = sizeof(fpdk_calib_algos_builtin)/sizeof(FPDKCALIBALGO);
+
 static uint16_t _FPDKCALIB_GetAlgoLength(const FPDKCALIBCP* algo)
 {
   uint16_t algowords;
@@ -135,96 +147,336 @@ static uint16_t _FPDKCALIB_GetAlgoLength(const FPDKCALIBCP* algo)
   return algowords;
 }
 
-static uint16_t _FPDKCALIB_FindPattern(const uint16_t* code, const uint16_t codewords, const FPDKCALIBCP* algo)
+static bool _FPDKCALIB_MatchPattern(const uint16_t* code, const FPDKCALIBCP* algo, const uint16_t algowords)
+{
+  for( uint16_t m=1; m<algowords; m++ )                                                            //first opcode was matched by index already
+  {
+    if( (code[m] & algo[m].smsk) != algo[m].sopc )
+      return false;
+  }
+  return true;
+}
+
+static void _FPDKCALIB_ExtractValues(const uint16_t* code, const FPDKCALIBCP* algo, const uint16_t algowords, uint32_t* frequency, uint32_t* millivolt)
 {
-  uint16_t algowords = _FPDKCALIB_GetAlgoLength(algo);
-  for( uint16_t p=0; p<codewords-algowords; p++ )
+  *frequency = 0;
+  *millivolt = 0;
+  for( uint16_t x=0; x<algowords; x++ )
   {
-    bool match = true;
-    for( uint16_t m=0; m<algowords; m++ )
+    switch(algo[x].cocf & 0xFF)
     {
-      if( (code[p+m] & algo[m].smsk) != algo[m].sopc )
-      {
-        match = false;
+      case CO_VAL_FREQ_00: *frequency |= ((uint32_t)(code[x]&0xFF))<< 0; break;
+      case CO_VAL_FREQ_08: *frequency |= ((uint32_t)(code[x]&0xFF))<< 8; break;
+      case CO_VAL_FREQ_16: *frequency |= ((uint32_t)(code[x]&0xFF))<<16; break;
+      case CO_VAL_FREQ_24: *frequency |= ((uint32_t)(code[x]&0xFF))<<24; break;
+      case CO_VAL_MVOL_00: *millivolt  |= ((uint32_t)(code[x]&0xFF))<< 0; break;
+      case CO_VAL_MVOL_08: *millivolt  |= ((uint32_t)(code[x]&0xFF))<< 8; break;
+      default:
         break;
-      }
     }
-    if( match )
-      return p;
   }
-  return 0xFFFF;
 }
 
-bool FPDKCALIB_InsertCalibration(const FPDKICDATA* icdata, uint8_t* code, const uint16_t len, uint32_t* frequency, uint32_t* millivolt, FPDKCALIBTYPE* type, uint8_t* algo, uint32_t* loopcycles, uint16_t* pos)
+uint16_t FPDKCALIB_InsertCalibrations(const FPDKICDATA* icdata, uint8_t* code, const uint16_t len, FPDKCALIBSITE* sites, const uint16_t maxsites)
 {
   uint16_t* code16 = (uint16_t*)code;
   uint16_t  len16 = len/2;
 
-  *pos = 0xFFFF;
+  //index of all algorithms for this IC by first opcode (signature 'H' / 'L'), 64 bit filter on low opcode bits rejects most code words
+  uint8_t  cand[FPDKCALIB_MAX_ALGOS];
+  uint16_t candwords[FPDKCALIB_MAX_ALGOS];
+  uint8_t  candcount = 0;
+  uint64_t filter = 0;
+  for( uint16_t a=0; a<fpdk_calib_algos_count; a++ )
+  {
+    if( fpdk_calib_algos[a].codebits != icdata->codebits )
+      continue;
+
+    const FPDKCALIBCP* first = &fpdk_calib_algos[a].algo[0];
+    if( 0x3F == (first->smsk & 0x3F) )
+      filter |= 1ULL<<(first->sopc & 0x3F);
+    else
+      filter = ~0ULL;
+
+    cand[candcount] = a;
+    candwords[candcount] = _FPDKCALIB_GetAlgoLength(fpdk_calib_algos[a].algo);
+    candcount++;
+  }
 
-  //serach pattern
-  for( uint8_t p=0; p<sizeof(fpdk_calib_algos)/sizeof(FPDKCALIBALGO); p++ )
+  //single pass over image for all algorithms, every site is reported (patterns can not overlap)
+  uint16_t found = 0;
+  for( uint16_t p=0; (p<len16) && (found<maxsites); p++ )
   {
-    if( fpdk_calib_algos[p].codebits == icdata->codebits )
+    if( !(filter & (1ULL<<(code16[p] & 0x3F))) )
+      continue;
+
+    for( uint8_t c=0; c<candcount; c++ )
     {
-      *pos = _FPDKCALIB_FindPattern(code16, len16, fpdk_calib_algos[p].algo);
-      if( 0xFFFF != *pos )
+      const FPDKCALIBALGO* calgo = &fpdk_calib_algos[cand[c]];
+      uint16_t algowords = candwords[c];
+      if( ((code16[p] & calgo->algo[0].smsk) != calgo->algo[0].sopc) || ((p+algowords)>len16) || !_FPDKCALIB_MatchPattern(&code16[p], calgo->algo, algowords) )
+        continue;
+
+      FPDKCALIBSITE* site = &sites[found++];
+      site->type = calgo->type;
+      site->algo = cand[c];
+      site->loopcycles = calgo->loopcycles;
+      site->pos = p;
+      _FPDKCALIB_ExtractValues(&code16[p], calgo->algo, algowords, &site->frequency, &site->millivolt);
+
+      //insert calibration code + fixup, remember after calibration actions (site does not depend on loaded algorithm table)
+      site->words = algowords;
+      site->ac_setimm = 0;
+      site->ac_nop = 0;
+      for( uint16_t i=0; i<algowords; i++ )
       {
-        *type = fpdk_calib_algos[p].type;
-        *loopcycles = fpdk_calib_algos[p].loopcycles;
-        *algo = p;
-        break;
+        if( calgo->algo[i].cocf & CO_AC_SETIMM )
+          site->ac_setimm |= 1UL<<i;
+        if( calgo->algo[i].cocf & CO_AC_NOP )
+          site->ac_nop |= 1UL<<i;
+        code16[p+i] = calgo->algo[i].copc;
+        if( calgo->algo[i].cocf & CO_BC_FIXUP )
+          code16[p+i] += p;
       }
+
+      p += algowords-1;
+      break;
     }
   }
-  if( 0xFFFF == *pos )
-    return false;
 
-  uint16_t algowords = _FPDKCALIB_GetAlgoLength(fpdk_calib_algos[*algo].algo);
+  return found;
+}
 
-  //extract mvolt and freq
-  *frequency = 0;
-  *millivolt = 0;
-  for( uint16_t x=0; x<algowords; x++ )
+bool FPDKCALIB_RemoveCalibration(const FPDKCALIBSITE* site, uint8_t* code, const uint8_t val)
+{
+  uint16_t* code16 = (uint16_t*)code;
+  uint16_t  pos = site->pos;
+
+  for( uint16_t p=0; p<site->words; p++ )
   {
-    switch(fpdk_calib_algos[*algo].algo[x].cocf & 0xFF)
-    {
-      case CO_VAL_FREQ_00: *frequency |= ((uint32_t)(code16[*pos+x]&0xFF))<< 0; break;
-      case CO_VAL_FREQ_08: *frequency |= ((uint32_t)(code16[*pos+x]&0xFF))<< 8; break;
-      case CO_VAL_FREQ_16: *frequency |= ((uint32_t)(code16[*pos+x]&0xFF))<<16; break;
-      case CO_VAL_FREQ_24: *frequency |= ((uint32_t)(code16[*pos+x]&0xFF))<<24; break;
-      case CO_VAL_MVOL_00: *millivolt  |= ((uint32_t)(code16[*pos+x]&0xFF))<< 0; break;
-      case CO_VAL_MVOL_08: *millivolt  |= ((uint32_t)(code16[*pos+x]&0xFF))<< 8; break;
-      default:
-        break;
-    }
+    if( site->ac_setimm & (1UL<<p) )                          //set val ?
+      code16[pos+p] = (code16[pos+p]&0xFF00) | val;            //place val in immediate value of opcode
+
+    if( site->ac_nop & (1UL<<p) )                             //replace with NOP?
+      code16[pos+p] = 0;                                       //replace opcode with NOP
   }
 
-  //insert calibration code + fixup
-  for( uint16_t i=0; i<algowords; i++ )
+  return true;
+}
+
+
+////
+//////// calibration algorithm descriptor files
+////
+
+typedef struct FPDKCALIBNAME
+{
+  const char* name;
+  uint16_t    val;
+
+} FPDKCALIBNAME;
+
+static const FPDKCALIBNAME _fpdk_calib_typenames[] = {
+  {"IHRC",FPDKCALIB_IHRC}, {"ILRC",FPDKCALIB_ILRC}, {"BG",FPDKCALIB_BG}, {"IHRC_BG",FPDKCALIB_IHRC_BG}, {"ILRC_BG",FPDKCALIB_ILRC_BG}, {0,0}
+};
+
+static const FPDKCALIBNAME _fpdk_calib_flagnames[] = {
+  {"REPL",CO_REPL}, {"IGNR",CO_IGNR}, {"BC_FIXUP",CO_BC_FIXUP}, {"AC_SETIMM",CO_AC_SETIMM}, {"AC_NOP",CO_AC_NOP},
+  {"FREQ_00",CO_VAL_FREQ_00}, {"FREQ_08",CO_VAL_FREQ_08}, {"FREQ_16",CO_VAL_FREQ_16}, {"FREQ_24",CO_VAL_FREQ_24},
+  {"MVOL_00",CO_VAL_MVOL_00}, {"MVOL_08",CO_VAL_MVOL_08}, {0,0}
+};
+
+typedef struct FPDKCALIBCACHEHDR
+{
+  char     magic[8];
+  uint32_t algosize;                                                                               //sizeof(FPDKCALIBALGO), cache is only valid for same build layout
+  uint32_t srcsize;
+  int64_t  srcmtime;
+  uint32_t count;
+
+} FPDKCALIBCACHEHDR;
+
+static bool _FPDKCALIB_LookupName(const FPDKCALIBNAME* names, const char* name, uint16_t* val)
+{
+  for( ; names->name; names++ )
   {
-    code16[*pos+i] = fpdk_calib_algos[*algo].algo[i].copc;
-    if( fpdk_calib_algos[*algo].algo[i].cocf & CO_BC_FIXUP )
-      code16[*pos+i] += *pos;
+    if( !strcmp(names->name, name) )
+    {
+      *val = names->val;
+      return true;
+    }
   }
+  return false;
+}
 
+static bool _FPDKCALIB_ParseHex16(const char* str, uint16_t* val)
+{
+  char* end;
+  unsigned long v = strtoul(str, &end, 16);
+  if( !*str || *end || (v>0xFFFF) )
+    return false;
+  *val = v;
   return true;
 }
 
-bool FPDKCALIB_RemoveCalibration(const uint8_t algo, uint8_t* code, const uint16_t pos, const uint8_t val)
+//descriptor format (one algorithm per block, '#' starts a comment):
+//  algo <IHRC|ILRC|IHRC_BG|ILRC_BG> <codebits> <loopcycles>   (BG is not tuned by programmer: _BG types calibrate frequency only, BG only returns -3)
+//    <sopc> <smsk> <copc> <FLAG|FLAG|...>      (hex opcodes, flags: REPL IGNR BC_FIXUP AC_SETIMM AC_NOP FREQ_xx MVOL_xx)
+//  end
+static int _FPDKCALIB_ParseFile(FILE* fin, FPDKCALIBALGO* algos, const uint16_t maxalgos)
 {
-  uint16_t* code16 = (uint16_t*)code;
+  char line[256];
+  int count = 0;
+  FPDKCALIBALGO* cur = 0;
+  uint16_t words = 0;
 
-  uint16_t algowords = _FPDKCALIB_GetAlgoLength(fpdk_calib_algos[algo].algo);
-  for( uint16_t p=0; p<algowords; p++ )
+  while( fgets(line, sizeof(line), fin) )
   {
-    if( fpdk_calib_algos[algo].algo[p].cocf & CO_AC_SETIMM )   //set val ?
-      code16[pos+p] = (code16[pos+p]&0xFF00) | val;            //place val in immediate value of opcode
+    char* comment = strchr(line, '#');
+    if( comment )
+      *comment = 0;
+
+    char* tok[5];
+    int ntok = 0;
+    for( char* t=strtok(line, " \t\r\n"); t && (ntok<5); t=strtok(0, " \t\r\n") )
+      tok[ntok++] = t;
+    if( !ntok )
+      continue;
+
+    if( !strcmp(tok[0], "algo") )
+    {
+      uint16_t type;
+      if( cur || (4 != ntok) || (count>=maxalgos) || !_FPDKCALIB_LookupName(_fpdk_calib_typenames, tok[1], &type) )
+        return -2;
+      if( FPDKCALIB_BG == type )
+        return -3;
+      cur = &algos[count];
+      memset(cur, 0, sizeof(FPDKCALIBALGO));
+      cur->type = type;
+      cur->codebits = atoi(tok[2]);
+      cur->loopcycles = atoi(tok[3]);
+      words = 0;
+      if( (cur->codebits<13) || (cur->codebits>16) || !cur->loopcycles )
+        return -2;
+    }
+    else
+    if( !strcmp(tok[0], "end") )
+    {
+      if( !cur || !words )
+        return -2;
+      cur = 0;
+      count++;
+    }
+    else
+    {
+      if( !cur || (4 != ntok) || (words>=FPDKCALIBCP_MAXWORDS) )
+        return -2;
 
-    if( fpdk_calib_algos[algo].algo[p].cocf & CO_AC_NOP )      //replace with NOP?
-      code16[pos+p] = 0;                                       //replace opcode with NOP
+      FPDKCALIBCP* cp = &cur->algo[words];
+      if( !_FPDKCALIB_ParseHex16(tok[0], &cp->sopc) || !_FPDKCALIB_ParseHex16(tok[1], &cp->smsk) || !_FPDKCALIB_ParseHex16(tok[2], &cp->copc) )
+        return -2;
+
+      for( char* f=strtok(tok[3], "|"); f; f=strtok(0, "|") )
+      {
+        uint16_t flag;
+        if( !_FPDKCALIB_LookupName(_fpdk_calib_flagnames, f, &flag) )
+          return -2;
+        cp->cocf |= flag;
+      }
+      if( !cp->cocf )                                                                              //zero flags terminate an algorithm
+        return -2;
+      words++;
+    }
   }
 
-  return true;
+  if( cur )
+    return -2;
+
+  return count;
+}
+
+static int _FPDKCALIB_ReadCache(const char* cachename, const struct stat* src, FPDKCALIBALGO* algos, const uint16_t maxalgos)
+{
+  FILE* fc = fopen(cachename, "rb");
+  if( !fc )
+    return -1;
+
+  FPDKCALIBCACHEHDR hdr;
+  int count = -1;
+  if( (1 == fread(&hdr, sizeof(hdr), 1, fc)) &&
+      !memcmp(hdr.magic, FPDKCALIB_CACHE_MAGIC, sizeof(hdr.magic)) && (sizeof(FPDKCALIBALGO) == hdr.algosize) &&
+      (src->st_size == hdr.srcsize) && (src->st_mtime == hdr.srcmtime) && (hdr.count<=maxalgos) &&
+      (hdr.count == fread(algos, sizeof(FPDKCALIBALGO), hdr.count, fc)) )
+  {
+    count = hdr.count;
+    for( uint32_t i=0; i<hdr.count; i++ )
+      if( FPDKCALIB_BG == algos[i].type )                                                          //cache of older build: parse descriptor again
+        count = -1;
+  }
+
+  fclose(fc);
+  return count;
+}
+
+static void _FPDKCALIB_WriteCache(const char* cachename, const struct stat* src, const FPDKCALIBALGO* algos, const uint16_t count)
+{
+  FILE* fc = fopen(cachename, "wb");
+  if( !fc )
+    return;                                                                                        //no cache, descriptor is parsed next time again
+
+  FPDKCALIBCACHEHDR hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, FPDKCALIB_CACHE_MAGIC, sizeof(hdr.magic));
+  hdr.algosize = sizeof(FPDKCALIBALGO);
+  hdr.srcsize = src->st_size;
+  hdr.srcmtime = src->st_mtime;
+  hdr.count = count;
+
+  bool ok = (1 == fwrite(&hdr, sizeof(hdr), 1, fc)) && (count == fwrite(algos, sizeof(FPDKCALIBALGO), count, fc));
+  fclose(fc);
+  if( !ok )
+    remove(cachename);
 }
 
+int FPDKCALIB_LoadAlgorithms(const char* filename)
+{
+  struct stat src;
+  if( stat(filename, &src) )
+    return -1;
+
+  uint16_t builtin = sizeof(fpdk_calib_algos_builtin)/sizeof(FPDKCALIBALGO);
+  uint16_t maxalgos = FPDKCALIB_MAX_ALGOS - builtin;
+  FPDKCALIBALGO* algos = malloc(FPDKCALIB_MAX_ALGOS*sizeof(FPDKCALIBALGO));
+  if( !algos )
+    return -1;
+  memcpy(algos, fpdk_calib_algos_builtin, sizeof(fpdk_calib_algos_builtin));
+
+  char cachename[1024];
+  snprintf(cachename, sizeof(cachename), "%s" FPDKCALIB_CACHE_EXT, filename);
+
+  int count = _FPDKCALIB_ReadCache(cachename, &src, &algos[builtin], maxalgos);
+  if( count<0 )
+  {
+    FILE* fin = fopen(filename, "r");
+    if( !fin )
+    {
+      free(algos);
+      return -1;
+    }
+    count = _FPDKCALIB_ParseFile(fin, &algos[builtin], maxalgos);
+    fclose(fin);
+    if( count<0 )
+    {
+      free(algos);
+      return count;
+    }
+    _FPDKCALIB_WriteCache(cachename, &src, &algos[builtin], count);
+  }
+
+  if( fpdk_calib_algos != fpdk_calib_algos_builtin )
+    free((void*)fpdk_calib_algos);
+  fpdk_calib_algos = algos;
+  fpdk_calib_algos_count = builtin + count;
+
+  return count;
+}
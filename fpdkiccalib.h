@@ -32,8 +32,26 @@ typedef enum FPDKCALIBTYPE
 
 } FPDKCALIBTYPE;
 
-bool FPDKCALIB_InsertCalibration(const FPDKICDATA* icdata, uint8_t* code, const uint16_t len, uint32_t* frequency, uint32_t* millivolt, FPDKCALIBTYPE* type, uint8_t* algo, uint32_t* loopcycles, uint16_t* pos);
-bool FPDKCALIB_RemoveCalibration(const uint8_t algo, uint8_t* code, const uint16_t pos, const uint8_t val);
+#define FPDKCALIB_MAX_SITES 8
+
+typedef struct FPDKCALIBSITE
+{
+  FPDKCALIBTYPE type;
+  uint8_t       algo;
+  uint32_t      loopcycles;
+  uint16_t      pos;
+  uint32_t      frequency;
+  uint32_t      millivolt;
+  uint16_t      words;                                                                             //length of calibration code
+  uint32_t      ac_setimm;                                                                         //words getting calibration value after calibration (bit mask)
+  uint32_t      ac_nop;                                                                            //words replaced with NOP after calibration (bit mask)
+
+} FPDKCALIBSITE;
+
+int      FPDKCALIB_LoadAlgorithms(const char* filename);
+
+uint16_t FPDKCALIB_InsertCalibrations(const FPDKICDATA* icdata, uint8_t* code, const uint16_t len, FPDKCALIBSITE* sites, const uint16_t maxsites);
+bool FPDKCALIB_RemoveCalibration(const FPDKCALIBSITE* site, uint8_t* code, const uint8_t val);
 
 
 #endif //__FPDKICCALIB_H__
@@ -16,8 +16,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "fpdkicdata.h"
 #include <strings.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 
-static const FPDKICDATA fpdk_ic_table[] =
+#define FPDKICDATA_CACHE_MAGIC "FPDKICD1"
+#define FPDKICDATA_CACHE_EXT   ".cache"
+
+static const FPDKICDATA fpdk_ic_table_builtin[] =
 {
   { .name                         = "PMS150C",
     .otpid                        = 0x2A16,
@@ -38,6 +46,11 @@ static const FPDKICDATA fpdk_ic_table[] =
     .write_block_size             = 2,
     .write_block_clock_groups     = 1,
     .write_block_clocks_per_group = 8,
+    .leave_progmode_us            = 10000,
+    .erase_wait_us                = 0,
+    .write_wait_us                = 100000,
+    .erase_pulse_us               = 0,
+    .write_clock_half_us          = 30
   },
 
   { .name                         = "PMS154B",
@@ -61,6 +74,11 @@ static const FPDKICDATA fpdk_ic_table[] =
     .write_block_size             = 2,
     .write_block_clock_groups     = 1,
     .write_block_clocks_per_group = 8,
+    .leave_progmode_us            = 10000,
+    .erase_wait_us                = 0,
+    .write_wait_us                = 100000,
+    .erase_pulse_us               = 0,
+    .write_clock_half_us          = 30
   },
 
   { .name                         = "PFS154",
@@ -86,7 +104,12 @@ static const FPDKICDATA fpdk_ic_table[] =
     .vpp_cmd_erase                = 5.5, //5.0
     .vdd_erase_hv                 = 3.0,
     .vpp_erase_hv                 = 9.0,
-    .erase_clocks                 = 2
+    .erase_clocks                 = 2,
+    .leave_progmode_us            = 10000,
+    .erase_wait_us                = 100000,
+    .write_wait_us                = 100000,
+    .erase_pulse_us               = 5000,
+    .write_clock_half_us          = 15
   },
 
   { .name                         = "PFS173",
@@ -112,29 +135,114 @@ static const FPDKICDATA fpdk_ic_table[] =
     .vpp_cmd_erase                = 5.5, //5.0
     .vdd_erase_hv                 = 3.0,
     .vpp_erase_hv                 = 9.0,
-    .erase_clocks                 = 4
+    .erase_clocks                 = 4,
+    .leave_progmode_us            = 10000,
+    .erase_wait_us                = 100000,
+    .write_wait_us                = 100000,
+    .erase_pulse_us               = 5000,
+    .write_clock_half_us          = 15
   },
 };
 
-FPDKICDATA* FPDKICDATA_GetICDataById12Bit(const uint16_t id12bit)
+#define FPDKICDATA_MAX_ICS     256
+#define FPDKICDATA_NAME_SLOTS  1024                                                                 //power of 2, >= 4*(3 names per IC)
+
+static const FPDKICDATA* fpdk_ic_table = fpdk_ic_table_builtin;                                    //built in ICs overlaid by loaded ones
+static uint16_t          fpdk_ic_table_count = sizeof(fpdk_ic_table_builtin)/sizeof(FPDKICDATA);
+
+static bool     _icdb_init = false;
+static uint16_t _icdb_byid[FPDKICDATA_MAX_ICS];                                                    //table indices sorted by id12bit (stable)
+static uint16_t _icdb_count;
+static uint16_t _icdb_names[FPDKICDATA_NAME_SLOTS];                                                //open addressing, table index+1 (0: empty)
+
+static uint32_t _FPDKICDATA_HashName(const char* name)
+{
+  uint32_t h = 2166136261UL;                                                                       //FNV-1a, case insensitive
+  for( ; *name; name++ )
+    h = (h ^ (uint8_t)tolower((uint8_t)*name)) * 16777619UL;
+  return h;
+}
+
+static void _FPDKICDATA_AddName(const char* name, const uint16_t idx)
 {
-  unsigned int i;
-  for( i=0; i<(sizeof(fpdk_ic_table)/sizeof(FPDKICDATA)); i++ )
+  if( !name[0] )
+    return;
+
+  for( uint32_t slot = _FPDKICDATA_HashName(name); ; slot++ )
   {
-    if( (id12bit&0xFFF) == (fpdk_ic_table[i].id12bit) )
-      return (FPDKICDATA*)&fpdk_ic_table[i];
+    uint16_t* e = &_icdb_names[slot & (FPDKICDATA_NAME_SLOTS-1)];
+    if( !*e )
+    {
+      *e = idx+1;
+      return;
+    }
+
+    const FPDKICDATA* ic = &fpdk_ic_table[*e-1];
+    if( !strcasecmp(name, ic->name) || !strcasecmp(name, ic->name_variant_1) || !strcasecmp(name, ic->name_variant_2) )
+      return;                                                                                      //first table entry wins
   }
+}
+
+static void _FPDKICDATA_BuildIndex(void)
+{
+  if( _icdb_init )
+    return;
+
+  _icdb_count = 0;
+  memset(_icdb_names, 0, sizeof(_icdb_names));
+
+  for( uint16_t i=0; (i<fpdk_ic_table_count) && (i<FPDKICDATA_MAX_ICS); i++ )
+  {
+    uint16_t p = _icdb_count++;                                                                    //insertion sort, keeps table order for same id
+    while( p && (fpdk_ic_table[_icdb_byid[p-1]].id12bit > fpdk_ic_table[i].id12bit) )
+    {
+      _icdb_byid[p] = _icdb_byid[p-1];
+      p--;
+    }
+    _icdb_byid[p] = i;
+
+    _FPDKICDATA_AddName(fpdk_ic_table[i].name, i);
+    _FPDKICDATA_AddName(fpdk_ic_table[i].name_variant_1, i);
+    _FPDKICDATA_AddName(fpdk_ic_table[i].name_variant_2, i);
+  }
+
+  _icdb_init = true;
+}
+
+static uint16_t _FPDKICDATA_LowerBoundId(const uint16_t id12bit)
+{
+  uint16_t lo = 0, hi = _icdb_count;
+  while( lo < hi )
+  {
+    uint16_t mid = (lo+hi)/2;
+    if( fpdk_ic_table[_icdb_byid[mid]].id12bit < id12bit )
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+FPDKICDATA* FPDKICDATA_GetICDataById12Bit(const uint16_t id12bit)
+{
+  _FPDKICDATA_BuildIndex();
+
+  uint16_t p = _FPDKICDATA_LowerBoundId(id12bit&0xFFF);
+  if( (p < _icdb_count) && ((id12bit&0xFFF) == fpdk_ic_table[_icdb_byid[p]].id12bit) )
+    return (FPDKICDATA*)&fpdk_ic_table[_icdb_byid[p]];
 
   return 0;
 }
 
 static FPDKICDATA* _FPDKICDATA_GetICDataById12BitAndCodebits(const uint16_t id12bit, const uint8_t codebits)
 {
-  unsigned int i;
-  for( i=0; i<(sizeof(fpdk_ic_table)/sizeof(FPDKICDATA)); i++ )
+  for( uint16_t p = _FPDKICDATA_LowerBoundId(id12bit&0xFFF); p < _icdb_count; p++ )
   {
-    if( ((id12bit&0xFFF) == (fpdk_ic_table[i].id12bit)) && (codebits == fpdk_ic_table[i].codebits) )
-      return (FPDKICDATA*)&fpdk_ic_table[i];
+    const FPDKICDATA* ic = &fpdk_ic_table[_icdb_byid[p]];
+    if( (id12bit&0xFFF) != ic->id12bit )
+      break;
+    if( codebits == ic->codebits )
+      return (FPDKICDATA*)ic;
   }
 
   return 0;
@@ -142,6 +250,8 @@ static FPDKICDATA* _FPDKICDATA_GetICDataById12BitAndCodebits(const uint16_t id12
 
 FPDKICDATA* FPDKICDATA_GetICDataForOTPByCmdResponse(const uint32_t cmdrsp)
 {
+  _FPDKICDATA_BuildIndex();
+
   FPDKICDATA* icdata = _FPDKICDATA_GetICDataById12BitAndCodebits(cmdrsp, 16); //try as 16 codebits words
   if( !icdata ) 
     icdata = _FPDKICDATA_GetICDataById12BitAndCodebits(cmdrsp>>2, 15);        //try as 15 codebits words
@@ -155,19 +265,348 @@ FPDKICDATA* FPDKICDATA_GetICDataForOTPByCmdResponse(const uint32_t cmdrsp)
 
 FPDKICDATA* FPDKICDATA_GetICDataByName(const char* name)
 {
-  unsigned int i;
-  for( i=0; i<(sizeof(fpdk_ic_table)/sizeof(FPDKICDATA)); i++ )
+  _FPDKICDATA_BuildIndex();
+
+  if( !name[0] )
+    return 0;
+
+  for( uint32_t slot = _FPDKICDATA_HashName(name); ; slot++ )
   {
-    if( 0 == strcasecmp(name, fpdk_ic_table[i].name) )
-      return (FPDKICDATA*)&fpdk_ic_table[i];
+    uint16_t e = _icdb_names[slot & (FPDKICDATA_NAME_SLOTS-1)];
+    if( !e )
+      return 0;
+
+    const FPDKICDATA* ic = &fpdk_ic_table[e-1];
+    if( !strcasecmp(name, ic->name) || !strcasecmp(name, ic->name_variant_1) || !strcasecmp(name, ic->name_variant_2) )
+      return (FPDKICDATA*)ic;
+  }
+}
+
+FPDKICDATA* FPDKICDATA_GetNext(unsigned int* iter)
+{
+  _FPDKICDATA_BuildIndex();
+
+  if( *iter >= _icdb_count )
+    return 0;
+
+  return (FPDKICDATA*)&fpdk_ic_table[_icdb_byid[(*iter)++]];
+}
+
 
-    if( 0 == strcasecmp(name, fpdk_ic_table[i].name_variant_1) )
-      return (FPDKICDATA*)&fpdk_ic_table[i];
+////
+//////// IC definition files
+////
 
-    if( 0 == strcasecmp(name, fpdk_ic_table[i].name_variant_2) )
-      return (FPDKICDATA*)&fpdk_ic_table[i];
+typedef enum FPDKICFIELDKIND
+{
+  FPDKICFIELD_STR,
+  FPDKICFIELD_TYPE,
+  FPDKICFIELD_BOOL,
+  FPDKICFIELD_U8,
+  FPDKICFIELD_U16,
+  FPDKICFIELD_U32,
+  FPDKICFIELD_FLOAT,
+
+} FPDKICFIELDKIND;
+
+typedef struct FPDKICFIELD
+{
+  const char*     name;
+  FPDKICFIELDKIND kind;
+  size_t          offset;
+
+} FPDKICFIELD;
+
+#define FPDKICFIELD_DEF(n,k) {#n, k, offsetof(FPDKICDATA,n)}
+
+static const FPDKICFIELD _fpdk_ic_fields[] = {
+  FPDKICFIELD_DEF(name_variant_1,               FPDKICFIELD_STR),
+  FPDKICFIELD_DEF(name_variant_2,               FPDKICFIELD_STR),
+  FPDKICFIELD_DEF(id12bit,                      FPDKICFIELD_U16),
+  FPDKICFIELD_DEF(otpid,                        FPDKICFIELD_U16),
+  FPDKICFIELD_DEF(type,                         FPDKICFIELD_TYPE),
+  FPDKICFIELD_DEF(addressbits,                  FPDKICFIELD_U8),
+  FPDKICFIELD_DEF(codebits,                     FPDKICFIELD_U8),
+  FPDKICFIELD_DEF(codewords,                    FPDKICFIELD_U16),
+  FPDKICFIELD_DEF(ramsize,                      FPDKICFIELD_U16),
+  FPDKICFIELD_DEF(exclude_code_first_instr,     FPDKICFIELD_BOOL),
+  FPDKICFIELD_DEF(exclude_code_start,           FPDKICFIELD_U16),
+  FPDKICFIELD_DEF(exclude_code_end,             FPDKICFIELD_U16),
+  FPDKICFIELD_DEF(vdd_cmd_read,                 FPDKICFIELD_FLOAT),
+  FPDKICFIELD_DEF(vpp_cmd_read,                 FPDKICFIELD_FLOAT),
+  FPDKICFIELD_DEF(vdd_cmd_write,                FPDKICFIELD_FLOAT),
+  FPDKICFIELD_DEF(vpp_cmd_write,                FPDKICFIELD_FLOAT),
+  FPDKICFIELD_DEF(vdd_write_hv,                 FPDKICFIELD_FLOAT),
+  FPDKICFIELD_DEF(vpp_write_hv,                 FPDKICFIELD_FLOAT),
+  FPDKICFIELD_DEF(write_block_size,             FPDKICFIELD_U8),
+  FPDKICFIELD_DEF(write_block_clock_groups,     FPDKICFIELD_U8),
+  FPDKICFIELD_DEF(write_block_clocks_per_group, FPDKICFIELD_U8),
+  FPDKICFIELD_DEF(vdd_cmd_erase,                FPDKICFIELD_FLOAT),
+  FPDKICFIELD_DEF(vpp_cmd_erase,                FPDKICFIELD_FLOAT),
+  FPDKICFIELD_DEF(vdd_erase_hv,                 FPDKICFIELD_FLOAT),
+  FPDKICFIELD_DEF(vpp_erase_hv,                 FPDKICFIELD_FLOAT),
+  FPDKICFIELD_DEF(erase_clocks,                 FPDKICFIELD_U8),
+  FPDKICFIELD_DEF(leave_progmode_us,            FPDKICFIELD_U32),
+  FPDKICFIELD_DEF(erase_wait_us,                FPDKICFIELD_U32),
+  FPDKICFIELD_DEF(write_wait_us,                FPDKICFIELD_U32),
+  FPDKICFIELD_DEF(erase_pulse_us,               FPDKICFIELD_U32),
+  FPDKICFIELD_DEF(write_clock_half_us,          FPDKICFIELD_U32),
+  {0,0,0}
+};
+
+typedef struct FPDKICDATACACHEHDR
+{
+  char     magic[8];
+  uint32_t icsize;                                                                                 //sizeof(FPDKICDATA), cache is only valid for same build layout
+  uint32_t count;                                                                                  //ICs in merged table
+  uint32_t loaded;                                                                                 //records in definition file
+  uint64_t srchash;
+
+} FPDKICDATACACHEHDR;
+
+static uint64_t _FPDKICDATA_HashBuffer(const uint8_t* buf, const size_t len)
+{
+  uint64_t h = 14695981039346656037ULL;                                                            //FNV-1a 64
+  for( size_t i=0; i<len; i++ )
+    h = (h ^ buf[i]) * 1099511628211ULL;
+  return h;
+}
+
+static bool _FPDKICDATA_SetField(FPDKICDATA* ic, const FPDKICFIELD* f, const char* val)
+{
+  void* dst = ((uint8_t*)ic) + f->offset;
+  char* end;
+
+  switch( f->kind )
+  {
+    case FPDKICFIELD_STR:
+      if( strlen(val) >= sizeof(ic->name) )
+        return false;
+      strcpy((char*)dst, val);
+      return true;
+
+    case FPDKICFIELD_TYPE:
+      if( !strcasecmp(val,"OTP1") )       *(FPDKICTYPE*)dst = FPDK_IC_OTP1;
+      else if( !strcasecmp(val,"OTP2") )  *(FPDKICTYPE*)dst = FPDK_IC_OTP2;
+      else if( !strcasecmp(val,"FLASH") ) *(FPDKICTYPE*)dst = FPDK_IC_FLASH;
+      else return false;
+      return true;
+
+    case FPDKICFIELD_FLOAT:
+    {
+      float v = strtof(val, &end);
+      if( *end || (v<0) )
+        return false;
+      *(float*)dst = v;
+      return true;
+    }
+
+    default:
+    {
+      unsigned long v = strtoul(val, &end, 0);
+      if( *end || (v > ((FPDKICFIELD_U32==f->kind)?0xFFFFFFFFUL:(FPDKICFIELD_U16==f->kind)?0xFFFF:((FPDKICFIELD_U8==f->kind)?0xFF:1))) )
+        return false;
+      if( FPDKICFIELD_U32 == f->kind )     *(uint32_t*)dst = v;
+      else if( FPDKICFIELD_U16 == f->kind ) *(uint16_t*)dst = v;
+      else if( FPDKICFIELD_U8 == f->kind ) *(uint8_t*)dst = v;
+      else                                 *(bool*)dst = v;
+      return true;
+    }
   }
+}
 
-  return 0;
+static bool _FPDKICDATA_Validate(const FPDKICDATA* ic)
+{
+  const float vdd[] = { ic->vdd_cmd_read, ic->vdd_cmd_write, ic->vdd_write_hv, ic->vdd_cmd_erase, ic->vdd_erase_hv };
+  const float vpp[] = { ic->vpp_cmd_read, ic->vpp_cmd_write, ic->vpp_write_hv, ic->vpp_cmd_erase, ic->vpp_erase_hv };
+  for( unsigned int i=0; i<sizeof(vdd)/sizeof(float); i++ )
+  {
+    if( (vdd[i] > 6.2) || (vpp[i] > 13.2) )                                                       //programmer DAC limits
+      return false;
+  }
+
+  return ic->name[0] && ic->id12bit && (ic->id12bit<=0xFFF) &&
+         ((FPDK_IC_OTP1==ic->type) || (FPDK_IC_OTP2==ic->type) || (FPDK_IC_FLASH==ic->type)) &&
+         (ic->codebits>=13) && (ic->codebits<=16) && (ic->addressbits<=13) &&
+         ic->codewords && (ic->codewords <= (1U<<ic->addressbits)) && (ic->codewords <= 0xC00) &&
+         (ic->exclude_code_start <= ic->exclude_code_end) && (ic->exclude_code_end <= ic->codewords) &&
+         ic->write_block_size && ic->write_block_clock_groups && ic->write_block_clocks_per_group &&
+         ((FPDK_IC_FLASH!=ic->type) || (ic->erase_clocks && (0 != ic->vdd_erase_hv))) &&
+         (ic->leave_progmode_us <= 1000000) && (ic->erase_wait_us <= 1000000) && (ic->write_wait_us <= 1000000) &&    //firmware timing limits
+         (ic->erase_pulse_us <= 50000) && (ic->write_clock_half_us <= 1000);
 }
 
+//definition format ('#' starts a comment):
+//  ic <NAME>                       (existing IC with same name is used as base and replaced, otherwise a new IC is added)
+//    <field> <value>               (field names as in FPDKICDATA, type: OTP1|OTP2|FLASH, integers dec or 0x hex)
+//  end
+static int _FPDKICDATA_ParseBuffer(char* buf, FPDKICDATA* table, uint16_t* count)
+{
+  FPDKICDATA* cur = 0;
+  int loaded = 0;
+
+  for( char* line = buf; line; )
+  {
+    char* next = strchr(line, '\n');
+    if( next )
+      *next++ = 0;
+
+    char* comment = strchr(line, '#');
+    if( comment )
+      *comment = 0;
+
+    char* tok[3];
+    int ntok = 0;
+    for( char* t=strtok(line, " \t\r"); t && (ntok<3); t=strtok(0, " \t\r") )
+      tok[ntok++] = t;
+    line = next;
+    if( !ntok )
+      continue;
+
+    if( !strcmp(tok[0], "ic") )
+    {
+      if( cur || (2 != ntok) || (strlen(tok[1]) >= sizeof(cur->name)) )
+        return -2;
+
+      uint16_t i;
+      for( i=0; (i<*count) && strcasecmp(tok[1], table[i].name); i++ )
+        ;
+      if( i == *count )
+      {
+        if( *count >= FPDKICDATA_MAX_ICS )
+          return -2;
+        memset(&table[i], 0, sizeof(FPDKICDATA));
+        strcpy(table[i].name, tok[1]);
+        (*count)++;
+      }
+      cur = &table[i];
+    }
+    else
+    if( !strcmp(tok[0], "end") )
+    {
+      if( !cur || (1 != ntok) || !_FPDKICDATA_Validate(cur) )
+        return -2;
+      cur = 0;
+      loaded++;
+    }
+    else
+    {
+      const FPDKICFIELD* f;
+      for( f=_fpdk_ic_fields; f->name && strcmp(f->name, tok[0]); f++ )
+        ;
+      if( !cur || (2 != ntok) || !f->name || !_FPDKICDATA_SetField(cur, f, tok[1]) )
+        return -2;
+    }
+  }
+
+  if( cur )
+    return -2;
+
+  return loaded;
+}
+
+static int _FPDKICDATA_ReadCache(const char* cachename, const uint64_t srchash, FPDKICDATA* table, uint16_t* count)
+{
+  FILE* fc = fopen(cachename, "rb");
+  if( !fc )
+    return -1;
+
+  FPDKICDATACACHEHDR hdr;
+  int loaded = -1;
+  if( (1 == fread(&hdr, sizeof(hdr), 1, fc)) &&
+      !memcmp(hdr.magic, FPDKICDATA_CACHE_MAGIC, sizeof(hdr.magic)) && (sizeof(FPDKICDATA) == hdr.icsize) &&
+      (srchash == hdr.srchash) && (hdr.count<=FPDKICDATA_MAX_ICS) &&
+      (hdr.count == fread(table, sizeof(FPDKICDATA), hdr.count, fc)) )
+  {
+    loaded = hdr.loaded;
+    *count = hdr.count;
+  }
+
+  fclose(fc);
+  return loaded;
+}
+
+static void _FPDKICDATA_WriteCache(const char* cachename, const uint64_t srchash, const FPDKICDATA* table, const uint16_t count, const int loaded)
+{
+  FILE* fc = fopen(cachename, "wb");
+  if( !fc )
+    return;                                                                                        //no cache, definitions are parsed next time again
+
+  FPDKICDATACACHEHDR hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, FPDKICDATA_CACHE_MAGIC, sizeof(hdr.magic));
+  hdr.icsize = sizeof(FPDKICDATA);
+  hdr.count = count;
+  hdr.loaded = loaded;
+  hdr.srchash = srchash;
+
+  bool ok = (1 == fwrite(&hdr, sizeof(hdr), 1, fc)) && (count == fwrite(table, sizeof(FPDKICDATA), count, fc));
+  fclose(fc);
+  if( !ok )
+    remove(cachename);
+}
+
+int FPDKICDATA_LoadDefinitions(const char* filename)
+{
+  FILE* fin = fopen(filename, "rb");
+  if( !fin )
+    return -1;
+
+  char* buf = 0;
+  size_t len = 0;
+  for( ;; )
+  {
+    char* nbuf = realloc(buf, len+4096+1);
+    if( !nbuf )
+    {
+      free(buf);
+      fclose(fin);
+      return -1;
+    }
+    buf = nbuf;
+    size_t r = fread(&buf[len], 1, 4096, fin);
+    len += r;
+    if( r < 4096 )
+      break;
+  }
+  fclose(fin);
+  buf[len] = 0;
+
+  FPDKICDATA* table = malloc(FPDKICDATA_MAX_ICS*sizeof(FPDKICDATA));
+  if( !table )
+  {
+    free(buf);
+    return -1;
+  }
+
+  //the cache holds the complete merged table, it is only valid for the definition file content with the same built in table
+  uint64_t srchash = _FPDKICDATA_HashBuffer((const uint8_t*)buf, len) ^ _FPDKICDATA_HashBuffer((const uint8_t*)fpdk_ic_table_builtin, sizeof(fpdk_ic_table_builtin));
+
+  char cachename[1024];
+  snprintf(cachename, sizeof(cachename), "%s" FPDKICDATA_CACHE_EXT, filename);
+
+  uint16_t count = 0;
+  int loaded = _FPDKICDATA_ReadCache(cachename, srchash, table, &count);
+  if( loaded<0 )
+  {
+    count = sizeof(fpdk_ic_table_builtin)/sizeof(FPDKICDATA);
+    memcpy(table, fpdk_ic_table_builtin, sizeof(fpdk_ic_table_builtin));
+    loaded = _FPDKICDATA_ParseBuffer(buf, table, &count);
+    if( loaded<0 )
+    {
+      free(buf);
+      free(table);
+      return loaded;
+    }
+    _FPDKICDATA_WriteCache(cachename, srchash, table, count, loaded);
+  }
+  free(buf);
+
+  if( fpdk_ic_table != fpdk_ic_table_builtin )
+    free((void*)fpdk_ic_table);
+  fpdk_ic_table = table;
+  fpdk_ic_table_count = count;
+  _icdb_init = false;                                                                              //rebuild index
+
+  return loaded;
+}
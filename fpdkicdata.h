@@ -56,11 +56,19 @@ typedef struct FPDKICDATA
   float      vdd_erase_hv;
   float      vpp_erase_hv;
   uint8_t    erase_clocks;
+  uint32_t   leave_progmode_us;                                                                    //timing profile (us), 0 = programmer default
+  uint32_t   erase_wait_us;
+  uint32_t   write_wait_us;
+  uint32_t   erase_pulse_us;
+  uint32_t   write_clock_half_us;
 
 } FPDKICDATA;
 
 FPDKICDATA* FPDKICDATA_GetICDataById12Bit(const uint16_t id12bit);
 FPDKICDATA* FPDKICDATA_GetICDataForOTPByCmdResponse(const uint32_t cmdrsp);
 FPDKICDATA* FPDKICDATA_GetICDataByName(const char* name);
+int         FPDKICDATA_LoadDefinitions(const char* filename);                                         //overlay built in ICs, returns number of records loaded
+
+FPDKICDATA* FPDKICDATA_GetNext(unsigned int* iter);                                                //*iter=0 to start, ordered by id, NULL at end
 
 #endif //__FPDKICDATA_H_
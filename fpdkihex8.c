@@ -22,136 +22,188 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <string.h>
 
-static bool _X2UI8(const char* str, uint8_t* out)
+//hex digit value + 1 (0: no hex digit)
+static const uint8_t _FPDKIHEX8_HEXVAL[256] = {
+  ['0']= 1, ['1']= 2, ['2']= 3, ['3']= 4, ['4']= 5, ['5']= 6, ['6']= 7, ['7']= 8, ['8']= 9, ['9']=10,
+  ['A']=11, ['B']=12, ['C']=13, ['D']=14, ['E']=15, ['F']=16,
+  ['a']=11, ['b']=12, ['c']=13, ['d']=14, ['e']=15, ['f']=16,
+};
+
+static inline bool _FPDKIHEX8_GetByte(const uint8_t* p, uint8_t* out)
 {
-  char tmp[] = {str[0],str[1],0};
-  unsigned int r;
-  if( 1 != sscanf(tmp, "%x", &r) )
-    return false;
-  *out = r;
-  return true;
+  uint8_t h = _FPDKIHEX8_HEXVAL[p[0]];
+  uint8_t l = _FPDKIHEX8_HEXVAL[p[1]];
+  *out = ((uint8_t)(h-1)<<4) | (uint8_t)(l-1);                                                     //no digit: garbage, caller checks return
+  return h && l;
+}
+
+static const char _FPDKIHEX8_NIBBLE[16] = { '0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F' };
+
+#define FPDKIHEX8_RECORD_BYTES 32
+#define FPDKIHEX8_OUTBUF_SIZE  0x4000
+
+static inline char* _FPDKIHEX8_PutByte(char* out, const uint8_t val)
+{
+  out[0] = _FPDKIHEX8_NIBBLE[val>>4];
+  out[1] = _FPDKIHEX8_NIBBLE[val&0x0F];
+  return out+2;
 }
 
-static bool _FPDKIHEX8_ParseLine(const char* line, uint8_t* type, uint16_t* address, uint8_t* data, uint8_t* datcount)
+//format one record at out, returns end of record
+static char* _FPDKIHEX8_CreateLine(char* out, const uint8_t type, const uint16_t address, const uint8_t* data, const uint8_t datcount)
 {
-  uint8_t addrl, addrh;
-  if( (strlen(line)<9) || (':' != line[0]) ||
-      !_X2UI8(&line[1], datcount) || !_X2UI8(&line[3], &addrh) || !_X2UI8(&line[5], &addrl) || !_X2UI8(&line[7], type) )
-    return false;
-  *address = (((uint16_t)addrh)<<8) | addrl;
-
-  uint8_t check;
-  if( (strlen(line)<(9+2*(*datcount))) || !_X2UI8(&line[9+2*(*datcount)], &check) )
-    return false;
-  check += (*datcount) + addrl + addrh + (*type);
-
-  for( uint8_t p=0; p<(*datcount); p++ )
+  uint8_t check = datcount + address + (address>>8) + type;
+  *out++ = ':';
+  out = _FPDKIHEX8_PutByte(out, datcount);
+  out = _FPDKIHEX8_PutByte(out, address>>8);
+  out = _FPDKIHEX8_PutByte(out, address);
+  out = _FPDKIHEX8_PutByte(out, type);
+  for( uint8_t p=0; p<datcount; p++ )
   {
-    if( !_X2UI8(&line[9+2*p], &data[p]) )
-      return false;
+    out = _FPDKIHEX8_PutByte(out, data[p]);
     check += data[p];
   }
-  return( 0 == check );
+  out = _FPDKIHEX8_PutByte(out, -check);
+  *out++ = '\n';
+  return out;
 }
 
-static int _FPDKIHEX8_CreateLine(const uint8_t type, const uint16_t address, const uint8_t* data, const uint8_t datcount, char lineout[600])
+static bool _FPDKIHEX8_IsBlank(const uint8_t* data, const uint8_t datcount, const uint16_t blankword)
 {
-  sprintf(lineout, ":%02X%04X%02X", datcount, address, type);
-  uint8_t check = datcount + address + (address>>8) + type;
-  char tmp[4];
   for( uint8_t p=0; p<datcount; p++ )
   {
-    sprintf(tmp, "%02X", data[p]);
-    strcat(lineout, tmp);
-    check += data[p];
+    if( data[p] != ((p&1)?(blankword>>8):(blankword&0xFF)) )
+      return false;
   }
-  check = -check;
-  sprintf(tmp,"%02X\n", check);
-  strcat(lineout, tmp);
-  return strlen(lineout);
+  return true;
 }
 
-int FPDKIHEX8_ReadFile(const char* filename, uint16_t* datout, const uint16_t datcount)
+int FPDKIHEX8_ParseBuffer(const char* buf, const size_t buflen, uint16_t* datout, const uint16_t datcount)
 {
   memset(datout, 0, sizeof(uint16_t)*datcount);
 
-  FILE *fin = fopen(filename, "r");
-  if( !fin )
-    return -1;
-
-  bool berr = false;
-//  char *line = 0;
-//  size_t len = 0;
-//  while( getline(&line, &len, fin)>0 )
-  char line[600];
-  while( NULL != fgets(line, sizeof(line), fin) )
+  const uint8_t* p = (const uint8_t*)buf;
+  const uint8_t* end = p + buflen;
+  uint32_t base = 0;                                                                               //extended segment / linear address
+  for( ;; )
   {
-    uint8_t tmp[256];
-    uint8_t type;
-    uint16_t address;
-    uint8_t count;
-    if( !_FPDKIHEX8_ParseLine(line, &type, &address, tmp, &count) || (type>1) )
+    if( p>=end )
+      return 0;                                                                                    //no end of file record, all records read
+    if( ':' != *p++ )                                                                              //every line is a record (no blank lines)
+      return -2;
+
+    //record: count(1) address(2) type(1) data(count) checksum(1), all bytes as 2 hex digits
+    uint8_t count, addrh, addrl, type;
+    if( ((end-p)<8) || !_FPDKIHEX8_GetByte(&p[0], &count) || !_FPDKIHEX8_GetByte(&p[2], &addrh) ||
+        !_FPDKIHEX8_GetByte(&p[4], &addrl) || !_FPDKIHEX8_GetByte(&p[6], &type) )
+      return -2;
+    p += 8;
+
+    //types: 0 data, 1 end of file, 2 extended segment address, 3 start segment address, 4 extended linear address, 5 start linear address
+    if( ((end-p)<(2*count+2)) || (type>5) || (((2 == type) || (4 == type)) && (2 != count)) )
+      return -2;
+
+    uint32_t address = base + ((((uint16_t)addrh)<<8) | addrl);
+    if( (0 == type) && ((address+count) > datcount) )
+      return -2;
+
+    uint8_t check = count + addrh + addrl + type;
+    uint16_t ext = 0;
+    for( uint8_t i=0; i<count; i++, p+=2 )
     {
-      berr = true;
-      break;
+      uint8_t d;
+      if( !_FPDKIHEX8_GetByte(p, &d) )
+        return -2;
+      check += d;
+      ext = (ext<<8) | d;
+      if( 0 == type )
+        datout[address+i] = 0x100 + d;
     }
+    if( 2 == type )
+      base = ((uint32_t)ext)<<4;
+    if( 4 == type )
+      base = ((uint32_t)ext)<<16;
+
+    uint8_t c;
+    if( !_FPDKIHEX8_GetByte(p, &c) || (0 != (uint8_t)(check+c)) )
+      return -2;
+    p += 2;
 
     if( 1 == type )
-      break;
+      return 0;
+
+    while( (p<end) && ('\n'!=*p++) )                                                               //ignore rest of line including line end
+      ;
+  }
+}
+
+int FPDKIHEX8_ReadFile(const char* filename, uint16_t* datout, const uint16_t datcount)
+{
+  memset(datout, 0, sizeof(uint16_t)*datcount);
+
+  FILE *fin = fopen(filename, "rb");
+  if( !fin )
+    return -1;
 
-    if( (address+count) > datcount )
+  //complete file is buffered and parsed in a single pass
+  char* buf = 0;
+  size_t len = 0, size = 0;
+  for( ;; )
+  {
+    if( len == size )
     {
-      berr = true;
-      break;
+      size = size?(2*size):0x10000;
+      char* nbuf = realloc(buf, size);
+      if( !nbuf )
+      {
+        free(buf);
+        buf = 0;
+        break;
+      }
+      buf = nbuf;
     }
-
-    for( uint8_t p=0; p<count; p++ )
-      datout[address+p] = 0x100 + tmp[p];
+    size_t r = fread(&buf[len], 1, size-len, fin);
+    if( !r )
+      break;
+    len += r;
   }
 
-//  if( line )
-//    free(line);
-
+  bool berr = ferror(fin) || !buf;
   fclose(fin);
 
-  if( berr )
-    return -2;
+  int ret = berr?-1:FPDKIHEX8_ParseBuffer(buf, len, datout, datcount);
+  free(buf);
 
-  return 0;
+  return ret;
 }
 
-int FPDKIHEX8_WriteFile(const char* filename, const uint8_t* datin, const uint16_t datlen)
+int FPDKIHEX8_WriteFile(const char* filename, const uint8_t* datin, const uint16_t datlen, const uint16_t blankword)
 {
   FILE *fout = fopen(filename, "w");
   if( !fout )
     return -1;
 
+  //records are formatted into one buffer which is written when full (max record: 1+2*(4+255+1)+1 chars)
+  static char outbuf[FPDKIHEX8_OUTBUF_SIZE];
+  char* out = outbuf;
   bool berr = false;
-  char line[600];
-  uint8_t data[256];
-  uint16_t lineitems = 0;
-  uint16_t lineaddr = 0;
 
-  for( uint16_t p=0; p<datlen; p++ )
+  for( uint32_t p=0; (p<datlen) && !berr; p+=FPDKIHEX8_RECORD_BYTES )
   {
-    data[lineitems] = datin[p];
-    lineitems++;
+    uint8_t count = ((datlen-p)>FPDKIHEX8_RECORD_BYTES)?FPDKIHEX8_RECORD_BYTES:(datlen-p);
+    if( blankword && _FPDKIHEX8_IsBlank(&datin[p], count, blankword) )                             //all words blank (records start at even address)
+      continue;
 
-    if( lineitems>=32 )
+    out = _FPDKIHEX8_CreateLine(out, 0, p, &datin[p], count);
+    if( (out-outbuf) > (FPDKIHEX8_OUTBUF_SIZE-600) )
     {
-      int linelength = _FPDKIHEX8_CreateLine(0, lineaddr, data, lineitems, line);
-      if( linelength != fwrite(line, 1, linelength, fout) )
-      {
-        berr = true;
-        break;
-      }
-      lineaddr += lineitems;
-      lineitems = 0;
+      berr = ((size_t)(out-outbuf) != fwrite(outbuf, 1, out-outbuf, fout));
+      out = outbuf;
     }
   }
-  
-  int linelength = _FPDKIHEX8_CreateLine(1, 0, NULL, 0, line);
-  if( linelength != fwrite(line, 1, linelength, fout) )
+
+  out = _FPDKIHEX8_CreateLine(out, 1, 0, NULL, 0);
+  if( (size_t)(out-outbuf) != fwrite(outbuf, 1, out-outbuf, fout) )
     berr = true;
 
   fclose(fout);
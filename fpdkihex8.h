@@ -18,8 +18,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define __FPDKIHEX8_H_
 
 #include <stdint.h>
+#include <stddef.h>
 
+int FPDKIHEX8_ParseBuffer(const char* buf, const size_t buflen, uint16_t* datout, const uint16_t datcount);
 int FPDKIHEX8_ReadFile(const char* filename, uint16_t* datout, const uint16_t datlen);
-int FPDKIHEX8_WriteFile(const char* filename, const uint8_t* datin, const uint16_t datlen);
+int FPDKIHEX8_WriteFile(const char* filename, const uint8_t* datin, const uint16_t datlen, const uint16_t blankword);
 
 #endif //__FPDKIHEX8_H_
@@ -0,0 +1,386 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "fpdkimage.h"
+#include "fpdkihex8.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct FPDKIMAGELOADER
+{
+  const char* name;
+  bool        (*probe)(const uint8_t* buf, const size_t len);
+  int         (*load)(const uint8_t* buf, const size_t len, FPDKIMAGE* img);
+
+} FPDKIMAGELOADER;
+
+////
+//////// Intel HEX (incl. extended segment / linear address records)
+////
+
+static bool _FPDKIMAGE_ProbeIHex(const uint8_t* buf, const size_t len)
+{
+  return( len && (':' == buf[0]) );
+}
+
+static int _FPDKIMAGE_LoadIHex(const uint8_t* buf, const size_t len, FPDKIMAGE* img)
+{
+  if( img->datcount>0xFFFF )
+    return -2;
+  return FPDKIHEX8_ParseBuffer((const char*)buf, len, img->data, img->datcount);
+}
+
+////
+//////// Motorola S-record (S1/S2/S3 data, S0/S5/S6 ignored, S7/S8/S9 end)
+////
+
+static int _FPDKIMAGE_HexByte(const uint8_t* p)
+{
+  int v = 0;
+  for( int i=0; i<2; i++ )
+  {
+    uint8_t c = p[i];
+    v <<= 4;
+    if( (c>='0') && (c<='9') )
+      v |= c-'0';
+    else
+    if( (c>='A') && (c<='F') )
+      v |= c-'A'+10;
+    else
+    if( (c>='a') && (c<='f') )
+      v |= c-'a'+10;
+    else
+      return -1;
+  }
+  return v;
+}
+
+static bool _FPDKIMAGE_ProbeSRec(const uint8_t* buf, const size_t len)
+{
+  return( (len>=2) && ('S' == buf[0]) && (buf[1]>='0') && (buf[1]<='9') );
+}
+
+static int _FPDKIMAGE_LoadSRec(const uint8_t* buf, const size_t len, FPDKIMAGE* img)
+{
+  const uint8_t* p = buf;
+  const uint8_t* end = buf + len;
+  for( ;; )
+  {
+    while( (p<end) && ((' '==*p) || ('\t'==*p) || ('\r'==*p) || ('\n'==*p)) )
+      p++;
+    if( (p>=end) || ((end-p)<4) || ('S' != p[0]) )
+      return -2;                                                                                   //no termination record
+
+    uint8_t type = p[1]-'0';
+    int count = _FPDKIMAGE_HexByte(&p[2]);
+    if( (type>9) || (4 == type) || (count<3) || ((end-p)<(4+2*count)) )
+      return -2;
+    p += 4;
+
+    uint8_t addrbytes = ((1==type)||(9==type)||(0==type)||(5==type))?2:(((2==type)||(8==type)||(6==type))?3:4);
+
+    uint8_t check = count;
+    uint32_t address = 0;
+    for( int i=0; i<count-1; i++, p+=2 )
+    {
+      int d = _FPDKIMAGE_HexByte(p);
+      if( d<0 )
+        return -2;
+      check += d;
+      if( i<addrbytes )
+        address = (address<<8) | d;
+      else
+      if( (type>=1) && (type<=3) )
+      {
+        uint32_t a = address + (i-addrbytes);
+        if( a>=img->datcount )
+          return -2;
+        img->data[a] = 0x100 + d;
+      }
+    }
+
+    int c = _FPDKIMAGE_HexByte(p);
+    if( (c<0) || (0xFF != (uint8_t)(check+c)) )                                                     //one's complement checksum
+      return -2;
+    p += 2;
+
+    if( type>=7 )
+      return 0;
+
+    while( (p<end) && ('\n'!=*p) )
+      p++;
+  }
+}
+
+////
+//////// ELF32 little endian (SDCC sdld output): PT_LOAD segments or SHF_ALLOC sections, symbols from SHT_SYMTAB
+////
+
+#define ELF_PT_LOAD      1
+#define ELF_SHT_PROGBITS 1
+#define ELF_SHT_SYMTAB   2
+#define ELF_SHF_ALLOC    2
+
+static uint32_t _FPDKIMAGE_Rd16(const uint8_t* p) { return p[0] | (((uint32_t)p[1])<<8); }
+static uint32_t _FPDKIMAGE_Rd32(const uint8_t* p) { return p[0] | (((uint32_t)p[1])<<8) | (((uint32_t)p[2])<<16) | (((uint32_t)p[3])<<24); }
+
+static bool _FPDKIMAGE_ProbeElf(const uint8_t* buf, const size_t len)
+{
+  return( (len>=52) && !memcmp(buf, "\x7F" "ELF", 4) );
+}
+
+static int _FPDKIMAGE_ElfCopy(const uint8_t* buf, const size_t len, FPDKIMAGE* img, const uint32_t offs, const uint32_t size, const uint32_t addr)
+{
+  if( ((uint64_t)offs+size > len) || ((uint64_t)addr+size > img->datcount) )
+    return -2;
+  for( uint32_t i=0; i<size; i++ )
+    img->data[addr+i] = 0x100 + buf[offs+i];
+  return 0;
+}
+
+static void _FPDKIMAGE_ElfSymbols(const uint8_t* buf, const size_t len, FPDKIMAGE* img, const uint32_t shoff, const uint32_t shentsize, const uint32_t shnum)
+{
+  for( uint32_t s=0; s<shnum; s++ )
+  {
+    const uint8_t* sh = &buf[shoff + s*shentsize];
+    if( ELF_SHT_SYMTAB != _FPDKIMAGE_Rd32(&sh[4]) )
+      continue;
+
+    uint32_t symoff = _FPDKIMAGE_Rd32(&sh[16]);
+    uint32_t symsize = _FPDKIMAGE_Rd32(&sh[20]);
+    uint32_t strndx = _FPDKIMAGE_Rd32(&sh[24]);
+    if( (strndx>=shnum) || ((uint64_t)symoff+symsize > len) )
+      continue;
+
+    const uint8_t* strsh = &buf[shoff + strndx*shentsize];
+    uint32_t stroff = _FPDKIMAGE_Rd32(&strsh[16]);
+    uint32_t strsize = _FPDKIMAGE_Rd32(&strsh[20]);
+    if( (uint64_t)stroff+strsize > len )
+      continue;
+
+    uint32_t count = symsize/16;
+    FPDKIMAGESYMBOL* syms = realloc(img->symbols, (img->symbolcount+count)*sizeof(FPDKIMAGESYMBOL));
+    if( !syms )
+      return;
+    img->symbols = syms;
+
+    for( uint32_t i=0; i<count; i++ )
+    {
+      const uint8_t* sym = &buf[symoff + i*16];
+      uint32_t name = _FPDKIMAGE_Rd32(&sym[0]);
+      if( !name || (name>=strsize) )
+        continue;
+
+      FPDKIMAGESYMBOL* out = &img->symbols[img->symbolcount++];
+      const uint8_t* term = memchr(&buf[stroff+name], 0, strsize-name);
+      size_t n = term?(size_t)(term-&buf[stroff+name]):(strsize-name);
+      if( n>=sizeof(out->name) )
+        n = sizeof(out->name)-1;
+      memcpy(out->name, &buf[stroff+name], n);
+      out->name[n] = 0;
+      out->addr = _FPDKIMAGE_Rd32(&sym[4]);
+    }
+  }
+}
+
+static int _FPDKIMAGE_LoadElf(const uint8_t* buf, const size_t len, FPDKIMAGE* img)
+{
+  if( (1 != buf[4]) || (1 != buf[5]) )                                                             //ELFCLASS32, ELFDATA2LSB
+    return -2;
+
+  uint32_t phoff = _FPDKIMAGE_Rd32(&buf[28]);
+  uint32_t shoff = _FPDKIMAGE_Rd32(&buf[32]);
+  uint32_t phentsize = _FPDKIMAGE_Rd16(&buf[42]);
+  uint32_t phnum = _FPDKIMAGE_Rd16(&buf[44]);
+  uint32_t shentsize = _FPDKIMAGE_Rd16(&buf[46]);
+  uint32_t shnum = _FPDKIMAGE_Rd16(&buf[48]);
+
+  if( phnum && ((phentsize<32) || ((uint64_t)phoff+phnum*phentsize > len)) )
+    return -2;
+  if( shnum && ((shentsize<40) || ((uint64_t)shoff+shnum*shentsize > len)) )
+    return -2;
+
+  bool loaded = false;
+  for( uint32_t i=0; i<phnum; i++ )
+  {
+    const uint8_t* ph = &buf[phoff + i*phentsize];
+    uint32_t filesz = _FPDKIMAGE_Rd32(&ph[16]);
+    if( (ELF_PT_LOAD != _FPDKIMAGE_Rd32(&ph[0])) || !filesz )
+      continue;
+    if( _FPDKIMAGE_ElfCopy(buf, len, img, _FPDKIMAGE_Rd32(&ph[4]), filesz, _FPDKIMAGE_Rd32(&ph[12])) < 0 )   //file offset, size, physical address
+      return -2;
+    loaded = true;
+  }
+
+  for( uint32_t i=0; (i<shnum) && !loaded; i++ )                                                   //no program headers: use allocated sections
+  {
+    const uint8_t* sh = &buf[shoff + i*shentsize];
+    uint32_t size = _FPDKIMAGE_Rd32(&sh[20]);
+    if( (ELF_SHT_PROGBITS != _FPDKIMAGE_Rd32(&sh[4])) || !(ELF_SHF_ALLOC & _FPDKIMAGE_Rd32(&sh[8])) || !size )
+      continue;
+    if( _FPDKIMAGE_ElfCopy(buf, len, img, _FPDKIMAGE_Rd32(&sh[16]), size, _FPDKIMAGE_Rd32(&sh[12])) < 0 )
+      return -2;
+  }
+
+  _FPDKIMAGE_ElfSymbols(buf, len, img, shoff, shentsize, shnum);
+  return 0;
+}
+
+////
+////////
+////
+
+static const FPDKIMAGELOADER _fpdk_image_loaders[] = {
+  { "elf",   _FPDKIMAGE_ProbeElf,  _FPDKIMAGE_LoadElf  },
+  { "srec",  _FPDKIMAGE_ProbeSRec, _FPDKIMAGE_LoadSRec },
+  { "ihex",  _FPDKIMAGE_ProbeIHex, _FPDKIMAGE_LoadIHex },
+  { 0 }
+};
+
+uint16_t FPDKIMAGE_GetRegions(const uint16_t* data, const uint32_t datcount, const uint32_t align, const uint32_t gap,
+                              FPDKIMAGEREGION* regions, const uint16_t maxregions)
+{
+  uint16_t count = 0;
+  for( uint32_t p=0; p<datcount; )
+  {
+    if( !(data[p] & 0xFF00) )
+    {
+      p++;
+      continue;
+    }
+
+    uint32_t start = p;
+    while( (p<datcount) && (data[p] & 0xFF00) )
+      p++;
+
+    if( align>1 )                                                                                  //extend to complete blocks
+    {
+      start -= start%align;
+      p = ((p+align-1)/align)*align;
+      if( p>datcount )
+        p = datcount;
+    }
+
+    if( count && (start <= (regions[count-1].start + regions[count-1].len + gap)) )                //merge with previous region (small gap / same block)
+    {
+      regions[count-1].len = p - regions[count-1].start;
+      continue;
+    }
+
+    if( count>=maxregions )                                                                        //no more regions: last one covers rest
+    {
+      uint32_t last = datcount;
+      while( (last>p) && !(data[last-1] & 0xFF00) )
+        last--;
+      if( align>1 )
+        last = ((last+align-1)/align)*align;
+      if( last>datcount )
+        last = datcount;
+      regions[count-1].len = last - regions[count-1].start;
+      break;
+    }
+
+    regions[count].start = start;
+    regions[count].len = p - start;
+    count++;
+  }
+  return count;
+}
+
+int FPDKIMAGE_ReadFile(const char* filename, uint16_t* datout, const uint32_t datcount, FPDKIMAGE* img)
+{
+  memset(img, 0, sizeof(FPDKIMAGE));
+  memset(datout, 0, sizeof(uint16_t)*datcount);
+  img->data = datout;
+  img->datcount = datcount;
+
+  FILE *fin = fopen(filename, "rb");
+  if( !fin )
+    return -1;
+
+  uint8_t* buf = 0;
+  size_t len = 0, size = 0;
+  for( ;; )
+  {
+    if( len == size )
+    {
+      size = size?(2*size):0x10000;
+      uint8_t* nbuf = realloc(buf, size);
+      if( !nbuf )
+      {
+        free(buf);
+        buf = 0;
+        break;
+      }
+      buf = nbuf;
+    }
+    size_t r = fread(&buf[len], 1, size-len, fin);
+    if( !r )
+      break;
+    len += r;
+  }
+
+  bool berr = ferror(fin) || !buf;
+  fclose(fin);
+  if( berr )
+  {
+    free(buf);
+    return -1;
+  }
+
+  int ret = -2;
+  for( const FPDKIMAGELOADER* l=_fpdk_image_loaders; l->name; l++ )
+  {
+    if( l->probe(buf, len) )
+    {
+      img->format = l->name;
+      ret = l->load(buf, len, img);
+      break;
+    }
+  }
+  free(buf);
+
+  if( ret<0 )
+  {
+    FPDKIMAGE_Free(img);
+    return ret;
+  }
+
+  img->regioncount = FPDKIMAGE_GetRegions(datout, datcount, 1, 0, img->regions, FPDKIMAGE_MAX_REGIONS);
+  return 0;
+}
+
+void FPDKIMAGE_Free(FPDKIMAGE* img)
+{
+  free(img->symbols);
+  img->symbols = 0;
+  img->symbolcount = 0;
+}
+
+bool FPDKIMAGE_FindSymbol(const FPDKIMAGE* img, const char* name, uint32_t* addr)
+{
+  for( uint32_t i=0; i<img->symbolcount; i++ )
+  {
+    if( !strcmp(img->symbols[i].name, name) )
+    {
+      *addr = img->symbols[i].addr;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,60 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __FPDKIMAGE_H_
+#define __FPDKIMAGE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FPDKIMAGE_MAX_REGIONS  64
+#define FPDKIMAGE_SYMBOL_NAME  48
+
+typedef struct FPDKIMAGEREGION
+{
+  uint32_t start;                                                                                  //byte address
+  uint32_t len;                                                                                    //bytes
+
+} FPDKIMAGEREGION;
+
+typedef struct FPDKIMAGESYMBOL
+{
+  char     name[FPDKIMAGE_SYMBOL_NAME];
+  uint32_t addr;
+
+} FPDKIMAGESYMBOL;
+
+typedef struct FPDKIMAGE
+{
+  const char*      format;                                                                         //name of loader which read the file
+  uint16_t*        data;                                                                           //buffer of caller: 0x100+byte for every loaded byte, 0: no data
+  uint32_t         datcount;
+  FPDKIMAGEREGION  regions[FPDKIMAGE_MAX_REGIONS];                                                 //populated address ranges
+  uint16_t         regioncount;
+  FPDKIMAGESYMBOL* symbols;                                                                        //only ELF input has symbols
+  uint32_t         symbolcount;
+
+} FPDKIMAGE;
+
+int      FPDKIMAGE_ReadFile(const char* filename, uint16_t* datout, const uint32_t datcount, FPDKIMAGE* img);
+void     FPDKIMAGE_Free(FPDKIMAGE* img);
+
+bool     FPDKIMAGE_FindSymbol(const FPDKIMAGE* img, const char* name, uint32_t* addr);
+
+uint16_t FPDKIMAGE_GetRegions(const uint16_t* data, const uint32_t datcount, const uint32_t align, const uint32_t gap,
+                              FPDKIMAGEREGION* regions, const uint16_t maxregions);
+
+#endif //__FPDKIMAGE_H_
@@ -0,0 +1,113 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "fpdkplan.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FPDKPLAN_MAGIC "FPDKPLN1"
+
+//file: header, plan struct as is (plan files are bound to the build which created them, like calibration caches), CRC32 of both
+typedef struct FPDKPLANHDR
+{
+  char     magic[8];
+  uint32_t plansize;                                                                               //sizeof(FPDKPLAN)
+
+} FPDKPLANHDR;
+
+typedef struct FPDKPLANFILE
+{
+  FPDKPLANHDR hdr;
+  FPDKPLAN    plan;
+  uint32_t    crc;
+
+} FPDKPLANFILE;
+
+static uint32_t _FPDKPLAN_CRC32(const uint8_t* dat, const size_t len)
+{
+  static uint32_t table[256];
+  if( !table[1] )
+  {
+    for( uint32_t i=0; i<256; i++ )
+    {
+      uint32_t c = i;
+      for( int k=0; k<8; k++ )
+        c = (c&1)?(0xEDB88320UL^(c>>1)):(c>>1);
+      table[i] = c;
+    }
+  }
+
+  uint32_t crc = 0xFFFFFFFFUL;
+  for( size_t i=0; i<len; i++ )
+    crc = table[(crc^dat[i])&0xFF] ^ (crc>>8);
+  return crc ^ 0xFFFFFFFFUL;
+}
+
+bool FPDKPLAN_IsPlanFile(const char* filename)
+{
+  FILE *fin = fopen(filename, "rb");
+  if( !fin )
+    return false;
+
+  char magic[8];
+  bool isplan = (1 == fread(magic, sizeof(magic), 1, fin)) && !memcmp(magic, FPDKPLAN_MAGIC, sizeof(magic));
+  fclose(fin);
+  return isplan;
+}
+
+int FPDKPLAN_ReadFile(const char* filename, FPDKPLAN* plan)
+{
+  FILE *fin = fopen(filename, "rb");
+  if( !fin )
+    return -1;
+
+  static FPDKPLANFILE file;                                                                        //complete plan is read at once
+  size_t r = fread(&file, 1, sizeof(file), fin);
+  fclose(fin);
+
+  if( (sizeof(file) != r) || memcmp(file.hdr.magic, FPDKPLAN_MAGIC, sizeof(file.hdr.magic)) || (sizeof(FPDKPLAN) != file.hdr.plansize) )
+    return -2;
+
+  if( file.crc != _FPDKPLAN_CRC32((const uint8_t*)&file, offsetof(FPDKPLANFILE, crc)) )
+    return -3;
+
+  memcpy(plan, &file.plan, sizeof(FPDKPLAN));
+  return 0;
+}
+
+int FPDKPLAN_WriteFile(const char* filename, const FPDKPLAN* plan)
+{
+  static FPDKPLANFILE file;
+  memset(&file, 0, sizeof(file));                                                                  //padding bytes are part of CRC, keep them reproducible
+  memcpy(file.hdr.magic, FPDKPLAN_MAGIC, sizeof(file.hdr.magic));
+  file.hdr.plansize = sizeof(FPDKPLAN);
+  memcpy(&file.plan, plan, sizeof(FPDKPLAN));
+  file.crc = _FPDKPLAN_CRC32((const uint8_t*)&file, offsetof(FPDKPLANFILE, crc));
+
+  FILE *fout = fopen(filename, "wb");
+  if( !fout )
+    return -1;
+
+  bool berr = (1 != fwrite(&file, sizeof(file), 1, fout));
+  fclose(fout);
+
+  if( berr )
+    return -2;
+
+  return 0;
+}
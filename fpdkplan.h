@@ -0,0 +1,47 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef __FPDKPLAN_H_
+#define __FPDKPLAN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fpdkicdata.h"
+#include "fpdkiccalib.h"
+#include "fpdkimage.h"
+
+#define FPDKPLAN_MAX_CODE 0x1800
+
+//everything "write" needs, prepared once by "compile": image with calibration code inserted, regions to write, calibration sites
+typedef struct FPDKPLAN
+{
+  FPDKICDATA      icdata;
+  uint16_t        fuse;                                                                            //0xFFFF: no fuse
+  uint32_t        len;                                                                             //bytes to consider for calibration search / secure fill
+  uint16_t        regioncount;
+  FPDKIMAGEREGION regions[FPDKIMAGE_MAX_REGIONS];
+  uint16_t        calibcount;
+  FPDKCALIBSITE   calib[FPDKCALIB_MAX_SITES];
+  uint8_t         data[FPDKPLAN_MAX_CODE];
+
+} FPDKPLAN;
+
+bool FPDKPLAN_IsPlanFile(const char* filename);
+int  FPDKPLAN_ReadFile(const char* filename, FPDKPLAN* plan);
+int  FPDKPLAN_WriteFile(const char* filename, const FPDKPLAN* plan);
+
+#endif //__FPDKPLAN_H_
@@ -19,6 +19,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 
 const char FPDK_ERR_MSG[16][64] = {
   "?", //0xFFF0
@@ -30,7 +32,7 @@ const char FPDK_ERR_MSG[16][64] = {
   "?", //0xFFF6
   "?", //0xFFF7
   "?", //0xFFF8
-  "?", //0xFFF9
+  "operation aborted",                //0xFFF9
   "chip is not blank",                //0xFFFA
   "verify failed",                    //0xFFFB
   "command ack failed / wrong icid",  //0xFFFC
@@ -121,6 +123,86 @@ void fpdkutil_waitfdorkeypress(const int fd, const int timeout)
   poll(fds, 2, timeout);
 }
 
+uint64_t fpdkutil_getMicroTicks(void)
+{
+  struct timespec spec;
+  clock_gettime(CLOCK_MONOTONIC, &spec);
+  return( ((uint64_t)spec.tv_sec*1000000) + (spec.tv_nsec / 1000) );
+}
+
+//stdout shares the (non blocking) file description with stdin on a terminal, so output is buffered
+//here and written whenever poll reports stdout writable instead of risking EAGAIN in stdio
+static uint8_t  _outbuf[0x10000];
+static uint32_t _outlen;
+static int      _outerr;                                                                           //errno of failed write, further output is discarded
+
+static void _fpdkutil_out_drain(void)
+{
+  uint32_t done = 0;
+  while( done < _outlen )
+  {
+    ssize_t w = write(STDOUT_FILENO, &_outbuf[done], _outlen-done);
+    if( (w < 0) && (EINTR == errno) )
+      continue;
+    if( (w < 0) && (EAGAIN != errno) && (EWOULDBLOCK != errno) )                                   //EIO, ENOSPC, EPIPE, ...: output is lost, don't wait for it forever
+    {
+      _outerr = errno;
+      _outlen = 0;
+      return;
+    }
+    if( w <= 0 )
+      break;                                                                                       //EAGAIN: remaining part is written on next POLLOUT
+    done += w;
+  }
+  memmove(_outbuf, &_outbuf[done], _outlen-done);
+  _outlen -= done;
+}
+
+static void _fpdkutil_out_wait(void)
+{
+  struct pollfd fds = {.fd=STDOUT_FILENO, .events=POLLOUT};
+  poll(&fds, 1, 100);
+  _fpdkutil_out_drain();
+}
+
+void fpdkutil_out_write(const uint8_t* dat, const uint32_t len)
+{
+  fflush(stdout);                                                                                  //keep order with printf output
+  if( _outerr )
+    return;
+  for( uint32_t p=0; (p<len) && !_outerr; )
+  {
+    if( _outlen == sizeof(_outbuf) )
+      _fpdkutil_out_wait();
+
+    uint32_t chunk = len-p;
+    if( chunk > (sizeof(_outbuf)-_outlen) )
+      chunk = sizeof(_outbuf)-_outlen;
+    memcpy(&_outbuf[_outlen], &dat[p], chunk);
+    _outlen += chunk;
+    p += chunk;
+  }
+}
+
+int fpdkutil_out_flush(void)
+{
+  while( _outlen )
+    _fpdkutil_out_wait();
+  return -_outerr;
+}
+
+int fpdkutil_waitevents(const int fd, const bool waitkey, const int timeout)
+{
+  struct pollfd fds[3] = {{.fd=fd, .events=POLLIN}, {.fd=STDIN_FILENO, .events=waitkey?POLLIN:0}, {.fd=STDOUT_FILENO, .events=_outlen?POLLOUT:0} };
+  if( poll(fds, 3, timeout) <= 0 )
+    return 0;
+
+  if( fds[2].revents & POLLOUT )
+    _fpdkutil_out_drain();
+
+  return ((fds[0].revents & POLLIN)?FPDKUTIL_EV_FD:0) | ((fds[1].revents & POLLIN)?FPDKUTIL_EV_KEY:0);
+}
+
 #elif defined(_WIN32)
 #include <windows.h>
 #include <conio.h>
@@ -147,6 +229,43 @@ unsigned long fpdkutil_getTickCount(void)
   return GetTickCount();
 }
 
+uint64_t fpdkutil_getMicroTicks(void)
+{
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return( (count.QuadPart / freq.QuadPart) * 1000000 + ((count.QuadPart % freq.QuadPart) * 1000000) / freq.QuadPart );
+}
+
+void fpdkutil_out_write(const uint8_t* dat, const uint32_t len)
+{
+  fwrite(dat, 1, len, stdout);
+}
+
+int fpdkutil_out_flush(void)
+{
+  if( fflush(stdout) || ferror(stdout) )
+    return -(errno?errno:EIO);
+  return 0;
+}
+
+int fpdkutil_waitevents(const int fd, const bool waitkey, const int timeout)
+{
+  fflush(stdout);
+  DWORD dwEndTick = GetTickCount() + timeout;
+  for( ;; )
+  {
+    DWORD dwError;
+    COMSTAT stat;
+    ClearCommError( (HANDLE)fd, &dwError, &stat );
+    int ev = (stat.cbInQue?FPDKUTIL_EV_FD:0) | ((waitkey && _kbhit())?FPDKUTIL_EV_KEY:0);
+    if( ev || (GetTickCount()>=dwEndTick) )
+      return ev;
+
+    Sleep(1);
+  }
+}
+
 void fpdkutil_waitfdorkeypress(const int fd, const int timeout)
 {
   DWORD dwEndTick = GetTickCount() + timeout;
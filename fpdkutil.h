@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define _POSIX_C_SOURCE 200809L
 
 #include <stdint.h>
+#include <stdbool.h>
 
 const char FPDK_ERR_MSG[16][64];
 
@@ -29,6 +30,13 @@ int  verbose_printf(char *format, ...);
 void          fpdkutil_waitfdorkeypress(const int fd, const int timeout);
 int           fpdkutil_getchar(void);
 unsigned long fpdkutil_getTickCount(void);
+uint64_t      fpdkutil_getMicroTicks(void);                                                      //monotonic, for timestamps
+
+#define FPDKUTIL_EV_FD  1
+#define FPDKUTIL_EV_KEY 2
+int           fpdkutil_waitevents(const int fd, const bool waitkey, const int timeout);           //returns FPDKUTIL_EV_xxx, writes buffered output meanwhile
+void          fpdkutil_out_write(const uint8_t* dat, const uint32_t len);                         //buffered binary safe stdout
+int           fpdkutil_out_flush(void);                                                           //0 or -errno of failed write (output discarded)
 
 //DEL void          fpdkutil_usleep(int64_t usec);
 
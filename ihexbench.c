@@ -0,0 +1,86 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "fpdkihex8.h"
+
+//micro benchmark + check for FPDKIHEX8_ParseBuffer: synthetic image formatted as 32 byte records, parsed from memory
+
+#define BENCH_BYTES      0xC000                                                                    //48k bytes image (1536 records)
+#define BENCH_PASSES     500
+
+static uint8_t  _image[BENCH_BYTES];
+static uint16_t _parsed[BENCH_BYTES];
+static char     _hex[(BENCH_BYTES/32)*(1+2*(4+32+1)+2) + 16];
+
+static uint32_t _lcg = 12345;
+static uint8_t _BENCH_Random(void)
+{
+  _lcg = _lcg*1103515245 + 12345;
+  return _lcg>>16;
+}
+
+//CRLF line ends, mixed case hex digits: all paths of the table decoder are used
+static size_t _BENCH_Format(char* out)
+{
+  char* o = out;
+  for( uint32_t a=0; a<BENCH_BYTES; a+=32 )
+  {
+    uint8_t check = 32 + (a>>8) + a;
+    o += sprintf(o, ":20%04X00", a);
+    for( uint32_t i=0; i<32; i++ )
+    {
+      o += sprintf(o, (i&1)?"%02x":"%02X", _image[a+i]);
+      check += _image[a+i];
+    }
+    o += sprintf(o, "%02X\r\n", (uint8_t)-check);
+  }
+  o += sprintf(o, ":00000001FF\r\n");
+  return o-out;
+}
+
+int main( int argc, const char * argv [] )
+{
+  for( uint32_t i=0; i<BENCH_BYTES; i++ )
+    _image[i] = _BENCH_Random();
+  size_t len = _BENCH_Format(_hex);
+
+  int r = 0;
+  clock_t start = clock();
+  for( uint32_t p=0; p<BENCH_PASSES; p++ )
+    r |= FPDKIHEX8_ParseBuffer(_hex, len, _parsed, BENCH_BYTES);
+  double secs = (double)(clock()-start)/CLOCKS_PER_SEC;
+
+  int fail = (0 != r);
+  for( uint32_t i=0; (i<BENCH_BYTES) && !fail; i++ )
+  {
+    if( _parsed[i] != (0x100 + _image[i]) )
+    {
+      printf("FAIL: byte 0x%04X is 0x%03X, expected 0x%03X\n", i, _parsed[i], 0x100 + _image[i]);
+      fail = 1;
+    }
+  }
+
+  printf("%s: %d bytes hex (%d bytes data), %.2f us per file, %.1f MB/s (%d passes)\n", fail?"FAIL":"OK", (int)len, BENCH_BYTES,
+         secs*1000000.0/BENCH_PASSES, secs?((double)len*BENCH_PASSES/secs/1000000.0):0.0, BENCH_PASSES);
+
+  return fail?-1:0;
+}
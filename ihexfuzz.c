@@ -0,0 +1,148 @@
+/*
+Copyright (C) 2019  freepdk  https://free-pdk.github.io
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "fpdkihex8.h"
+
+//fuzz harness for FPDKIHEX8_ParseBuffer
+//  libFuzzer:  clang -g -O1 -std=c99 -fsanitize=fuzzer,address -DFPDKIHEX8_LIBFUZZER ihexfuzz.c fpdkihex8.c
+//  standalone: ./ihexfuzz [ITERATIONS] [FILE...]  (mutates built in seeds, FILEs are parsed once, e.g. crash reproducers)
+
+#define FUZZ_DATCOUNT 0x1800
+
+static uint16_t _fuzzdat[FUZZ_DATCOUNT];
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+  char* buf = malloc(size?size:1);                                                                 //exact size: sanitizers catch reads behind the end
+  if( !buf )
+    return 0;
+  memcpy(buf, data, size);
+
+  int r = FPDKIHEX8_ParseBuffer(buf, size, _fuzzdat, FUZZ_DATCOUNT);
+  free(buf);
+
+  if( (0 != r) && (-2 != r) )
+    abort();
+  for( uint32_t i=0; i<FUZZ_DATCOUNT; i++ )                                                        //0: unused, 0x100+val: data
+  {
+    if( _fuzzdat[i] && ((_fuzzdat[i]<0x100) || (_fuzzdat[i]>0x1FF)) )
+      abort();
+  }
+  return 0;
+}
+
+#ifndef FPDKIHEX8_LIBFUZZER
+
+static const char* _fuzz_seeds[] = {
+  ":0400000001020304F2\n:00000001FF\n",
+  ":10000000000102030405060708090A0B0C0D0E0F78\r\n:0400100010111213A6\r\n:00000001FF\r\n",
+  ":020000040000FA\n:020000020000FC\n:0400000001020304F2\n",
+  ":0400000001020304F2",
+};
+
+static const char _fuzz_alphabet[] = ":0123456789ABCDEFabcdef\r\n \0\xFF";
+
+static uint32_t _lcg = 12345;
+static uint32_t _FUZZ_Random(void)
+{
+  _lcg = _lcg*1103515245 + 12345;
+  return _lcg>>8;
+}
+
+//byte flip, replace with hex alphabet, insert, delete, truncate
+static size_t _FUZZ_Mutate(uint8_t* buf, size_t len, const size_t max)
+{
+  uint32_t n = 1 + (_FUZZ_Random()%4);
+  for( uint32_t m=0; m<n; m++ )
+  {
+    size_t pos = len?(_FUZZ_Random()%len):0;
+    switch( _FUZZ_Random()%5 )
+    {
+      case 0: if( len ) buf[pos] ^= 1<<(_FUZZ_Random()%8); break;
+      case 1: if( len ) buf[pos] = _fuzz_alphabet[_FUZZ_Random()%(sizeof(_fuzz_alphabet)-1)]; break;
+      case 2:
+        if( len<max )
+        {
+          memmove(&buf[pos+1], &buf[pos], len-pos);
+          buf[pos] = _fuzz_alphabet[_FUZZ_Random()%(sizeof(_fuzz_alphabet)-1)];
+          len++;
+        }
+        break;
+      case 3:
+        if( len )
+        {
+          memmove(&buf[pos], &buf[pos+1], len-pos-1);
+          len--;
+        }
+        break;
+      case 4: len = pos; break;
+    }
+  }
+  return len;
+}
+
+int main( int argc, const char * argv [] )
+{
+  uint32_t iterations = (argc>1)?strtoul(argv[1], NULL, 0):200000;
+
+  for( int a=2; a<argc; a++ )
+  {
+    FILE* f = fopen(argv[a], "rb");
+    if( !f )
+    {
+      printf("ERROR: Could not read file: %s\n", argv[a]);
+      return -1;
+    }
+    static uint8_t fbuf[0x100000];
+    size_t len = fread(fbuf, 1, sizeof(fbuf), f);
+    fclose(f);
+    LLVMFuzzerTestOneInput(fbuf, len);
+  }
+
+  //all seeds are valid files
+  for( uint32_t s=0; s<sizeof(_fuzz_seeds)/sizeof(_fuzz_seeds[0]); s++ )
+  {
+    if( 0 != FPDKIHEX8_ParseBuffer(_fuzz_seeds[s], strlen(_fuzz_seeds[s]), _fuzzdat, FUZZ_DATCOUNT) )
+    {
+      printf("FAIL: seed %d does not parse\n", s);
+      return -1;
+    }
+  }
+
+  static uint8_t buf[1024];
+  uint32_t accepted = 0;
+  for( uint32_t i=0; i<iterations; i++ )
+  {
+    const char* seed = _fuzz_seeds[i%(sizeof(_fuzz_seeds)/sizeof(_fuzz_seeds[0]))];
+    size_t len = strlen(seed);
+    memcpy(buf, seed, len);
+    len = _FUZZ_Mutate(buf, len, sizeof(buf));
+    LLVMFuzzerTestOneInput(buf, len);
+    if( 0 == FPDKIHEX8_ParseBuffer((const char*)buf, len, _fuzzdat, FUZZ_DATCOUNT) )
+      accepted++;
+  }
+
+  printf("OK: %d mutated inputs (%d accepted)\n", iterations, accepted);
+  return 0;
+}
+
+#endif //FPDKIHEX8_LIBFUZZER